@@ -0,0 +1,86 @@
+#pragma once
+#ifndef ALLOCATIONCOUNTER_H
+#define ALLOCATIONCOUNTER_H
+
+#include <cstdlib>
+#include <new>
+
+/*
+	Counts the heap allocations each thread makes, so the simulation can check that stepping the physics doesn't make any
+	(whatever the GUI thread happens to be allocating at the same time).
+
+	Counting means replacing the global operator new, which is a whole program decision, so it is only switched on in Debug
+	builds (or by defining ORBYTE_COUNT_ALLOCATIONS). Everywhere else Count() stays at 0 and costs nothing.
+	Only include this header from one .cpp file: the replacement operators are defined here.
+*/
+#if defined(_DEBUG) && !defined(ORBYTE_COUNT_ALLOCATIONS)
+#define ORBYTE_COUNT_ALLOCATIONS
+#endif
+
+class AllocationCounter
+{
+public:
+	// Function local so it is constant initialised before anything can allocate
+	static long long& Counter()
+	{
+		static thread_local long long counter = 0;
+		return counter;
+	}
+
+	/// <summary>
+	/// Allocations made by the calling thread so far. Take the difference either side of a piece of code to see how many it made.
+	/// </summary>
+	static long long Count()
+	{
+		return Counter();
+	}
+
+	static bool Enabled()
+	{
+#ifdef ORBYTE_COUNT_ALLOCATIONS
+		return true;
+#else
+		return false;
+#endif
+	}
+};
+
+#ifdef ORBYTE_COUNT_ALLOCATIONS
+void* operator new(std::size_t size)
+{
+	AllocationCounter::Counter()++;
+	void* p = std::malloc(size > 0 ? size : 1);
+	if (p == NULL)
+	{
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void* operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
+#endif
+
+#endif /*ALLOCATIONCOUNTER_H*/
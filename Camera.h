@@ -77,6 +77,18 @@ public:
 		
 	}
 
+	// The rotation rotate() applies for the camera's rotation, as a row-major 3x3 matrix, so a great many points (test
+	// particles) can be turned with nine multiplies each rather than six trig calls
+	void Rotation_Matrix(double m[9])
+	{
+		float rx = camera_rotation.x, ry = camera_rotation.y, rz = camera_rotation.z; // Same precision as rotate()
+		double cx = std::cos(rx), sx = std::sin(rx), cy = std::cos(ry), sy = std::sin(ry), cz = std::cos(rz), sz = std::sin(rz);
+		// Rz * Ry * Rx
+		m[0] = cz * cy; m[1] = cz * sy * sx - sz * cx; m[2] = cz * sy * cx + sz * sx;
+		m[3] = sz * cy; m[4] = sz * sy * sx + cz * cx; m[5] = sz * sy * cx - cz * sx;
+		m[6] = -sy;     m[7] = cy * sx;                m[8] = cy * cx;
+	}
+
 	vector3 WorldSpaceToScreenSpace(vector3 world_pos, float screen_height, float screen_width)
 	{
 		//manipulate world_pos here such that it is rotated around centre of universe
@@ -0,0 +1,374 @@
+#pragma once
+#ifndef COLLISIONS_H
+#define COLLISIONS_H
+
+#include <vector>
+#include <string>
+#include <cmath>
+#include <algorithm>
+#include "PhysicsState.h"
+
+/*
+	Finds bodies that touched during the last step (each body is a sphere of PhysicsStore::radius) and does something about it.
+
+	Broad phase: a spatial hash. Each body is swept from where it was at the start of the step to where it is now, and the
+	sphere around that whole path is dropped into a uniform grid of cells as wide as the biggest such sphere. Touching bodies
+	must then share a cell or sit in neighbouring ones, so each body is only tested against the few in its 27 surrounding cells
+	rather than everyone: near linear in the number of bodies, as long as they aren't all piled into the same cell.
+	Cells are bucketed by hash with a counting sort, so once the buffers have grown nothing here touches the heap.
+
+	Narrow phase: both bodies are taken to move in a straight line over the step, and tested at their closest approach. At
+	large time scales a body can cover many times its own size in one step, so only testing where it ends up would let it
+	pass straight through another.
+
+	The central body sits at the origin and isn't in the store, so it is tested separately with central_radius.
+*/
+class CollisionDetector
+{
+public:
+	enum Response
+	{
+		OFF,
+		MERGE, // The lighter body is absorbed into the heavier: mass, momentum and volume are all kept
+		BOUNCE, // Bodies push apart, with restitution deciding how much of their closing speed they keep
+		RESPONSE_COUNT
+	};
+
+	Response response = OFF;
+	double restitution = 1; // BOUNCE: 1 = perfectly elastic, 0 = they stop dead along the line between them
+	double central_radius = 0; // Radius of the central body, 0 to let bodies pass through it
+
+private:
+	// Swept sphere of every slot for this step. reach < 0 => the body has no size and can't collide.
+	std::vector<double> cx, cy, cz, reach;
+	std::vector<long long> gx, gy, gz; // Cell coordinates
+	std::vector<int> bucket_start; // Bucket -> first entry of sorted, bucket_start[b + 1] is one past its last
+	std::vector<int> sorted; // Slots, ordered by bucket
+	std::vector<int> bucket; // Slot -> bucket
+
+	// Contacts found this step
+	struct Contact
+	{
+		int i, j; // Slots (j = -1 for the central body)
+		double t; // When they touch, as a fraction of the step
+	};
+	std::vector<Contact> contacts;
+	std::vector<char> absorbed; // Slot -> absorbed by another body already this step
+	std::vector<int> doomed; // Handles to remove at the end
+
+	int last_collisions = 0;
+
+	static long long Cell(double v, double size)
+	{
+		return (long long)floor(v / size);
+	}
+
+	int Bucket(long long x, long long y, long long z, int mask)
+	{
+		unsigned long long h = (unsigned long long)x * 73856093ULL ^ (unsigned long long)y * 19349663ULL ^ (unsigned long long)z * 83492791ULL;
+		return (int)(h & (unsigned long long)mask);
+	}
+
+	// Closest approach of two points moving in straight lines over the step. p0 = relative position at the start, p1 at the end.
+	static double Closest_Approach(double p0x, double p0y, double p0z, double p1x, double p1y, double p1z, double& t)
+	{
+		double dx = p1x - p0x, dy = p1y - p0y, dz = p1z - p0z;
+		double d2 = dx * dx + dy * dy + dz * dz;
+		t = d2 > 0 ? -(p0x * dx + p0y * dy + p0z * dz) / d2 : 1;
+		t = std::min(1.0, std::max(0.0, t));
+		double x = p0x + dx * t, y = p0y + dy * t, z = p0z + dz * t;
+		return x * x + y * y + z * z;
+	}
+
+	void Merge(PhysicsStore& store, int i, int j)
+	{
+		if (store.gm[j] > store.gm[i])
+		{
+			std::swap(i, j); // i survives
+		}
+		double mi = store.gm[i], mj = store.gm[j];
+		double m = mi + mj;
+		double wi = m > 0 ? mi / m : 0.5, wj = m > 0 ? mj / m : 0.5; // Two massless bodies just meet in the middle
+
+		store.x[i] = store.x[i] * wi + store.x[j] * wj;
+		store.y[i] = store.y[i] * wi + store.y[j] * wj;
+		store.z[i] = store.z[i] * wi + store.z[j] * wj;
+		store.vx[i] = store.vx[i] * wi + store.vx[j] * wj;
+		store.vy[i] = store.vy[i] * wi + store.vy[j] * wj;
+		store.vz[i] = store.vz[i] * wi + store.vz[j] * wj;
+		store.gm[i] = m;
+		store.radius[i] = cbrt(store.radius[i] * store.radius[i] * store.radius[i] + store.radius[j] * store.radius[j] * store.radius[j]);
+		store.Refresh_Orbit(store.handle_of_slot[i]);
+
+		// j's satellites carry on around the survivor. If the survivor was one of them, it takes j's place around j's parent.
+		int survivor = store.handle_of_slot[i], gone = store.handle_of_slot[j];
+		for (int k = 0; k < store.Size(); k++)
+		{
+			if (store.parent[k] == gone)
+			{
+				store.Set_Parent(store.handle_of_slot[k], k == i ? store.parent[j] : survivor);
+			}
+		}
+
+		absorbed[j] = 1;
+		doomed.push_back(gone);
+	}
+
+	void Bounce(PhysicsStore& store, int i, int j)
+	{
+		double nx = store.x[j] - store.x[i], ny = store.y[j] - store.y[i], nz = store.z[j] - store.z[i];
+		double d = sqrt(nx * nx + ny * ny + nz * nz);
+		if (d == 0)
+		{
+			return; // No line between them to bounce along
+		}
+		nx /= d; ny /= d; nz /= d;
+
+		// Share of the impulse each takes: inverse mass, with massless bodies taking all of it
+		double wi, wj;
+		if (store.gm[i] > 0 && store.gm[j] > 0)
+		{
+			wi = 1 / store.gm[i]; wj = 1 / store.gm[j];
+			double w = wi + wj;
+			wi /= w; wj /= w;
+		}
+		else
+		{
+			wi = store.gm[i] > 0 ? 0 : (store.gm[j] > 0 ? 1 : 0.5);
+			wj = 1 - wi;
+		}
+
+		double closing = (store.vx[j] - store.vx[i]) * nx + (store.vy[j] - store.vy[i]) * ny + (store.vz[j] - store.vz[i]) * nz;
+		if (closing < 0)
+		{
+			double dv = -(1 + restitution) * closing;
+			store.vx[i] -= nx * dv * wi; store.vy[i] -= ny * dv * wi; store.vz[i] -= nz * dv * wi;
+			store.vx[j] += nx * dv * wj; store.vy[j] += ny * dv * wj; store.vz[j] += nz * dv * wj;
+		}
+
+		// Push them apart until they just touch, so they don't collide again next step
+		double overlap = store.radius[i] + store.radius[j] - d;
+		if (overlap > 0)
+		{
+			store.x[i] -= nx * overlap * wi; store.y[i] -= ny * overlap * wi; store.z[i] -= nz * overlap * wi;
+			store.x[j] += nx * overlap * wj; store.y[j] += ny * overlap * wj; store.z[j] += nz * overlap * wj;
+		}
+		store.Refresh_Orbit(store.handle_of_slot[i]);
+		store.Refresh_Orbit(store.handle_of_slot[j]);
+	}
+
+	// Into the central body: absorbed when merging, reflected off its surface when bouncing. An absorbed body's satellites are
+	// left going round the central body (see PhysicsStore::Remove).
+	void Hit_Central(PhysicsStore& store, int i)
+	{
+		if (response == MERGE)
+		{
+			absorbed[i] = 1;
+			doomed.push_back(store.handle_of_slot[i]);
+			return;
+		}
+
+		double r = sqrt(store.x[i] * store.x[i] + store.y[i] * store.y[i] + store.z[i] * store.z[i]);
+		if (r == 0)
+		{
+			return;
+		}
+		double nx = store.x[i] / r, ny = store.y[i] / r, nz = store.z[i] / r;
+		double radial = store.vx[i] * nx + store.vy[i] * ny + store.vz[i] * nz;
+		if (radial < 0)
+		{
+			double dv = -(1 + restitution) * radial;
+			store.vx[i] += nx * dv; store.vy[i] += ny * dv; store.vz[i] += nz * dv;
+		}
+		double surface = central_radius + store.radius[i];
+		if (r < surface)
+		{
+			store.x[i] = nx * surface; store.y[i] = ny * surface; store.z[i] = nz * surface;
+		}
+		store.Refresh_Orbit(store.handle_of_slot[i]);
+	}
+
+public:
+	CollisionDetector()
+	{
+		// Collisions are rare, so make room up front rather than allocating in the middle of a step when one happens
+		contacts.reserve(256);
+		doomed.reserve(256);
+	}
+
+	/// <summary>
+	/// Find the bodies that touched during the last step and apply the response. Merged bodies are removed from the store.
+	/// </summary>
+	/// <param name="px">Positions at the start of the step (slot for slot with the store), or NULL to only test where bodies are now</param>
+	/// <returns>Number of collisions</returns>
+	int Resolve(PhysicsStore& store, const double* px, const double* py, const double* pz)
+	{
+		last_collisions = 0;
+		int n = store.Size();
+		if (response == OFF || n == 0)
+		{
+			return 0;
+		}
+		if (px == NULL)
+		{
+			px = store.x.data(); py = store.y.data(); pz = store.z.data();
+		}
+
+		// Swept spheres
+		cx.resize(n); cy.resize(n); cz.resize(n); reach.resize(n);
+		double biggest = 0;
+		for (int i = 0; i < n; i++)
+		{
+			double dx = store.x[i] - px[i], dy = store.y[i] - py[i], dz = store.z[i] - pz[i];
+			cx[i] = (store.x[i] + px[i]) / 2; cy[i] = (store.y[i] + py[i]) / 2; cz[i] = (store.z[i] + pz[i]) / 2;
+			reach[i] = store.radius[i] > 0 ? store.radius[i] + sqrt(dx * dx + dy * dy + dz * dz) / 2 : -1;
+			biggest = std::max(biggest, reach[i]);
+		}
+
+		contacts.clear();
+		absorbed.assign(n, 0);
+
+		// Central body: nothing to hash, it's one fixed sphere
+		if (central_radius > 0)
+		{
+			for (int i = 0; i < n; i++)
+			{
+				double t;
+				double r = central_radius + std::max(0.0, store.radius[i]);
+				if (Closest_Approach(px[i], py[i], pz[i], store.x[i], store.y[i], store.z[i], t) < r * r)
+				{
+					contacts.push_back({ i, -1, t });
+				}
+			}
+		}
+
+		// Broad phase: bucket every body that has a size by the cell its swept sphere's centre is in
+		if (biggest > 0 && n > 1)
+		{
+			double size = 2 * biggest; // Two spheres that touch can then be at most one cell apart
+			int buckets = 1;
+			while (buckets < 2 * n)
+			{
+				buckets <<= 1;
+			}
+			int mask = buckets - 1;
+			gx.resize(n); gy.resize(n); gz.resize(n);
+			bucket.resize(n);
+			bucket_start.assign(buckets + 1, 0);
+			for (int i = 0; i < n; i++)
+			{
+				if (reach[i] < 0)
+				{
+					continue;
+				}
+				gx[i] = Cell(cx[i], size); gy[i] = Cell(cy[i], size); gz[i] = Cell(cz[i], size);
+				bucket[i] = Bucket(gx[i], gy[i], gz[i], mask);
+				bucket_start[bucket[i]]++;
+			}
+			for (int b = 1; b <= buckets; b++)
+			{
+				bucket_start[b] += bucket_start[b - 1]; // Now the end of each bucket
+			}
+			sorted.resize(bucket_start[buckets]);
+			for (int i = n - 1; i >= 0; i--)
+			{
+				if (reach[i] >= 0)
+				{
+					sorted[--bucket_start[bucket[i]]] = i; // Counting sort: fill each bucket from its end, leaving its start behind
+				}
+			}
+
+			// Narrow phase against everything in the 27 cells around each body
+			for (int i = 0; i < n; i++)
+			{
+				if (reach[i] < 0)
+				{
+					continue;
+				}
+				for (int ox = -1; ox <= 1; ox++)
+				for (int oy = -1; oy <= 1; oy++)
+				for (int oz = -1; oz <= 1; oz++)
+				{
+					long long x = gx[i] + ox, y = gy[i] + oy, z = gz[i] + oz;
+					int b = Bucket(x, y, z, mask);
+					for (int k = bucket_start[b]; k < bucket_start[b + 1]; k++)
+					{
+						int j = sorted[k];
+						// Each pair once, and only from the cell j is really in (others can share its bucket)
+						if (j <= i || gx[j] != x || gy[j] != y || gz[j] != z)
+						{
+							continue;
+						}
+						double rx = cx[j] - cx[i], ry = cy[j] - cy[i], rz = cz[j] - cz[i];
+						double sum = reach[i] + reach[j];
+						if (rx * rx + ry * ry + rz * rz >= sum * sum)
+						{
+							continue; // Swept spheres don't even overlap
+						}
+						double t;
+						double touch = store.radius[i] + store.radius[j];
+						double d2 = Closest_Approach(px[j] - px[i], py[j] - py[i], pz[j] - pz[i], store.x[j] - store.x[i], store.y[j] - store.y[i], store.z[j] - store.z[i], t);
+						if (d2 < touch * touch)
+						{
+							contacts.push_back({ i, j, t });
+						}
+					}
+				}
+			}
+		}
+
+		if (contacts.empty())
+		{
+			return 0;
+		}
+
+		// Earliest first, so a body that hits two others in one step deals with the first one it reached
+		std::sort(contacts.begin(), contacts.end(), [](const Contact& a, const Contact& b) { return a.t < b.t; });
+		doomed.clear();
+		for (const Contact& c : contacts)
+		{
+			if (absorbed[c.i] || (c.j >= 0 && absorbed[c.j]))
+			{
+				continue; // Already gone this step. Whatever absorbed it will be tested again next step.
+			}
+			if (c.j < 0)
+			{
+				Hit_Central(store, c.i);
+			}
+			else if (response == MERGE)
+			{
+				Merge(store, c.i, c.j);
+			}
+			else
+			{
+				Bounce(store, c.i, c.j);
+			}
+			last_collisions++;
+		}
+
+		// Only now, as removing swaps slots around
+		for (int handle : doomed)
+		{
+			store.Remove(handle);
+		}
+		store.revision++; // Bodies were moved, their masses changed: nothing from before the collision is any good now
+		return last_collisions;
+	}
+
+	int Get_Last_Collisions()
+	{
+		return last_collisions;
+	}
+
+	static std::string Response_Name(Response r)
+	{
+		switch (r)
+		{
+		case MERGE: return "Merge";
+		case BOUNCE: return "Bounce";
+		default: return "Off";
+		}
+	}
+};
+
+#endif /*COLLISIONS_H*/
@@ -0,0 +1,121 @@
+#pragma once
+#ifndef COMMANDQUEUE_H
+#define COMMANDQUEUE_H
+
+#include <atomic>
+#include <thread>
+#include "vec3.h"
+
+/*
+	An edit for the simulation thread to make to its physics state or settings. Fixed size, so queueing one never allocates.
+*/
+struct PhysicsCommand
+{
+	enum Type
+	{
+		// Bodies (handle says which)
+		ADD_BODY, // a = position, b = velocity, value = G * mass, value2 = mu
+		REMOVE_BODY,
+		SET_POSITION, // a
+		SET_VELOCITY, // a
+		SET_GM, // value
+		SET_MU, // value
+		SET_ANALYTIC, // value = 1 to follow a fixed Kepler orbit, 0 to be integrated
+		SET_PARENT, // value = handle of the parent body, -1 for none
+		SET_RADIUS, // value
+		SET_SOFTENING, // value = softening length (m). Applies to every body, so handle is unused.
+
+		// Settings
+		SET_TIME_SCALE, // value
+		SET_METHOD, // value = SystemIntegrator::Method
+		SET_FORCE_MODE, // value = 1 for Barnes-Hut, 0 for direct sum. value2 = opening angle
+		SET_PHYSICS_RATE, // value = steps per real second
+		SET_TOLERANCE, // value = relative tolerance
+		SET_WORKERS, // value = worker thread count
+		SET_COLLISIONS, // value = CollisionDetector::Response, value2 = restitution, a.x = radius of the central body
+		SET_REGULARIZATION, // value = 1 to take close pairs out of the method's step and solve them as binaries, 0 not to
+		SET_FORCE_MODELS, // value = SelectableIntegrator::Forces, a = (J2 of the central body, its radius, radiation area to mass), b = (drag density, scale height, ballistic coefficient), value2 = radiation pressure at 1 AU
+		SET_TIMELINE, // value = Timeline::Retention, value2 = memory budget (MB)
+
+		// Test particles
+		ADD_BELT, // value = count, value2 = G * mass of the central body, a = (inner, outer semi-major axis, max eccentricity), b.x = max inclination, b.y = seed
+		ADD_RING, // handle = body to go around, value = count, a = (inner, outer radius, thickness), b.y = seed
+		CLEAR_PARTICLES,
+
+		// Timeline
+		SEEK, // value = simulated time to go to (s), within the timeline
+		WARP, // value = simulated time to go to (s), anywhere after now. value2 = step to take (s), 0 for the current one.
+		CANCEL_WARP
+	};
+
+	Type type;
+	int handle = -1;
+	vector3 a = { 0, 0, 0 };
+	vector3 b = { 0, 0, 0 };
+	double value = 0;
+	double value2 = 0;
+};
+
+/*
+	Single producer, single consumer ring buffer of commands: the GUI thread pushes, the simulation thread pops, and neither
+	ever takes a lock. Each side only writes its own index, and publishes it with a release store after the slot it covers is
+	written (push) or read (pop), so the other side sees whole commands or nothing.
+*/
+class CommandQueue
+{
+private:
+	static const int CAPACITY = 1024; // One slot is always left empty to tell full from empty
+
+	PhysicsCommand slots[CAPACITY];
+	std::atomic<int> head{ 0 }; // Next slot to pop. Written by the consumer only.
+	std::atomic<int> tail{ 0 }; // Next slot to push. Written by the producer only.
+	long long pushed = 0; // Producer side count
+	long long popped = 0; // Consumer side count
+
+public:
+	/// <summary>
+	/// Queue a command. Producer thread only. If the queue is full this waits for the consumer to make room.
+	/// </summary>
+	void Push(const PhysicsCommand& command)
+	{
+		int t = tail.load(std::memory_order_relaxed);
+		int next = (t + 1) % CAPACITY;
+		while (next == head.load(std::memory_order_acquire))
+		{
+			std::this_thread::yield(); // Full. The simulation thread drains the queue every loop, so this is short.
+		}
+		slots[t] = command;
+		tail.store(next, std::memory_order_release);
+		pushed++;
+	}
+
+	/// <summary>
+	/// Take the oldest command, if there is one. Consumer thread only.
+	/// </summary>
+	bool Pop(PhysicsCommand& command)
+	{
+		int h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire))
+		{
+			return false; // Empty
+		}
+		command = slots[h];
+		head.store((h + 1) % CAPACITY, std::memory_order_release);
+		popped++;
+		return true;
+	}
+
+	// Number of commands ever pushed. Producer thread only.
+	long long Pushed()
+	{
+		return pushed;
+	}
+
+	// Number of commands ever popped. Consumer thread only.
+	long long Popped()
+	{
+		return popped;
+	}
+};
+
+#endif /*COMMANDQUEUE_H*/
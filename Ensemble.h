@@ -0,0 +1,416 @@
+#pragma once
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+#include <vector>
+#include <string>
+#include <cmath>
+#include <random>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include "PhysicsState.h"
+#include "WorkerPool.h"
+#include "GravityKernel.h"
+
+/*
+	Runs many copies of one scenario at once, each with its starting velocities nudged by a different random amount, to see
+	how sensitive the outcome is to where things started.
+
+	Members are integrated side by side in blocks of LANES. Within a block every array is laid out [body][lane], so each pair
+	of bodies is one sum done for LANES different members over contiguous doubles: one AVX-512 register, or two AVX2 ones
+	(picked at runtime like GravityKernel's). Where GravityKernel's SIMD lanes are different bodies j, here they are
+	different universes. Each block is independent of every other for the whole run, so blocks are handed out to worker
+	threads whole and no thread waits on another until the end.
+
+	Every member sees the same bodies as the scenario, all as plain top level bodies around the central body (no satellite
+	hierarchy, no analytic orbits, no collisions), stepped with fixed step leapfrog or one of its Yoshida compositions.
+	Member 0 is always the unperturbed scenario, for the others to be compared against.
+*/
+class Ensemble
+{
+public:
+	enum Method { LEAPFROG, YOSHIDA4, YOSHIDA6 };
+
+	static const int LANES = 8; // Members per block
+
+private:
+	struct Block
+	{
+		std::vector<double> x, y, z, vx, vy, vz, ax, ay, az; // [body * LANES + lane]
+		double start_energy[LANES];
+		double end_energy[LANES];
+	};
+
+	std::vector<Block> blocks;
+	int members = 0;
+	int n = 0; // Bodies per member
+	std::vector<double> gm, mu; // Same for every member
+	double eps2 = 0;
+	WorkerPool pool;
+	double run_seconds = 0; // Real time the last Run took
+
+	// Acceleration of every body in every lane. [body * LANES + lane] arrays, gm and mu by body.
+	static void Evaluate_Scalar(int n, const double* gm, const double* mu, double eps2, const double* x, const double* y, const double* z, double* ax, double* ay, double* az)
+	{
+		//SUN
+		for (int i = 0; i < n; i++)
+		{
+			for (int k = i * LANES; k < (i + 1) * LANES; k++)
+			{
+				double r2 = x[k] * x[k] + y[k] * y[k] + z[k] * z[k];
+				double s = r2 > 0 ? -mu[i] / (r2 * sqrt(r2)) : 0;
+				ax[k] = x[k] * s; ay[k] = y[k] * s; az[k] = z[k] * s;
+			}
+		}
+
+		//Others. Each pair once, like GravityKernel::Pair_Rows, but across lanes instead of across j.
+		for (int i = 0; i < n; i++)
+		{
+			for (int j = i + 1; j < n; j++)
+			{
+				for (int l = 0; l < LANES; l++)
+				{
+					int a = i * LANES + l, b = j * LANES + l;
+					double rx = x[b] - x[a], ry = y[b] - y[a], rz = z[b] - z[a];
+					double r2 = rx * rx + ry * ry + rz * rz + eps2;
+					if (r2 == 0)
+					{
+						continue;
+					}
+					double inv_cube = 1 / (r2 * sqrt(r2));
+					ax[a] += rx * gm[j] * inv_cube; ay[a] += ry * gm[j] * inv_cube; az[a] += rz * gm[j] * inv_cube;
+					ax[b] -= rx * gm[i] * inv_cube; ay[b] -= ry * gm[i] * inv_cube; az[b] -= rz * gm[i] * inv_cube;
+				}
+			}
+		}
+	}
+
+#ifdef ORBYTE_X86
+	// The same, all 8 lanes in one register. Exact sqrt and division rather than GravityKernel's reciprocal square root
+	// estimate: an ensemble is about tiny differences between members, so the kernel shouldn't add any of its own.
+	ORBYTE_TARGET("avx512f")
+	static void Evaluate_AVX512(int n, const double* gm, const double* mu, double eps2, const double* x, const double* y, const double* z, double* ax, double* ay, double* az)
+	{
+		const __m512d zero = _mm512_setzero_pd(), one = _mm512_set1_pd(1), veps2 = _mm512_set1_pd(eps2);
+		for (int i = 0; i < n; i++)
+		{
+			int o = i * LANES;
+			__m512d px = _mm512_loadu_pd(x + o), py = _mm512_loadu_pd(y + o), pz = _mm512_loadu_pd(z + o);
+			__m512d r2 = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(px, px), _mm512_mul_pd(py, py)), _mm512_mul_pd(pz, pz));
+			__mmask8 nonzero = _mm512_cmp_pd_mask(r2, zero, _CMP_NEQ_OQ);
+			__m512d safe = _mm512_mask_blend_pd(nonzero, one, r2);
+			__m512d s = _mm512_maskz_div_pd(nonzero, _mm512_set1_pd(-mu[i]), _mm512_mul_pd(safe, _mm512_sqrt_pd(safe)));
+			_mm512_storeu_pd(ax + o, _mm512_mul_pd(px, s));
+			_mm512_storeu_pd(ay + o, _mm512_mul_pd(py, s));
+			_mm512_storeu_pd(az + o, _mm512_mul_pd(pz, s));
+		}
+		for (int i = 0; i < n; i++)
+		{
+			int a = i * LANES;
+			__m512d xi = _mm512_loadu_pd(x + a), yi = _mm512_loadu_pd(y + a), zi = _mm512_loadu_pd(z + a);
+			__m512d gmi = _mm512_set1_pd(gm[i]);
+			for (int j = i + 1; j < n; j++)
+			{
+				int b = j * LANES;
+				__m512d rx = _mm512_sub_pd(_mm512_loadu_pd(x + b), xi);
+				__m512d ry = _mm512_sub_pd(_mm512_loadu_pd(y + b), yi);
+				__m512d rz = _mm512_sub_pd(_mm512_loadu_pd(z + b), zi);
+				__m512d r2 = _mm512_add_pd(_mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(rx, rx), _mm512_mul_pd(ry, ry)), _mm512_mul_pd(rz, rz)), veps2);
+				__mmask8 nonzero = _mm512_cmp_pd_mask(r2, zero, _CMP_NEQ_OQ); // Coincident bodies don't interact
+				__m512d safe = _mm512_mask_blend_pd(nonzero, one, r2);
+				__m512d inv_cube = _mm512_maskz_div_pd(nonzero, one, _mm512_mul_pd(safe, _mm512_sqrt_pd(safe)));
+				__m512d gmj = _mm512_set1_pd(gm[j]);
+				_mm512_storeu_pd(ax + a, _mm512_add_pd(_mm512_loadu_pd(ax + a), _mm512_mul_pd(_mm512_mul_pd(rx, gmj), inv_cube)));
+				_mm512_storeu_pd(ay + a, _mm512_add_pd(_mm512_loadu_pd(ay + a), _mm512_mul_pd(_mm512_mul_pd(ry, gmj), inv_cube)));
+				_mm512_storeu_pd(az + a, _mm512_add_pd(_mm512_loadu_pd(az + a), _mm512_mul_pd(_mm512_mul_pd(rz, gmj), inv_cube)));
+				_mm512_storeu_pd(ax + b, _mm512_sub_pd(_mm512_loadu_pd(ax + b), _mm512_mul_pd(_mm512_mul_pd(rx, gmi), inv_cube)));
+				_mm512_storeu_pd(ay + b, _mm512_sub_pd(_mm512_loadu_pd(ay + b), _mm512_mul_pd(_mm512_mul_pd(ry, gmi), inv_cube)));
+				_mm512_storeu_pd(az + b, _mm512_sub_pd(_mm512_loadu_pd(az + b), _mm512_mul_pd(_mm512_mul_pd(rz, gmi), inv_cube)));
+			}
+		}
+	}
+
+	// Two registers of 4 lanes
+	ORBYTE_TARGET("avx2")
+	static void Evaluate_AVX2(int n, const double* gm, const double* mu, double eps2, const double* x, const double* y, const double* z, double* ax, double* ay, double* az)
+	{
+		const __m256d zero = _mm256_setzero_pd(), one = _mm256_set1_pd(1), veps2 = _mm256_set1_pd(eps2);
+		for (int k = 0; k < n * LANES; k += 4)
+		{
+			__m256d px = _mm256_loadu_pd(x + k), py = _mm256_loadu_pd(y + k), pz = _mm256_loadu_pd(z + k);
+			__m256d r2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(px, px), _mm256_mul_pd(py, py)), _mm256_mul_pd(pz, pz));
+			__m256d nonzero = _mm256_cmp_pd(r2, zero, _CMP_NEQ_OQ);
+			__m256d safe = _mm256_blendv_pd(one, r2, nonzero);
+			__m256d s = _mm256_and_pd(nonzero, _mm256_div_pd(_mm256_set1_pd(-mu[k / LANES]), _mm256_mul_pd(safe, _mm256_sqrt_pd(safe))));
+			_mm256_storeu_pd(ax + k, _mm256_mul_pd(px, s));
+			_mm256_storeu_pd(ay + k, _mm256_mul_pd(py, s));
+			_mm256_storeu_pd(az + k, _mm256_mul_pd(pz, s));
+		}
+		for (int i = 0; i < n; i++)
+		{
+			__m256d gmi = _mm256_set1_pd(gm[i]);
+			for (int j = i + 1; j < n; j++)
+			{
+				__m256d gmj = _mm256_set1_pd(gm[j]);
+				for (int h = 0; h < LANES; h += 4)
+				{
+					int a = i * LANES + h, b = j * LANES + h;
+					__m256d rx = _mm256_sub_pd(_mm256_loadu_pd(x + b), _mm256_loadu_pd(x + a));
+					__m256d ry = _mm256_sub_pd(_mm256_loadu_pd(y + b), _mm256_loadu_pd(y + a));
+					__m256d rz = _mm256_sub_pd(_mm256_loadu_pd(z + b), _mm256_loadu_pd(z + a));
+					__m256d r2 = _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(rx, rx), _mm256_mul_pd(ry, ry)), _mm256_mul_pd(rz, rz)), veps2);
+					__m256d nonzero = _mm256_cmp_pd(r2, zero, _CMP_NEQ_OQ); // Coincident bodies don't interact
+					__m256d safe = _mm256_blendv_pd(one, r2, nonzero);
+					__m256d inv_cube = _mm256_and_pd(nonzero, _mm256_div_pd(one, _mm256_mul_pd(safe, _mm256_sqrt_pd(safe))));
+					_mm256_storeu_pd(ax + a, _mm256_add_pd(_mm256_loadu_pd(ax + a), _mm256_mul_pd(_mm256_mul_pd(rx, gmj), inv_cube)));
+					_mm256_storeu_pd(ay + a, _mm256_add_pd(_mm256_loadu_pd(ay + a), _mm256_mul_pd(_mm256_mul_pd(ry, gmj), inv_cube)));
+					_mm256_storeu_pd(az + a, _mm256_add_pd(_mm256_loadu_pd(az + a), _mm256_mul_pd(_mm256_mul_pd(rz, gmj), inv_cube)));
+					_mm256_storeu_pd(ax + b, _mm256_sub_pd(_mm256_loadu_pd(ax + b), _mm256_mul_pd(_mm256_mul_pd(rx, gmi), inv_cube)));
+					_mm256_storeu_pd(ay + b, _mm256_sub_pd(_mm256_loadu_pd(ay + b), _mm256_mul_pd(_mm256_mul_pd(ry, gmi), inv_cube)));
+					_mm256_storeu_pd(az + b, _mm256_sub_pd(_mm256_loadu_pd(az + b), _mm256_mul_pd(_mm256_mul_pd(rz, gmi), inv_cube)));
+				}
+			}
+		}
+	}
+#endif
+
+	// Whichever of the above the gravity kernel setting (K) says. SSE2 only has 2 lanes, so it uses the scalar loop.
+	void Evaluate(Block& b)
+	{
+		switch (GravityKernel::Get_Level())
+		{
+#ifdef ORBYTE_X86
+		case GravityKernel::AVX512: Evaluate_AVX512(n, gm.data(), mu.data(), eps2, b.x.data(), b.y.data(), b.z.data(), b.ax.data(), b.ay.data(), b.az.data()); return;
+		case GravityKernel::AVX2: Evaluate_AVX2(n, gm.data(), mu.data(), eps2, b.x.data(), b.y.data(), b.z.data(), b.ax.data(), b.ay.data(), b.az.data()); return;
+#endif
+		default: Evaluate_Scalar(n, gm.data(), mu.data(), eps2, b.x.data(), b.y.data(), b.z.data(), b.ax.data(), b.ay.data(), b.az.data()); return;
+		}
+	}
+
+	// Total energy of each lane, divided by G (gm stands in for mass). Only its change over a run matters.
+	void Energy(Block& b, double* energy)
+	{
+		for (int l = 0; l < LANES; l++)
+		{
+			energy[l] = 0;
+		}
+		for (int i = 0; i < n; i++)
+		{
+			int oi = i * LANES;
+			for (int l = 0; l < LANES; l++)
+			{
+				double v2 = b.vx[oi + l] * b.vx[oi + l] + b.vy[oi + l] * b.vy[oi + l] + b.vz[oi + l] * b.vz[oi + l];
+				double r = sqrt(b.x[oi + l] * b.x[oi + l] + b.y[oi + l] * b.y[oi + l] + b.z[oi + l] * b.z[oi + l]);
+				energy[l] += gm[i] * (0.5 * v2 - (r > 0 ? mu[i] / r : 0));
+			}
+			for (int j = i + 1; j < n; j++)
+			{
+				int oj = j * LANES;
+				for (int l = 0; l < LANES; l++)
+				{
+					double rx = b.x[oj + l] - b.x[oi + l], ry = b.y[oj + l] - b.y[oi + l], rz = b.z[oj + l] - b.z[oi + l];
+					double r = sqrt(rx * rx + ry * ry + rz * rz + eps2);
+					energy[l] -= r > 0 ? gm[i] * gm[j] / r : 0;
+				}
+			}
+		}
+	}
+
+	// Whole run of one block: kick-drift-kick substeps of weights[w] * h each, steps times over
+	void Integrate(Block& b, double h, int steps, const double* weights, int count)
+	{
+		int size = n * LANES;
+		Energy(b, b.start_energy);
+		Evaluate(b);
+		for (int s = 0; s < steps; s++)
+		{
+			for (int w = 0; w < count; w++)
+			{
+				double dt = weights[w] * h;
+				for (int k = 0; k < size; k++)
+				{
+					b.vx[k] += b.ax[k] * 0.5 * dt; b.vy[k] += b.ay[k] * 0.5 * dt; b.vz[k] += b.az[k] * 0.5 * dt;
+					b.x[k] += b.vx[k] * dt; b.y[k] += b.vy[k] * dt; b.z[k] += b.vz[k] * dt;
+				}
+				Evaluate(b);
+				for (int k = 0; k < size; k++)
+				{
+					b.vx[k] += b.ax[k] * 0.5 * dt; b.vy[k] += b.ay[k] * 0.5 * dt; b.vz[k] += b.az[k] * 0.5 * dt;
+				}
+			}
+		}
+		Energy(b, b.end_energy);
+	}
+
+public:
+	/// <summary>
+	/// Make count copies of a scenario, each (but member 0) with every velocity component nudged by a normally distributed
+	/// amount of standard deviation spread * that body's speed. The same seed always gives the same ensemble.
+	/// </summary>
+	void Setup(const PhysicsStore& scenario, int count, double spread, unsigned long long seed = 1)
+	{
+		members = std::max(1, count);
+		n = (int)scenario.x.size();
+		gm = scenario.gm;
+		mu = scenario.mu;
+		eps2 = scenario.softening * scenario.softening;
+
+		blocks.resize((members + LANES - 1) / LANES);
+		for (int k = 0; k < (int)blocks.size(); k++)
+		{
+			Block& b = blocks[k];
+			b.x.resize(n * LANES); b.y.resize(n * LANES); b.z.resize(n * LANES);
+			b.vx.resize(n * LANES); b.vy.resize(n * LANES); b.vz.resize(n * LANES);
+			b.ax.assign(n * LANES, 0); b.ay.assign(n * LANES, 0); b.az.assign(n * LANES, 0);
+			for (int l = 0; l < LANES; l++)
+			{
+				int m = k * LANES + l;
+				// A generator per member, so each member's nudges don't depend on how many others there are. Lanes past the
+				// last member (padding) just repeat member 0.
+				std::mt19937_64 rng(seed + 0x9E3779B97F4A7C15ull * (m < members ? m : 0));
+				std::normal_distribution<double> nudge(0, spread);
+				for (int i = 0; i < n; i++)
+				{
+					int o = i * LANES + l;
+					double speed = sqrt(scenario.vx[i] * scenario.vx[i] + scenario.vy[i] * scenario.vy[i] + scenario.vz[i] * scenario.vz[i]);
+					double f = (m > 0 && m < members) ? speed : 0;
+					b.x[o] = scenario.x[i]; b.y[o] = scenario.y[i]; b.z[o] = scenario.z[i];
+					b.vx[o] = scenario.vx[i] + nudge(rng) * f;
+					b.vy[o] = scenario.vy[i] + nudge(rng) * f;
+					b.vz[o] = scenario.vz[i] + nudge(rng) * f;
+				}
+			}
+		}
+	}
+
+	/// <summary>
+	/// Integrate every member for the given simulated time, in fixed steps of (at most) step seconds.
+	/// </summary>
+	/// <param name="workers">Worker threads besides the calling one</param>
+	void Run(double seconds, double step, Method method = YOSHIDA4, int workers = 0)
+	{
+		// Same weights as SystemIntegrator's
+		static const double cbrt2 = 1.2599210498948732;
+		static const double y4_1 = 1 / (2 - cbrt2);
+		static const double y4_0 = -cbrt2 / (2 - cbrt2);
+		static const double yoshida4[3] = { y4_1, y4_0, y4_1 };
+		static const double y6_1 = -1.17767998417887, y6_2 = 0.235573213359357, y6_3 = 0.784513610477560;
+		static const double y6_0 = 1 - 2 * (y6_1 + y6_2 + y6_3);
+		static const double yoshida6[7] = { y6_3, y6_2, y6_1, y6_0, y6_1, y6_2, y6_3 };
+		static const double leapfrog[1] = { 1 };
+		const double* weights = method == LEAPFROG ? leapfrog : (method == YOSHIDA6 ? yoshida6 : yoshida4);
+		int count = method == LEAPFROG ? 1 : (method == YOSHIDA6 ? 7 : 3);
+
+		int steps = step > 0 ? std::max(1, (int)ceil(fabs(seconds) / step)) : 1;
+		double h = seconds / steps;
+
+		if (workers != pool.Size())
+		{
+			pool.Resize(std::max(0, workers));
+		}
+		auto start = std::chrono::steady_clock::now();
+		auto run = [&](int begin, int end)
+		{
+			for (int k = begin; k < end; k++)
+			{
+				Integrate(blocks[k], h, steps, weights, count);
+			}
+		};
+		pool.Parallel_For((int)blocks.size(), 1, run);
+		run_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	int Members()
+	{
+		return members;
+	}
+
+	double Run_Seconds()
+	{
+		return run_seconds;
+	}
+
+	// Member m's body i, as it stands
+	vector3 Position(int m, int i)
+	{
+		const Block& b = blocks[m / LANES];
+		int o = i * LANES + m % LANES;
+		return { b.x[o], b.y[o], b.z[o] };
+	}
+
+	vector3 Velocity(int m, int i)
+	{
+		const Block& b = blocks[m / LANES];
+		int o = i * LANES + m % LANES;
+		return { b.vx[o], b.vy[o], b.vz[o] };
+	}
+
+	// Relative change in member m's total energy over the last Run: the integration error, as the physics conserves it
+	double Energy_Error(int m)
+	{
+		const Block& b = blocks[m / LANES];
+		double e0 = b.start_energy[m % LANES];
+		return e0 != 0 ? (b.end_energy[m % LANES] - e0) / fabs(e0) : 0;
+	}
+
+	/// <summary>
+	/// Write every member's final state to a CSV file, one row per member per body. Returns false if it can't be written.
+	/// </summary>
+	bool Write_CSV(const std::string& path, const std::vector<std::string>& names)
+	{
+		std::ofstream out(path);
+		if (!out)
+		{
+			std::cout << "\nERR. Writing ensemble results to " << path << " failed.";
+			return false;
+		}
+		out.precision(17);
+		out << "member,body,x,y,z,vx,vy,vz,energy_error\n";
+		for (int m = 0; m < members; m++)
+		{
+			for (int i = 0; i < n; i++)
+			{
+				vector3 p = Position(m, i), v = Velocity(m, i);
+				out << m << "," << (i < (int)names.size() ? names[i] : std::to_string(i)) << "," << p.x << "," << p.y << "," << p.z << "," << v.x << "," << v.y << "," << v.z << "," << Energy_Error(m) << "\n";
+			}
+		}
+		return true;
+	}
+
+	/// <summary>
+	/// Per body spread of the final positions across the ensemble, and how well energy was kept, to the console.
+	/// </summary>
+	void Print_Statistics(const std::vector<std::string>& names)
+	{
+		std::cout << "\n__________________\nENSEMBLE: " << members << " members, " << n << " bodies, " << run_seconds * 1000 << " ms\n__________________\n";
+		for (int i = 0; i < n; i++)
+		{
+			vector3 mean = { 0, 0, 0 };
+			for (int m = 0; m < members; m++)
+			{
+				mean = mean + Position(m, i);
+			}
+			mean = mean * (1.0 / members);
+			double variance = 0, furthest = 0;
+			vector3 reference = Position(0, i);
+			for (int m = 0; m < members; m++)
+			{
+				vector3 p = Position(m, i);
+				variance += (p - mean) * (p - mean);
+				furthest = std::max(furthest, Magnitude(p - reference));
+			}
+			std::cout << (i < (int)names.size() ? names[i] : std::to_string(i)) << ": mean position " << mean.Debug() << ", spread (rms) " << sqrt(variance / members) << " m, furthest from member 0 " << furthest << " m\n";
+		}
+		double worst = 0, total = 0;
+		for (int m = 0; m < members; m++)
+		{
+			worst = std::max(worst, fabs(Energy_Error(m)));
+			total += fabs(Energy_Error(m));
+		}
+		std::cout << "Energy error: mean " << total / members << ", worst " << worst << "\n";
+	}
+};
+
+#endif /*ENSEMBLE_H*/
@@ -0,0 +1,504 @@
+#pragma once
+#ifndef EPHEMERIS_H
+#define EPHEMERIS_H
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <cmath>
+#include <algorithm>
+#include "PhysicsState.h"
+#include "SystemIntegrator.h"
+
+/*
+	A scenario integrated once and kept as piecewise Chebyshev polynomials, one series per body, the way the JPL DE
+	ephemerides are. Its state at any time in the span is then a polynomial evaluation, not an integration: playing back a
+	thousand years costs the same per frame as playing back one, and any time can be jumped to directly.
+
+	Build runs a SystemIntegrator over the span at a fixed step and fits each body's position in granules (pieces) of its own
+	length, an eighth of its orbit (or its fastest satellite's, which it wobbles with), so Mercury gets short granules and
+	Neptune long ones. Each granule is a least squares fit
+	to the positions and velocities of SAMPLES + 1 evenly spaced steps, so velocity comes from the same polynomial (its
+	derivative) and agrees with it. Because the samples are always spread the same way over a granule, one fit matrix does
+	every granule of every body. Satellites are fitted relative to their parent, as the Moon is in the DE files, so their
+	granules follow their own orbit rather than the parent's.
+
+	Collisions and edits aren't part of it: it is what the scenario does left alone.
+*/
+class Ephemeris
+{
+private:
+	static const int GRANULES_PER_ORBIT = 8;
+	static const int SAMPLES = 24; // Steps a granule is fitted to (at least): twice the default degree
+
+	struct Series
+	{
+		std::string name;
+		int handle = -1; // In the store it plays back into, -1 if not bound to a body there
+		int parent = -1; // Series it is fitted relative to, -1 for the central body
+		double granule = 0; // Length of each polynomial piece (s)
+		std::vector<double> coefficients; // 3 * (degree + 1) per granule: x's, then y's, then z's
+
+		// Building only
+		int stride = 1; // Steps between samples
+		int granules_done = 0;
+		std::vector<double> samples; // 6 per sample: relative x, y, z, vx, vy, vz
+	};
+
+	std::vector<Series> series;
+	int degree = 12;
+	double start = 0; // Simulated time the span starts at (s)
+	double span = 0; // Length (s)
+
+	// T_j(tau) and T_j'(tau) for j = 0..degree
+	static void Chebyshev(double tau, int degree, double* t, double* dt)
+	{
+		double u_prev = 0, u = 1; // U_{j-1}, the Chebyshev polynomials of the second kind, for T_j' = j U_{j-1}
+		t[0] = 1; dt[0] = 0;
+		if (degree == 0)
+		{
+			return;
+		}
+		t[1] = tau; dt[1] = 1;
+		for (int j = 2; j <= degree; j++)
+		{
+			t[j] = 2 * tau * t[j - 1] - t[j - 2];
+			double u_next = 2 * tau * u - u_prev; // U_{j-1}
+			u_prev = u;
+			u = u_next;
+			dt[j] = j * u;
+		}
+	}
+
+	/// <summary>
+	/// Least squares fit of degree + 1 Chebyshev coefficients to SAMPLES + 1 evenly spaced positions and derivatives (in tau,
+	/// so velocity * granule / 2). Returns the (degree + 1) x 2(SAMPLES + 1) matrix that turns samples into coefficients.
+	/// </summary>
+	static std::vector<double> Fit_Matrix(int degree)
+	{
+		int d = degree + 1;
+		int rows = 2 * (SAMPLES + 1);
+		std::vector<double> a(rows * d); // Position rows then derivative rows, interleaved by sample
+		std::vector<double> t(d), dt(d);
+		for (int k = 0; k <= SAMPLES; k++)
+		{
+			Chebyshev(-1 + 2.0 * k / SAMPLES, degree, t.data(), dt.data());
+			for (int j = 0; j < d; j++)
+			{
+				a[(2 * k) * d + j] = t[j];
+				a[(2 * k + 1) * d + j] = dt[j];
+			}
+		}
+
+		// Normal equations (A^T A) M = A^T, solved by Gauss-Jordan with partial pivoting. Small, and only done once.
+		std::vector<double> n(d * d, 0), m(d * rows, 0);
+		for (int i = 0; i < d; i++)
+		{
+			for (int r = 0; r < rows; r++)
+			{
+				m[i * rows + r] = a[r * d + i];
+				for (int j = 0; j < d; j++)
+				{
+					n[i * d + j] += a[r * d + i] * a[r * d + j];
+				}
+			}
+		}
+		for (int c = 0; c < d; c++)
+		{
+			int pivot = c;
+			for (int i = c + 1; i < d; i++)
+			{
+				if (fabs(n[i * d + c]) > fabs(n[pivot * d + c]))
+				{
+					pivot = i;
+				}
+			}
+			for (int j = 0; j < d; j++) { std::swap(n[c * d + j], n[pivot * d + j]); }
+			for (int r = 0; r < rows; r++) { std::swap(m[c * rows + r], m[pivot * rows + r]); }
+
+			double inverse = 1 / n[c * d + c];
+			for (int j = 0; j < d; j++) { n[c * d + j] *= inverse; }
+			for (int r = 0; r < rows; r++) { m[c * rows + r] *= inverse; }
+			for (int i = 0; i < d; i++)
+			{
+				double f = n[i * d + c];
+				if (i == c || f == 0)
+				{
+					continue;
+				}
+				for (int j = 0; j < d; j++) { n[i * d + j] -= f * n[c * d + j]; }
+				for (int r = 0; r < rows; r++) { m[i * rows + r] -= f * m[c * rows + r]; }
+			}
+		}
+		return m;
+	}
+
+	// Fit the granule a series' samples cover and append its coefficients
+	void Fit(Series& s, const std::vector<double>& fit)
+	{
+		int d = degree + 1;
+		int rows = 2 * (SAMPLES + 1);
+		double half = s.granule / 2; // d/dtau = half * d/dt
+		for (int axis = 0; axis < 3; axis++)
+		{
+			for (int i = 0; i < d; i++)
+			{
+				double c = 0;
+				const double* row = &fit[i * rows];
+				for (int k = 0; k <= SAMPLES; k++)
+				{
+					c += row[2 * k] * s.samples[k * 6 + axis] + row[2 * k + 1] * s.samples[k * 6 + 3 + axis] * half;
+				}
+				s.coefficients.push_back(c);
+			}
+		}
+	}
+
+	// Relative state of a series' body in the store being integrated
+	static void Relative_State(PhysicsStore& store, int slot, int parent_slot, double* out)
+	{
+		out[0] = store.x[slot]; out[1] = store.y[slot]; out[2] = store.z[slot];
+		out[3] = store.vx[slot]; out[4] = store.vy[slot]; out[5] = store.vz[slot];
+		if (parent_slot >= 0)
+		{
+			out[0] -= store.x[parent_slot]; out[1] -= store.y[parent_slot]; out[2] -= store.z[parent_slot];
+			out[3] -= store.vx[parent_slot]; out[4] -= store.vy[parent_slot]; out[5] -= store.vz[parent_slot];
+		}
+	}
+
+	// Just this series' own polynomial (relative to its parent)
+	void Evaluate_Series(const Series& s, double t, double* out) const
+	{
+		int d = degree + 1;
+		int granules = s.coefficients.size() / (3 * d);
+		double local = t - start;
+		int g = std::max(0, std::min(granules - 1, (int)floor(local / s.granule)));
+		double tau = 2 * (local - g * s.granule) / s.granule - 1;
+
+		double tj[32], dtj[32];
+		Chebyshev(tau, degree, tj, dtj);
+		const double* c = &s.coefficients[g * 3 * d];
+		for (int axis = 0; axis < 3; axis++, c += d)
+		{
+			double p = 0, v = 0;
+			for (int j = 0; j < d; j++)
+			{
+				p += c[j] * tj[j];
+				v += c[j] * dtj[j];
+			}
+			out[axis] = p;
+			out[3 + axis] = v * 2 / s.granule;
+		}
+	}
+
+public:
+	/// <summary>
+	/// Integrate a scenario and fit its ephemeris.
+	/// </summary>
+	/// <param name="scenario">Bodies at the start of the span</param>
+	/// <param name="names">Name of the body in each slot, to bind to bodies by later</param>
+	/// <param name="_start">Simulated time of the scenario (s)</param>
+	/// <param name="_span">How long to cover (s)</param>
+	/// <param name="step">Integration step (s). Positions come out about as accurate as an integration at this step.</param>
+	/// <param name="method">SystemIntegrator::Method to integrate with</param>
+	/// <param name="_degree">Of the polynomials</param>
+	/// <returns>false (and nothing built) unless the span and step are positive and finite</returns>
+	bool Build(const PhysicsStore& scenario, const std::vector<std::string>& names, double _start, double _span, double step, int method = SystemIntegrator::YOSHIDA6, int _degree = 12)
+	{
+		if (!(_span > 0 && step > 0 && std::isfinite(_span) && std::isfinite(step) && std::isfinite(_start)))
+		{
+			return false; // A zero step would never get anywhere, and a zero span has nothing to fit
+		}
+		degree = std::max(1, std::min(2 * SAMPLES + 1, std::min(31, _degree))); // No more unknowns than samples, and Chebyshev's buffers
+		start = _start;
+		span = _span;
+		PhysicsStore store;
+		store.Assign_State(scenario);
+		SystemIntegrator integrator;
+		integrator.Set_Method(method);
+		std::vector<double> fit = Fit_Matrix(degree);
+
+		int n = store.Size();
+		series.assign(n, Series());
+		std::vector<double> period(n);
+		for (int i = 0; i < n; i++)
+		{
+			Series& s = series[i];
+			s.name = i < (int)names.size() ? names[i] : std::to_string(i);
+			s.handle = store.handle_of_slot[i];
+			s.parent = store.parent[i] >= 0 ? store.Slot(store.parent[i]) : -1;
+
+			// Period of its orbit (around its parent if it has one)
+			double rel[6];
+			Relative_State(store, i, s.parent, rel);
+			double mu = s.parent >= 0 ? store.gm[s.parent] + store.gm[i] : store.mu[i] + store.gm[i];
+			double r = sqrt(rel[0] * rel[0] + rel[1] * rel[1] + rel[2] * rel[2]);
+			double v2 = rel[3] * rel[3] + rel[4] * rel[4] + rel[5] * rel[5];
+			double a = 1 / (2 / r - v2 / mu);
+			const double pi = 3.14159265358979323846;
+			period[i] = a > 0 ? 2 * pi * sqrt(a * a * a / mu) : span; // Unbound => as long as it needs to be
+		}
+		for (int i = 0; i < n; i++)
+		{
+			for (int p = series[i].parent, depth = 0; p >= 0 && depth < 8; p = series[p].parent, depth++)
+			{
+				period[p] = std::min(period[p], period[i]); // A parent wobbles with its satellites' orbits too
+			}
+		}
+		for (int i = 0; i < n; i++)
+		{
+			Series& s = series[i];
+			s.stride = std::max(1, (int)(period[i] / GRANULES_PER_ORBIT / step / SAMPLES));
+			s.granule = (double)s.stride * SAMPLES * step;
+			s.samples.resize(6 * (SAMPLES + 1));
+			s.coefficients.clear();
+			s.coefficients.reserve((size_t)(span / s.granule + 2) * 3 * (degree + 1));
+			Relative_State(store, i, s.parent, &s.samples[0]);
+		}
+
+		// Step until every series has granules past the end of the span
+		for (long long k = 1; ; k++)
+		{
+			integrator.Step(1000, step, store);
+			bool done = true;
+			for (int i = 0; i < n; i++)
+			{
+				Series& s = series[i];
+				if (s.granules_done * s.granule < span)
+				{
+					done = false;
+					if (k % s.stride == 0)
+					{
+						long long sample = k / s.stride - (long long)s.granules_done * SAMPLES;
+						Relative_State(store, i, s.parent, &s.samples[sample * 6]);
+						if (sample == SAMPLES)
+						{
+							Fit(s, fit);
+							s.granules_done++;
+							std::copy(s.samples.begin() + SAMPLES * 6, s.samples.end(), s.samples.begin()); // End of this one starts the next
+						}
+					}
+				}
+			}
+			if (done)
+			{
+				break;
+			}
+		}
+		for (Series& s : series)
+		{
+			std::vector<double>().swap(s.samples);
+		}
+		return true;
+	}
+
+	/// <summary>
+	/// State of body i at a time (clamped to the span), relative to the central body.
+	/// </summary>
+	void State(int i, double t, vector3& position, vector3& velocity) const
+	{
+		double out[6] = { 0, 0, 0, 0, 0, 0 };
+		for (int s = i, depth = 0; s >= 0 && depth < 8; s = series[s].parent, depth++) // Parent chains are short; 8 guards a loop
+		{
+			double own[6];
+			Evaluate_Series(series[s], t, own);
+			for (int k = 0; k < 6; k++)
+			{
+				out[k] += own[k];
+			}
+		}
+		position = { out[0], out[1], out[2] };
+		velocity = { out[3], out[4], out[5] };
+	}
+
+	/// <summary>
+	/// Match a body in the store being played back into to its series, by name.
+	/// </summary>
+	/// <returns>false if there isn't a series of that name (or it's taken)</returns>
+	bool Bind(const std::string& name, int handle)
+	{
+		for (Series& s : series)
+		{
+			if (s.name == name && s.handle == -1)
+			{
+				s.handle = handle;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Forget which bodies the series go with, to Bind them again
+	void Unbind()
+	{
+		for (Series& s : series)
+		{
+			s.handle = -1;
+		}
+	}
+
+	/// <summary>
+	/// True if every body in the store has a series, so playing back into it leaves nothing to integrate.
+	/// </summary>
+	bool Covers(PhysicsStore& store) const
+	{
+		int bound = 0;
+		for (const Series& s : series)
+		{
+			if (s.handle >= 0 && s.handle < (int)store.slot_of_handle.size() && store.Slot(s.handle) >= 0)
+			{
+				bound++;
+			}
+		}
+		return bound == store.Size() && store.Size() > 0;
+	}
+
+	/// <summary>
+	/// Move every bound body in the store to where the ephemeris has it at a time. Not an edit, so nothing is journaled.
+	/// </summary>
+	void Evaluate(double t, PhysicsStore& store) const
+	{
+		for (int i = 0; i < (int)series.size(); i++)
+		{
+			int h = series[i].handle;
+			if (h < 0 || h >= (int)store.slot_of_handle.size() || store.Slot(h) < 0)
+			{
+				continue;
+			}
+			int slot = store.Slot(h);
+			vector3 p, v;
+			State(i, t, p, v);
+			store.x[slot] = p.x; store.y[slot] = p.y; store.z[slot] = p.z;
+			store.vx[slot] = v.x; store.vy[slot] = v.y; store.vz[slot] = v.z;
+			if (store.orbits.Find(h) >= 0)
+			{
+				store.orbits.Set(h, store.mu[slot], p, v); // So its fixed orbit carries on from here once playback stops
+			}
+		}
+		store.revision++; // Moved from outside the integrator: cached forces no longer apply
+	}
+
+	bool Contains(double t) const
+	{
+		return !series.empty() && t >= start && t <= start + span;
+	}
+
+	// Move the whole span in time, e.g. to play a file built from t = 0 back from the current simulated time
+	void Set_Start(double seconds)
+	{
+		start = seconds;
+	}
+
+	double Get_Start() const
+	{
+		return start;
+	}
+
+	double Get_Span() const
+	{
+		return span;
+	}
+
+	int Size() const
+	{
+		return series.size();
+	}
+
+	// Memory taken by the coefficients
+	long long Bytes() const
+	{
+		long long bytes = 0;
+		for (const Series& s : series)
+		{
+			bytes += s.coefficients.size() * sizeof(double);
+		}
+		return bytes;
+	}
+
+	/// <summary>
+	/// Save to a file (in simulations/, like .orbyte files).
+	/// </summary>
+	bool Write(const std::string& path) const
+	{
+		std::ofstream out("simulations/" + path, std::ios::binary | std::ios::out);
+		if (!out)
+		{
+			std::cout << "\nERR. Writing ephemeris to " << path << " failed.";
+			return false;
+		}
+		out.write("ORBEPH1", 8);
+		int count = series.size();
+		out.write((char*)&degree, sizeof(int));
+		out.write((char*)&start, sizeof(double));
+		out.write((char*)&span, sizeof(double));
+		out.write((char*)&count, sizeof(int));
+		for (const Series& s : series)
+		{
+			int length = s.name.size();
+			out.write((char*)&length, sizeof(int));
+			out.write(s.name.data(), length);
+			out.write((char*)&s.parent, sizeof(int));
+			out.write((char*)&s.granule, sizeof(double));
+			long long values = s.coefficients.size();
+			out.write((char*)&values, sizeof(long long));
+			out.write((char*)s.coefficients.data(), values * sizeof(double));
+		}
+		return true;
+	}
+
+	/// <summary>
+	/// Load from a file written by Write. Series come back unbound.
+	/// </summary>
+	bool Read(const std::string& path)
+	{
+		std::ifstream in("simulations/" + path, std::ios::binary | std::ios::in);
+		char magic[8] = {};
+		in.read(magic, 8);
+		if (!in || std::string(magic) != "ORBEPH1")
+		{
+			std::cout << "\nERR. " << path << " isn't an ephemeris.";
+			return false;
+		}
+		int count = 0;
+		in.read((char*)&degree, sizeof(int));
+		in.read((char*)&start, sizeof(double));
+		in.read((char*)&span, sizeof(double));
+		in.read((char*)&count, sizeof(int));
+		if (!in || degree < 1 || degree > 31 || count < 0)
+		{
+			std::cout << "\nERR. " << path << " is corrupt.";
+			series.clear();
+			return false;
+		}
+		series.assign(count, Series());
+		for (Series& s : series)
+		{
+			int length = 0;
+			in.read((char*)&length, sizeof(int));
+			s.name.resize(std::max(0, length));
+			in.read(&s.name[0], s.name.size());
+			in.read((char*)&s.parent, sizeof(int));
+			in.read((char*)&s.granule, sizeof(double));
+			long long values = 0;
+			in.read((char*)&values, sizeof(long long));
+			if (!in || values <= 0 || values % (3 * (degree + 1)) != 0 || s.parent < -1 || s.parent >= count || s.granule <= 0)
+			{
+				std::cout << "\nERR. " << path << " is corrupt.";
+				series.clear();
+				return false;
+			}
+			s.coefficients.resize(values);
+			in.read((char*)s.coefficients.data(), values * sizeof(double));
+		}
+		if (!in)
+		{
+			std::cout << "\nERR. " << path << " is cut short.";
+			series.clear();
+			return false;
+		}
+		return true;
+	}
+};
+
+#endif /*EPHEMERIS_H*/
@@ -0,0 +1,476 @@
+#pragma once
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <vector>
+#include <string>
+#include <cmath>
+#include <limits>
+#include <fstream>
+#include <iostream>
+#include <functional>
+#include "PhysicsState.h"
+
+/*
+	Finds the exact times things happen between steps (periapsis, crossing a plane, closest approach, or any condition given
+	as a function of the state), without making the steps any smaller.
+
+	Each event is a function g of the bodies' state that changes sign when the event happens: r . v for apsides, the height
+	above a plane for crossings, (r1 - r2) . (v1 - v2) for closest approaches. After each step g is looked at across the step
+	on a dense output of it, and where it changes sign the time is found by root finding on that dense output.
+
+	The dense output is a quintic Hermite interpolant through each body's position, velocity and acceleration at both ends of
+	the step, which is good to O(h^6) in position whatever integrated the step. Accelerations come from the same model as the
+	integrators (the central body plus every body's pull, softened the same way), worked out only for the bodies an event
+	looks at. g is sampled at a few points across the step, not just its ends, so an event that happens and un-happens within
+	one long step (two apsides in a step) is still caught, and the root is found with the Illinois method (regula falsi that
+	doesn't stall), to a fraction of a second.
+
+	Events are logged in a fixed ring (the oldest go first), so checking never allocates once events are set up.
+*/
+class EventDetector
+{
+public:
+	enum Direction
+	{
+		FALLING = -1, // g goes from + to -
+		EITHER = 0,
+		RISING = 1 // g goes from - to +
+	};
+
+	/*
+		The bodies at some moment within the step being checked, interpolated as they are asked for. Handle -1 is the central body.
+	*/
+	class View
+	{
+		friend class EventDetector;
+
+	private:
+		EventDetector* detector = NULL;
+		double theta = 0; // Fraction of the step
+
+	public:
+		vector3 Position(int handle)
+		{
+			return detector->Interpolate(handle, theta, false);
+		}
+
+		vector3 Velocity(int handle)
+		{
+			return detector->Interpolate(handle, theta, true);
+		}
+
+		// Position and velocity of one body relative to another (-1 for the central body)
+		vector3 Relative_Position(int handle, int to)
+		{
+			return Position(handle) - Position(to);
+		}
+
+		vector3 Relative_Velocity(int handle, int to)
+		{
+			return Velocity(handle) - Velocity(to);
+		}
+
+		// Simulated time (s)
+		double Time()
+		{
+			return detector->step_start + theta * detector->step;
+		}
+	};
+
+	typedef std::function<double(View&)> Function;
+
+	// One event found
+	struct Event
+	{
+		int definition; // Which one (see Add)
+		double seconds; // When
+		double value; // The definition's value function there (distance, say), 0 if it has none
+	};
+
+private:
+	struct Definition
+	{
+		int id;
+		std::string name;
+		Function g;
+		Direction direction;
+		Function value; // Logged with the event. May be empty.
+		double limit; // Only logged if value <= limit
+	};
+	std::vector<Definition> definitions;
+	int next_id = 0;
+
+	static const int SAMPLES = 4; // Sub-intervals of the step g is looked at over
+	static const int MAX_ITERATIONS = 64;
+	double time_tolerance = 1E-3; // Seconds. Refinement stops once the root is bracketed this tightly.
+
+	// The step being checked
+	const StateBuffer* start_state = NULL;
+	const PhysicsStore* end_state = NULL;
+	double step_start = 0;
+	double step = 0;
+
+	// Interpolants, worked out per slot as they're first asked for in a step
+	struct Hermite
+	{
+		double p0[3], v0[3], a0[3], p1[3], v1[3], a1[3];
+	};
+	std::vector<Hermite> hermite;
+	std::vector<long long> hermite_stamp; // Check the interpolant was worked out in. Stale => work it out again.
+	long long stamp = 0;
+	bool missing = false; // An event asked about a body that isn't there (any more)
+
+	// Log
+	std::vector<Event> ring = std::vector<Event>(4096);
+	int first = 0;
+	int count = 0;
+	long long total = 0; // Ever logged
+
+	// Same model as SystemIntegrator::Evaluate, for one body
+	static vector3 Acceleration(const PhysicsStore& store, int i, const double* x, const double* y, const double* z)
+	{
+		double eps2 = store.softening * store.softening;
+		double r2 = x[i] * x[i] + y[i] * y[i] + z[i] * z[i];
+		double s = r2 > 0 ? -store.mu[i] / (r2 * sqrt(r2)) : 0;
+		vector3 a = { x[i] * s, y[i] * s, z[i] * s };
+		int n = store.x.size();
+		for (int j = 0; j < n; j++)
+		{
+			if (j == i)
+			{
+				continue;
+			}
+			double dx = x[j] - x[i], dy = y[j] - y[i], dz = z[j] - z[i];
+			double d2 = dx * dx + dy * dy + dz * dz + eps2;
+			if (d2 > 0)
+			{
+				double f = store.gm[j] / (d2 * sqrt(d2));
+				a.x += dx * f; a.y += dy * f; a.z += dz * f;
+			}
+		}
+		return a;
+	}
+
+	vector3 Interpolate(int handle, double t, bool velocity)
+	{
+		if (handle < 0)
+		{
+			return { 0, 0, 0 }; // Central body, fixed at the origin
+		}
+		const PhysicsStore& e = *end_state;
+		int i = handle < (int)e.slot_of_handle.size() ? e.slot_of_handle[handle] : -1;
+		if (i < 0)
+		{
+			missing = true;
+			return { 0, 0, 0 };
+		}
+		if (hermite_stamp[i] != stamp)
+		{
+			const StateBuffer& s = *start_state;
+			Hermite& H = hermite[i];
+			vector3 a0 = Acceleration(e, i, s.x.data(), s.y.data(), s.z.data());
+			vector3 a1 = Acceleration(e, i, e.x.data(), e.y.data(), e.z.data());
+			H.p0[0] = s.x[i]; H.p0[1] = s.y[i]; H.p0[2] = s.z[i];
+			H.v0[0] = s.vx[i]; H.v0[1] = s.vy[i]; H.v0[2] = s.vz[i];
+			H.a0[0] = a0.x; H.a0[1] = a0.y; H.a0[2] = a0.z;
+			H.p1[0] = e.x[i]; H.p1[1] = e.y[i]; H.p1[2] = e.z[i];
+			H.v1[0] = e.vx[i]; H.v1[1] = e.vy[i]; H.v1[2] = e.vz[i];
+			H.a1[0] = a1.x; H.a1[1] = a1.y; H.a1[2] = a1.z;
+			hermite_stamp[i] = stamp;
+		}
+		const Hermite& H = hermite[i];
+		double h = step, t2 = t * t, t3 = t2 * t, t4 = t3 * t, t5 = t4 * t;
+		double out[3];
+		if (!velocity)
+		{
+			double c_p0 = 1 - 10 * t3 + 15 * t4 - 6 * t5;
+			double c_v0 = (t - 6 * t3 + 8 * t4 - 3 * t5) * h;
+			double c_a0 = (0.5 * t2 - 1.5 * t3 + 1.5 * t4 - 0.5 * t5) * h * h;
+			double c_a1 = (0.5 * t3 - t4 + 0.5 * t5) * h * h;
+			double c_v1 = (-4 * t3 + 7 * t4 - 3 * t5) * h;
+			double c_p1 = 10 * t3 - 15 * t4 + 6 * t5;
+			for (int c = 0; c < 3; c++)
+			{
+				out[c] = c_p0 * H.p0[c] + c_v0 * H.v0[c] + c_a0 * H.a0[c] + c_a1 * H.a1[c] + c_v1 * H.v1[c] + c_p1 * H.p1[c];
+			}
+		}
+		else
+		{
+			// d/dt of the above: each d/dtheta over h
+			double c_p0 = (-30 * t2 + 60 * t3 - 30 * t4) / h;
+			double c_v0 = 1 - 18 * t2 + 32 * t3 - 15 * t4;
+			double c_a0 = (t - 4.5 * t2 + 6 * t3 - 2.5 * t4) * h;
+			double c_a1 = (1.5 * t2 - 4 * t3 + 2.5 * t4) * h;
+			double c_v1 = -12 * t2 + 28 * t3 - 15 * t4;
+			double c_p1 = (30 * t2 - 60 * t3 + 30 * t4) / h;
+			for (int c = 0; c < 3; c++)
+			{
+				out[c] = c_p0 * H.p0[c] + c_v0 * H.v0[c] + c_a0 * H.a0[c] + c_a1 * H.a1[c] + c_v1 * H.v1[c] + c_p1 * H.p1[c];
+			}
+		}
+		return { out[0], out[1], out[2] };
+	}
+
+	double G(const Definition& d, double t)
+	{
+		View v;
+		v.detector = this;
+		v.theta = t;
+		return d.g(v);
+	}
+
+	// Root of g between fractions a and b of the step, where it has opposite signs ga and gb
+	double Refine(const Definition& d, double a, double b, double ga, double gb)
+	{
+		int side = 0;
+		double tolerance = time_tolerance / step;
+		for (int k = 0; k < MAX_ITERATIONS && b - a > tolerance; k++)
+		{
+			double c = (a * gb - b * ga) / (gb - ga);
+			double gc = G(d, c);
+			if (gc == 0)
+			{
+				return c;
+			}
+			if ((gc > 0) == (gb > 0))
+			{
+				b = c; gb = gc;
+				if (side == -1)
+				{
+					ga /= 2; // Illinois: the same end twice running => halve the other's weight so it can't stall
+				}
+				side = -1;
+			}
+			else
+			{
+				a = c; ga = gc;
+				if (side == 1)
+				{
+					gb /= 2;
+				}
+				side = 1;
+			}
+		}
+		return (a * gb - b * ga) / (gb - ga);
+	}
+
+	void Log(int definition, double seconds, double value)
+	{
+		int capacity = ring.size();
+		if (count == capacity)
+		{
+			first = (first + 1) % capacity;
+			count--;
+		}
+		ring[(first + count) % capacity] = { definition, seconds, value };
+		count++;
+		total++;
+	}
+
+public:
+	/// <summary>
+	/// Watch for a condition of your own.
+	/// </summary>
+	/// <param name="name">To log it under</param>
+	/// <param name="g">Changes sign when the event happens. Must be continuous (no jumps between + and -).</param>
+	/// <param name="direction">Which way the sign has to change to count</param>
+	/// <param name="value">Worked out at the event and logged with it, if given</param>
+	/// <param name="limit">Only log the event if value is at most this</param>
+	/// <returns>Id of the event, for the log and Remove</returns>
+	int Add(const std::string& name, Function g, Direction direction = EITHER, Function value = NULL, double limit = std::numeric_limits<double>::infinity())
+	{
+		definitions.push_back({ next_id, name, g, direction, value, limit });
+		return next_id++;
+	}
+
+	/// <summary>
+	/// Periapsis and apoapsis of a body about another (-1 for the central body): where r . v goes through 0. Logs the distance.
+	/// </summary>
+	/// <returns>Id of the periapsis event. The apoapsis is the next id.</returns>
+	int Add_Apsides(const std::string& name, int handle, int about = -1)
+	{
+		Function g = [handle, about](View& v) { return Scalar_Product(v.Relative_Position(handle, about), v.Relative_Velocity(handle, about)); };
+		Function r = [handle, about](View& v) { return Magnitude(v.Relative_Position(handle, about)); };
+		int id = Add(name + " periapsis", g, RISING, r);
+		Add(name + " apoapsis", g, FALLING, r);
+		return id;
+	}
+
+	/// <summary>
+	/// A body crossing a plane through another body (-1 for the central body), such as the ecliptic: the nodes of its orbit.
+	/// </summary>
+	/// <param name="normal">Of the plane. Crossing along it is the ascending node, against it the descending.</param>
+	/// <returns>Id of the ascending node event. The descending node is the next id.</returns>
+	int Add_Plane_Crossing(const std::string& name, int handle, vector3 normal, int about = -1)
+	{
+		Function g = [handle, about, normal](View& v) { return Scalar_Product(v.Relative_Position(handle, about), normal); };
+		int id = Add(name + " ascending node", g, RISING);
+		Add(name + " descending node", g, FALLING);
+		return id;
+	}
+
+	/// <summary>
+	/// Closest approaches of two bodies (the minima of the distance between them), closer than a distance. Logs the distance.
+	/// </summary>
+	int Add_Close_Approach(const std::string& name, int a, int b, double within = std::numeric_limits<double>::infinity())
+	{
+		Function g = [a, b](View& v) { return Scalar_Product(v.Relative_Position(a, b), v.Relative_Velocity(a, b)); };
+		Function d = [a, b](View& v) { return Magnitude(v.Relative_Position(a, b)); };
+		return Add(name + " closest approach", g, RISING, d, within);
+	}
+
+	void Remove(int id)
+	{
+		for (int k = 0; k < (int)definitions.size(); k++)
+		{
+			if (definitions[k].id == id)
+			{
+				definitions.erase(definitions.begin() + k);
+				return;
+			}
+		}
+	}
+
+	// Stop watching for anything. The log is kept.
+	void Clear()
+	{
+		definitions.clear();
+	}
+
+	int Size()
+	{
+		return definitions.size();
+	}
+
+	std::string Name(int id)
+	{
+		for (const Definition& d : definitions)
+		{
+			if (d.id == id)
+			{
+				return d.name;
+			}
+		}
+		return "Event " + std::to_string(id);
+	}
+
+	void Set_Time_Tolerance(double seconds)
+	{
+		time_tolerance = std::max(0.0, seconds);
+	}
+
+	/// <summary>
+	/// Look for events in a step just taken. Events about bodies that are gone (merged, removed) are skipped.
+	/// </summary>
+	/// <param name="start">State at the start of the step, in the same slots as end (see SystemIntegrator::Get_Previous)</param>
+	/// <param name="end">State at the end of the step</param>
+	/// <param name="start_seconds">Simulated time at the start of the step</param>
+	/// <param name="dt">Length of the step (s)</param>
+	/// <returns>Events found</returns>
+	int Check(const StateBuffer& start, const PhysicsStore& end, double start_seconds, double dt)
+	{
+		if (definitions.empty() || dt <= 0 || start.x.size() != end.x.size())
+		{
+			return 0;
+		}
+		start_state = &start;
+		end_state = &end;
+		step_start = start_seconds;
+		step = dt;
+		stamp++;
+		if (hermite.size() < end.x.size())
+		{
+			hermite.resize(end.x.size());
+			hermite_stamp.resize(end.x.size(), 0);
+		}
+
+		long long before = total;
+		for (const Definition& d : definitions)
+		{
+			missing = false;
+			double a = 0;
+			double ga = G(d, 0);
+			if (missing)
+			{
+				continue;
+			}
+			for (int k = 1; k <= SAMPLES; k++)
+			{
+				double b = (double)k / SAMPLES;
+				double gb = G(d, b);
+				bool rising = ga < 0 && gb >= 0;
+				bool falling = ga > 0 && gb <= 0;
+				if ((rising && d.direction != FALLING) || (falling && d.direction != RISING))
+				{
+					double t = gb == 0 ? b : Refine(d, a, b, ga, gb);
+					View v;
+					v.detector = this;
+					v.theta = t;
+					double value = d.value ? d.value(v) : 0;
+					if (value <= d.limit)
+					{
+						Log(d.id, start_seconds + t * dt, value);
+					}
+				}
+				a = b;
+				ga = gb;
+			}
+		}
+		return (int)(total - before);
+	}
+
+	// Events in the log, oldest first
+	int Logged()
+	{
+		return count;
+	}
+
+	const Event& Get_Event(int i)
+	{
+		return ring[(first + i) % ring.size()];
+	}
+
+	// Events ever logged, including any the ring has dropped
+	long long Total()
+	{
+		return total;
+	}
+
+	void Clear_Log()
+	{
+		first = 0;
+		count = 0;
+	}
+
+	// One line for the console or the GUI
+	std::string Describe(const Event& e)
+	{
+		std::string s = Name(e.definition) + " at " + std::to_string(e.seconds / 86400) + " days";
+		if (e.value != 0)
+		{
+			s += " (" + std::to_string(e.value / 1000) + " km)";
+		}
+		return s;
+	}
+
+	bool Write_CSV(const std::string& path)
+	{
+		std::ofstream out(path);
+		if (!out)
+		{
+			std::cout << "\nERR. Writing events to " << path << " failed.";
+			return false;
+		}
+		out.precision(17);
+		out << "seconds,event,value\n";
+		for (int i = 0; i < count; i++)
+		{
+			const Event& e = Get_Event(i);
+			out << e.seconds << "," << Name(e.definition) << "," << e.value << "\n";
+		}
+		return true;
+	}
+};
+
+#endif /*EVENTS_H*/
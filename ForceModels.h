@@ -0,0 +1,138 @@
+#pragma once
+#ifndef FORCEMODELS_H
+#define FORCEMODELS_H
+
+#include <cmath>
+#include <algorithm>
+#include "vec3.h"
+
+/*
+	Forces on top of point mass gravity, plugged into the system integrators at compile time: BasicSystemIntegrator is
+	a template over a ForceModel, which is just the list of extra forces to add.
+
+		BasicSystemIntegrator<ForceModel<>> (SystemIntegrator) - gravity alone. ForceModel<> adds nothing, so there is
+			nothing to branch on and nothing left after inlining: it compiles to the same code as before there were models.
+		BasicSystemIntegrator<ForceModel<J2Oblateness, AtmosphericDrag>> - gravity, the central body's oblateness and drag.
+
+	A ForceModel derives from every model it lists, so their settings are set straight on the integrator's forces member
+	(integrator.forces.j2 = 1.08263E-3). Each model only has to provide
+
+		void Add(const ForceState& s, double mu, vector3& a) const
+
+	which adds its acceleration on one body into a. The integrators call it wherever they work out gravity: every stage of
+	every method, and the perturbations of satellites in their parent's frame.
+
+	Velocity dependent forces (drag) aren't symplectic, so the leapfrog family lose their bounded energy error with them on,
+	as they should: drag takes energy out. The kicks see the velocity the bodies have at the time of the kick.
+*/
+
+// One body, as the force models see it
+struct ForceState
+{
+	vector3 r, v; // Position and velocity relative to the central body (m, m/s)
+	vector3 relative_r, relative_v; // Relative to the body's parent. The same as r, v for a body with none.
+	double parent_radius; // Of the parent (m), 0 for a body with none
+};
+
+/*
+	Oblateness of the central body (its J2 term), with its pole along z. Pulls bodies towards its equator and makes orbits
+	precess: what keeps a sun-synchronous satellite sun-synchronous.
+*/
+struct J2Oblateness
+{
+	double j2 = 0; // 1.08263E-3 for the Earth, 2E-7 for the Sun
+	double j2_radius = 0; // Equatorial radius of the central body (m)
+
+	void Add(const ForceState& s, double mu, vector3& a) const
+	{
+		double r2 = s.r.x * s.r.x + s.r.y * s.r.y + s.r.z * s.r.z;
+		if (r2 <= 0 || j2 == 0)
+		{
+			return;
+		}
+		double r = sqrt(r2);
+		double k = -1.5 * j2 * mu * j2_radius * j2_radius / (r2 * r2 * r);
+		double z2 = 5 * s.r.z * s.r.z / r2;
+		a.x += k * s.r.x * (1 - z2);
+		a.y += k * s.r.y * (1 - z2);
+		a.z += k * s.r.z * (3 - z2);
+	}
+};
+
+/*
+	Drag from the parent's atmosphere on satellites, with density falling off exponentially with height. The atmosphere
+	doesn't turn with the planet. Bodies without a parent (planets) don't feel it.
+*/
+struct AtmosphericDrag
+{
+	double drag_density = 1.225; // At the surface (kg/m^3)
+	double drag_scale_height = 8500; // Height over which the density falls by e (m)
+	double drag_ballistic = 0.01; // Drag coefficient * area / mass (m^2/kg)
+
+	void Add(const ForceState& s, double /*mu*/, vector3& a) const
+	{
+		if (s.parent_radius <= 0)
+		{
+			return;
+		}
+		double height = std::max(0.0, Magnitude(s.relative_r) - s.parent_radius);
+		double rho = drag_density * exp(-height / drag_scale_height);
+		double speed = Magnitude(s.relative_v);
+		double k = -0.5 * rho * drag_ballistic * speed;
+		a.x += k * s.relative_v.x;
+		a.y += k * s.relative_v.y;
+		a.z += k * s.relative_v.z;
+	}
+};
+
+/*
+	Sunlight pushing on satellites, away from the central body (taken to be the Sun), falling off with the square of the
+	distance. No shadowing. Planets are too heavy for their area to notice, so only bodies with a parent feel it.
+*/
+struct RadiationPressure
+{
+	double radiation_pressure = 4.56E-6; // At 1 AU (N/m^2)
+	double radiation_area_to_mass = 0.01; // Reflectivity * area / mass (m^2/kg)
+
+	void Add(const ForceState& s, double /*mu*/, vector3& a) const
+	{
+		const double AU = 1.495978707E11;
+		double r2 = s.r.x * s.r.x + s.r.y * s.r.y + s.r.z * s.r.z;
+		if (s.parent_radius <= 0 || r2 <= 0)
+		{
+			return;
+		}
+		double k = radiation_pressure * radiation_area_to_mass * AU * AU / (r2 * sqrt(r2));
+		a.x += k * s.r.x;
+		a.y += k * s.r.y;
+		a.z += k * s.r.z;
+	}
+};
+
+/*
+	Gravity plus the listed models. See the top of the file.
+*/
+template <class... Models>
+struct ForceModel : Models...
+{
+	static const bool EMPTY = sizeof...(Models) == 0; // Nothing to add: the integrators skip working out ForceStates at all
+
+	void Add(const ForceState& s, double mu, vector3& a) const
+	{
+		int expand[] = { 0, (Models::Add(s, mu, a), 0)... }; // Each model in turn, unrolled at compile time
+		(void)expand;
+		(void)s; // Unused by ForceModel<>
+		(void)mu;
+		(void)a;
+	}
+
+	// Copy the settings of each model listed here out of another ForceModel that lists them too (and maybe more)
+	template <class Other>
+	void Take_Settings(const Other& other)
+	{
+		int expand[] = { 0, (static_cast<Models&>(*this) = static_cast<const Models&>(other), 0)... };
+		(void)expand;
+	}
+};
+
+#endif /*FORCEMODELS_H*/
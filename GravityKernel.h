@@ -0,0 +1,547 @@
+#pragma once
+#ifndef GRAVITYKERNEL_H
+#define GRAVITYKERNEL_H
+
+#include <string>
+#include <cmath>
+#include <chrono>
+#include <atomic>
+#include "vec3.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define ORBYTE_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define ORBYTE_TARGET(isa) // MSVC lets any function use any intrinsic
+#else
+#define ORBYTE_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+/*
+	The pairwise gravity loop, written once per instruction set and picked at runtime depending on what the CPU can do.
+
+	Each kernel works on a "row": one body i against a contiguous range of bodies j. The wide kernels do 2 (SSE2), 4 (AVX2) or
+	8 (AVX-512) j's at a time. Instead of sqrt, three pow(mag, 3) and a Normalize per pair, 1/|r|^3 comes from a hardware
+	reciprocal square root estimate, polished with Newton-Raphson steps until it is as good as a double division: within
+	about 1E-15 of the scalar kernel per pair.
+
+	SSE2 and AVX2 only have single precision rsqrt, so r^2 takes a trip through float for the first guess. From its 12 bits
+	they need three steps, where AVX-512's 14 bit double estimate needs two. That guess is only meaningful for separations
+	between roughly 1E-19 m and 1E19 m, which covers anything we'd simulate by a wide margin.
+	The scalar kernel does the division properly and is the exact reference.
+
+	When ax/ay/az are given, the row is symmetric: j also receives the equal and opposite pull from i (Newton's third law).
+	That is how the system integrators' direct sum runs (see Pair_Rows), so each pair costs one evaluation, not two.
+
+	Test particles turn the loop the other way round: a handful of bodies pull on a great many points, so the "field" kernels
+	take one body against a contiguous range of points and go wide over the points instead.
+
+	Every kernel takes a Plummer softening length squared, eps2, which is simply added to r^2. Bodies then behave like fuzzy
+	clouds of that size rather than points, so two that pass through each other feel a large but finite pull. With eps2 = 0
+	the answer is bitwise the same as without it (adding 0 changes nothing, and neither does the fused multiply-add).
+*/
+class GravityKernel
+{
+public:
+	enum Level { SCALAR = 0, SSE2 = 1, AVX2 = 2, AVX512 = 3 };
+
+private:
+	struct Stats
+	{
+		long long interactions = 0;
+		double seconds = 0;
+	};
+
+	// Atomic so the GUI can switch kernels while the simulation thread is using them
+	static std::atomic<Level>& Current()
+	{
+		static std::atomic<Level> level{ Best_Supported() };
+		return level;
+	}
+
+	// Per thread: each thread reports the kernel time it spent itself
+	static Stats& Statistics()
+	{
+		static thread_local Stats stats;
+		return stats;
+	}
+
+	// i against j in [j0, j1). Sum of i's acceleration goes into out[3]
+	static void Row_Scalar(double px, double py, double pz, double gmi, int j0, int j1, const double* x, const double* y, const double* z, const double* gm, double eps2, double* ax, double* ay, double* az, double* out)
+	{
+		double axi = 0, ayi = 0, azi = 0;
+		for (int j = j0; j < j1; j++)
+		{
+			double rx = px - x[j];
+			double ry = py - y[j];
+			double rz = pz - z[j];
+			double r2 = rx * rx + ry * ry + rz * rz + eps2;
+			if (r2 == 0)
+			{
+				continue;
+			}
+			double inv_cube = 1 / (r2 * sqrt(r2));
+			double si = gm[j] * inv_cube;
+			axi -= rx * si; ayi -= ry * si; azi -= rz * si;
+			if (ax != NULL)
+			{
+				double sj = gmi * inv_cube;
+				ax[j] += rx * sj; ay[j] += ry * sj; az[j] += rz * sj;
+			}
+		}
+		out[0] += axi; out[1] += ayi; out[2] += azi;
+	}
+
+	// Body (bx, by, bz, gm) against points [i0, i1). Adds each point's acceleration onto ax, ay, az.
+	static void Field_Scalar(double bx, double by, double bz, double gm, int i0, int i1, const double* x, const double* y, const double* z, double eps2, double* ax, double* ay, double* az)
+	{
+		for (int i = i0; i < i1; i++)
+		{
+			double rx = bx - x[i];
+			double ry = by - y[i];
+			double rz = bz - z[i];
+			double r2 = rx * rx + ry * ry + rz * rz + eps2;
+			if (r2 == 0)
+			{
+				continue;
+			}
+			double s = gm / (r2 * sqrt(r2));
+			ax[i] += rx * s; ay[i] += ry * s; az[i] += rz * s;
+		}
+	}
+
+#ifdef ORBYTE_X86
+	ORBYTE_TARGET("sse2")
+	static void Field_SSE2(double bx, double by, double bz, double gm, int i0, int i1, const double* x, const double* y, const double* z, double eps2, double* ax, double* ay, double* az)
+	{
+		const __m128d zero = _mm_setzero_pd(), half = _mm_set1_pd(0.5), three_halves = _mm_set1_pd(1.5);
+		__m128d vbx = _mm_set1_pd(bx), vby = _mm_set1_pd(by), vbz = _mm_set1_pd(bz), vgm = _mm_set1_pd(gm), veps2 = _mm_set1_pd(eps2);
+		int i = i0;
+		for (; i + 2 <= i1; i += 2)
+		{
+			__m128d rx = _mm_sub_pd(vbx, _mm_loadu_pd(x + i));
+			__m128d ry = _mm_sub_pd(vby, _mm_loadu_pd(y + i));
+			__m128d rz = _mm_sub_pd(vbz, _mm_loadu_pd(z + i));
+			__m128d r2 = _mm_add_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(rx, rx), _mm_mul_pd(ry, ry)), _mm_mul_pd(rz, rz)), veps2);
+			__m128d inv = _mm_cvtps_pd(_mm_rsqrt_ps(_mm_cvtpd_ps(r2)));
+			__m128d half_r2 = _mm_mul_pd(half, r2);
+			inv = _mm_mul_pd(inv, _mm_sub_pd(three_halves, _mm_mul_pd(half_r2, _mm_mul_pd(inv, inv))));
+			inv = _mm_mul_pd(inv, _mm_sub_pd(three_halves, _mm_mul_pd(half_r2, _mm_mul_pd(inv, inv))));
+			inv = _mm_mul_pd(inv, _mm_sub_pd(three_halves, _mm_mul_pd(half_r2, _mm_mul_pd(inv, inv))));
+			inv = _mm_and_pd(inv, _mm_cmpneq_pd(r2, zero));
+			__m128d s = _mm_mul_pd(vgm, _mm_mul_pd(inv, _mm_mul_pd(inv, inv)));
+			_mm_storeu_pd(ax + i, _mm_add_pd(_mm_loadu_pd(ax + i), _mm_mul_pd(rx, s)));
+			_mm_storeu_pd(ay + i, _mm_add_pd(_mm_loadu_pd(ay + i), _mm_mul_pd(ry, s)));
+			_mm_storeu_pd(az + i, _mm_add_pd(_mm_loadu_pd(az + i), _mm_mul_pd(rz, s)));
+		}
+		Field_Scalar(bx, by, bz, gm, i, i1, x, y, z, eps2, ax, ay, az); // Leftovers
+	}
+
+	ORBYTE_TARGET("avx2,fma")
+	static void Field_AVX2(double bx, double by, double bz, double gm, int i0, int i1, const double* x, const double* y, const double* z, double eps2, double* ax, double* ay, double* az)
+	{
+		const __m256d zero = _mm256_setzero_pd(), half = _mm256_set1_pd(0.5), three_halves = _mm256_set1_pd(1.5);
+		__m256d vbx = _mm256_set1_pd(bx), vby = _mm256_set1_pd(by), vbz = _mm256_set1_pd(bz), vgm = _mm256_set1_pd(gm), veps2 = _mm256_set1_pd(eps2);
+		int i = i0;
+		for (; i + 4 <= i1; i += 4)
+		{
+			__m256d rx = _mm256_sub_pd(vbx, _mm256_loadu_pd(x + i));
+			__m256d ry = _mm256_sub_pd(vby, _mm256_loadu_pd(y + i));
+			__m256d rz = _mm256_sub_pd(vbz, _mm256_loadu_pd(z + i));
+			__m256d r2 = _mm256_fmadd_pd(rz, rz, _mm256_fmadd_pd(ry, ry, _mm256_fmadd_pd(rx, rx, veps2)));
+			__m256d inv = _mm256_cvtps_pd(_mm_rsqrt_ps(_mm256_cvtpd_ps(r2)));
+			__m256d half_r2 = _mm256_mul_pd(half, r2);
+			inv = _mm256_mul_pd(inv, _mm256_fnmadd_pd(half_r2, _mm256_mul_pd(inv, inv), three_halves));
+			inv = _mm256_mul_pd(inv, _mm256_fnmadd_pd(half_r2, _mm256_mul_pd(inv, inv), three_halves));
+			inv = _mm256_mul_pd(inv, _mm256_fnmadd_pd(half_r2, _mm256_mul_pd(inv, inv), three_halves));
+			inv = _mm256_and_pd(inv, _mm256_cmp_pd(r2, zero, _CMP_NEQ_OQ));
+			__m256d s = _mm256_mul_pd(vgm, _mm256_mul_pd(inv, _mm256_mul_pd(inv, inv)));
+			_mm256_storeu_pd(ax + i, _mm256_fmadd_pd(rx, s, _mm256_loadu_pd(ax + i)));
+			_mm256_storeu_pd(ay + i, _mm256_fmadd_pd(ry, s, _mm256_loadu_pd(ay + i)));
+			_mm256_storeu_pd(az + i, _mm256_fmadd_pd(rz, s, _mm256_loadu_pd(az + i)));
+		}
+		Field_Scalar(bx, by, bz, gm, i, i1, x, y, z, eps2, ax, ay, az); // Leftovers
+	}
+
+	ORBYTE_TARGET("avx512f")
+	static void Field_AVX512(double bx, double by, double bz, double gm, int i0, int i1, const double* x, const double* y, const double* z, double eps2, double* ax, double* ay, double* az)
+	{
+		const __m512d zero = _mm512_setzero_pd(), half = _mm512_set1_pd(0.5), three_halves = _mm512_set1_pd(1.5);
+		__m512d vbx = _mm512_set1_pd(bx), vby = _mm512_set1_pd(by), vbz = _mm512_set1_pd(bz), vgm = _mm512_set1_pd(gm), veps2 = _mm512_set1_pd(eps2);
+		int i = i0;
+		for (; i + 8 <= i1; i += 8)
+		{
+			__m512d rx = _mm512_sub_pd(vbx, _mm512_loadu_pd(x + i));
+			__m512d ry = _mm512_sub_pd(vby, _mm512_loadu_pd(y + i));
+			__m512d rz = _mm512_sub_pd(vbz, _mm512_loadu_pd(z + i));
+			__m512d r2 = _mm512_fmadd_pd(rz, rz, _mm512_fmadd_pd(ry, ry, _mm512_fmadd_pd(rx, rx, veps2)));
+			__mmask8 nonzero = _mm512_cmp_pd_mask(r2, zero, _CMP_NEQ_OQ);
+			__m512d inv = _mm512_maskz_rsqrt14_pd(nonzero, r2);
+			__m512d half_r2 = _mm512_mul_pd(half, r2);
+			inv = _mm512_mul_pd(inv, _mm512_fnmadd_pd(half_r2, _mm512_mul_pd(inv, inv), three_halves));
+			inv = _mm512_mul_pd(inv, _mm512_fnmadd_pd(half_r2, _mm512_mul_pd(inv, inv), three_halves));
+			__m512d s = _mm512_mul_pd(vgm, _mm512_mul_pd(inv, _mm512_mul_pd(inv, inv)));
+			_mm512_storeu_pd(ax + i, _mm512_fmadd_pd(rx, s, _mm512_loadu_pd(ax + i)));
+			_mm512_storeu_pd(ay + i, _mm512_fmadd_pd(ry, s, _mm512_loadu_pd(ay + i)));
+			_mm512_storeu_pd(az + i, _mm512_fmadd_pd(rz, s, _mm512_loadu_pd(az + i)));
+		}
+		Field_Scalar(bx, by, bz, gm, i, i1, x, y, z, eps2, ax, ay, az); // Leftovers
+	}
+
+	ORBYTE_TARGET("sse2")
+	static void Row_SSE2(double px, double py, double pz, double gmi, int j0, int j1, const double* x, const double* y, const double* z, const double* gm, double eps2, double* ax, double* ay, double* az, double* out)
+	{
+		const __m128d zero = _mm_setzero_pd(), half = _mm_set1_pd(0.5), three_halves = _mm_set1_pd(1.5);
+		__m128d vpx = _mm_set1_pd(px), vpy = _mm_set1_pd(py), vpz = _mm_set1_pd(pz), vgmi = _mm_set1_pd(gmi), veps2 = _mm_set1_pd(eps2);
+		__m128d axi = zero, ayi = zero, azi = zero;
+		int j = j0;
+		for (; j + 2 <= j1; j += 2)
+		{
+			__m128d rx = _mm_sub_pd(vpx, _mm_loadu_pd(x + j));
+			__m128d ry = _mm_sub_pd(vpy, _mm_loadu_pd(y + j));
+			__m128d rz = _mm_sub_pd(vpz, _mm_loadu_pd(z + j));
+			__m128d r2 = _mm_add_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(rx, rx), _mm_mul_pd(ry, ry)), _mm_mul_pd(rz, rz)), veps2);
+
+			// 12 bit guess => 24 => 48 => full double precision
+			__m128d inv = _mm_cvtps_pd(_mm_rsqrt_ps(_mm_cvtpd_ps(r2)));
+			__m128d half_r2 = _mm_mul_pd(half, r2);
+			inv = _mm_mul_pd(inv, _mm_sub_pd(three_halves, _mm_mul_pd(half_r2, _mm_mul_pd(inv, inv))));
+			inv = _mm_mul_pd(inv, _mm_sub_pd(three_halves, _mm_mul_pd(half_r2, _mm_mul_pd(inv, inv))));
+			inv = _mm_mul_pd(inv, _mm_sub_pd(three_halves, _mm_mul_pd(half_r2, _mm_mul_pd(inv, inv))));
+			inv = _mm_and_pd(inv, _mm_cmpneq_pd(r2, zero)); // Coincident bodies don't interact
+			__m128d inv_cube = _mm_mul_pd(inv, _mm_mul_pd(inv, inv));
+
+			__m128d si = _mm_mul_pd(_mm_loadu_pd(gm + j), inv_cube);
+			axi = _mm_sub_pd(axi, _mm_mul_pd(rx, si));
+			ayi = _mm_sub_pd(ayi, _mm_mul_pd(ry, si));
+			azi = _mm_sub_pd(azi, _mm_mul_pd(rz, si));
+			if (ax != NULL)
+			{
+				__m128d sj = _mm_mul_pd(vgmi, inv_cube);
+				_mm_storeu_pd(ax + j, _mm_add_pd(_mm_loadu_pd(ax + j), _mm_mul_pd(rx, sj)));
+				_mm_storeu_pd(ay + j, _mm_add_pd(_mm_loadu_pd(ay + j), _mm_mul_pd(ry, sj)));
+				_mm_storeu_pd(az + j, _mm_add_pd(_mm_loadu_pd(az + j), _mm_mul_pd(rz, sj)));
+			}
+		}
+		double lanes[2];
+		_mm_storeu_pd(lanes, axi); out[0] += lanes[0] + lanes[1];
+		_mm_storeu_pd(lanes, ayi); out[1] += lanes[0] + lanes[1];
+		_mm_storeu_pd(lanes, azi); out[2] += lanes[0] + lanes[1];
+		Row_Scalar(px, py, pz, gmi, j, j1, x, y, z, gm, eps2, ax, ay, az, out); // Leftovers
+	}
+
+	ORBYTE_TARGET("avx2,fma")
+	static void Row_AVX2(double px, double py, double pz, double gmi, int j0, int j1, const double* x, const double* y, const double* z, const double* gm, double eps2, double* ax, double* ay, double* az, double* out)
+	{
+		const __m256d zero = _mm256_setzero_pd(), half = _mm256_set1_pd(0.5), three_halves = _mm256_set1_pd(1.5);
+		__m256d vpx = _mm256_set1_pd(px), vpy = _mm256_set1_pd(py), vpz = _mm256_set1_pd(pz), vgmi = _mm256_set1_pd(gmi), veps2 = _mm256_set1_pd(eps2);
+		__m256d axi = zero, ayi = zero, azi = zero;
+		int j = j0;
+		for (; j + 4 <= j1; j += 4)
+		{
+			__m256d rx = _mm256_sub_pd(vpx, _mm256_loadu_pd(x + j));
+			__m256d ry = _mm256_sub_pd(vpy, _mm256_loadu_pd(y + j));
+			__m256d rz = _mm256_sub_pd(vpz, _mm256_loadu_pd(z + j));
+			__m256d r2 = _mm256_fmadd_pd(rz, rz, _mm256_fmadd_pd(ry, ry, _mm256_fmadd_pd(rx, rx, veps2)));
+
+			// 12 bit guess => 24 => 48 => full double precision
+			__m256d inv = _mm256_cvtps_pd(_mm_rsqrt_ps(_mm256_cvtpd_ps(r2)));
+			__m256d half_r2 = _mm256_mul_pd(half, r2);
+			inv = _mm256_mul_pd(inv, _mm256_fnmadd_pd(half_r2, _mm256_mul_pd(inv, inv), three_halves));
+			inv = _mm256_mul_pd(inv, _mm256_fnmadd_pd(half_r2, _mm256_mul_pd(inv, inv), three_halves));
+			inv = _mm256_mul_pd(inv, _mm256_fnmadd_pd(half_r2, _mm256_mul_pd(inv, inv), three_halves));
+			inv = _mm256_and_pd(inv, _mm256_cmp_pd(r2, zero, _CMP_NEQ_OQ)); // Coincident bodies don't interact
+			__m256d inv_cube = _mm256_mul_pd(inv, _mm256_mul_pd(inv, inv));
+
+			__m256d si = _mm256_mul_pd(_mm256_loadu_pd(gm + j), inv_cube);
+			axi = _mm256_fnmadd_pd(rx, si, axi);
+			ayi = _mm256_fnmadd_pd(ry, si, ayi);
+			azi = _mm256_fnmadd_pd(rz, si, azi);
+			if (ax != NULL)
+			{
+				__m256d sj = _mm256_mul_pd(vgmi, inv_cube);
+				_mm256_storeu_pd(ax + j, _mm256_fmadd_pd(rx, sj, _mm256_loadu_pd(ax + j)));
+				_mm256_storeu_pd(ay + j, _mm256_fmadd_pd(ry, sj, _mm256_loadu_pd(ay + j)));
+				_mm256_storeu_pd(az + j, _mm256_fmadd_pd(rz, sj, _mm256_loadu_pd(az + j)));
+			}
+		}
+		double lanes[4];
+		_mm256_storeu_pd(lanes, axi); out[0] += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+		_mm256_storeu_pd(lanes, ayi); out[1] += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+		_mm256_storeu_pd(lanes, azi); out[2] += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+		Row_Scalar(px, py, pz, gmi, j, j1, x, y, z, gm, eps2, ax, ay, az, out); // Leftovers
+	}
+
+	ORBYTE_TARGET("avx512f")
+	static void Row_AVX512(double px, double py, double pz, double gmi, int j0, int j1, const double* x, const double* y, const double* z, const double* gm, double eps2, double* ax, double* ay, double* az, double* out)
+	{
+		const __m512d zero = _mm512_setzero_pd(), half = _mm512_set1_pd(0.5), three_halves = _mm512_set1_pd(1.5);
+		__m512d vpx = _mm512_set1_pd(px), vpy = _mm512_set1_pd(py), vpz = _mm512_set1_pd(pz), vgmi = _mm512_set1_pd(gmi), veps2 = _mm512_set1_pd(eps2);
+		__m512d axi = zero, ayi = zero, azi = zero;
+		int j = j0;
+		for (; j + 8 <= j1; j += 8)
+		{
+			__m512d rx = _mm512_sub_pd(vpx, _mm512_loadu_pd(x + j));
+			__m512d ry = _mm512_sub_pd(vpy, _mm512_loadu_pd(y + j));
+			__m512d rz = _mm512_sub_pd(vpz, _mm512_loadu_pd(z + j));
+			__m512d r2 = _mm512_fmadd_pd(rz, rz, _mm512_fmadd_pd(ry, ry, _mm512_fmadd_pd(rx, rx, veps2)));
+
+			// Double precision estimate straight away: 14 bits => 28 => 56 bits
+			__mmask8 nonzero = _mm512_cmp_pd_mask(r2, zero, _CMP_NEQ_OQ); // Coincident bodies don't interact
+			__m512d inv = _mm512_maskz_rsqrt14_pd(nonzero, r2);
+			__m512d half_r2 = _mm512_mul_pd(half, r2);
+			inv = _mm512_mul_pd(inv, _mm512_fnmadd_pd(half_r2, _mm512_mul_pd(inv, inv), three_halves));
+			inv = _mm512_mul_pd(inv, _mm512_fnmadd_pd(half_r2, _mm512_mul_pd(inv, inv), three_halves));
+			__m512d inv_cube = _mm512_mul_pd(inv, _mm512_mul_pd(inv, inv));
+
+			__m512d si = _mm512_mul_pd(_mm512_loadu_pd(gm + j), inv_cube);
+			axi = _mm512_fnmadd_pd(rx, si, axi);
+			ayi = _mm512_fnmadd_pd(ry, si, ayi);
+			azi = _mm512_fnmadd_pd(rz, si, azi);
+			if (ax != NULL)
+			{
+				__m512d sj = _mm512_mul_pd(vgmi, inv_cube);
+				_mm512_storeu_pd(ax + j, _mm512_fmadd_pd(rx, sj, _mm512_loadu_pd(ax + j)));
+				_mm512_storeu_pd(ay + j, _mm512_fmadd_pd(ry, sj, _mm512_loadu_pd(ay + j)));
+				_mm512_storeu_pd(az + j, _mm512_fmadd_pd(rz, sj, _mm512_loadu_pd(az + j)));
+			}
+		}
+		out[0] += _mm512_reduce_add_pd(axi);
+		out[1] += _mm512_reduce_add_pd(ayi);
+		out[2] += _mm512_reduce_add_pd(azi);
+		Row_Scalar(px, py, pz, gmi, j, j1, x, y, z, gm, eps2, ax, ay, az, out); // Leftovers
+	}
+#endif
+
+	static void Row(double px, double py, double pz, double gmi, int j0, int j1, const double* x, const double* y, const double* z, const double* gm, double eps2, double* ax, double* ay, double* az, double* out)
+	{
+		switch (Current())
+		{
+#ifdef ORBYTE_X86
+		case AVX512: Row_AVX512(px, py, pz, gmi, j0, j1, x, y, z, gm, eps2, ax, ay, az, out); return;
+		case AVX2: Row_AVX2(px, py, pz, gmi, j0, j1, x, y, z, gm, eps2, ax, ay, az, out); return;
+		case SSE2: Row_SSE2(px, py, pz, gmi, j0, j1, x, y, z, gm, eps2, ax, ay, az, out); return;
+#endif
+		default: Row_Scalar(px, py, pz, gmi, j0, j1, x, y, z, gm, eps2, ax, ay, az, out); return;
+		}
+	}
+
+	static void Field_Row(double bx, double by, double bz, double gm, int i0, int i1, const double* x, const double* y, const double* z, double eps2, double* ax, double* ay, double* az)
+	{
+		switch (Current())
+		{
+#ifdef ORBYTE_X86
+		case AVX512: Field_AVX512(bx, by, bz, gm, i0, i1, x, y, z, eps2, ax, ay, az); return;
+		case AVX2: Field_AVX2(bx, by, bz, gm, i0, i1, x, y, z, eps2, ax, ay, az); return;
+		case SSE2: Field_SSE2(bx, by, bz, gm, i0, i1, x, y, z, eps2, ax, ay, az); return;
+#endif
+		default: Field_Scalar(bx, by, bz, gm, i0, i1, x, y, z, eps2, ax, ay, az); return;
+		}
+	}
+
+	static void Record(long long interactions, std::chrono::high_resolution_clock::time_point start)
+	{
+		std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+		Record(interactions, elapsed.count());
+	}
+
+public:
+	static bool Supported(Level level)
+	{
+		if (level == SCALAR)
+		{
+			return true;
+		}
+#ifdef ORBYTE_X86
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 0);
+		int max_leaf = info[0];
+		__cpuid(info, 1);
+		bool sse2 = (info[3] & (1 << 26)) != 0;
+		bool fma = (info[2] & (1 << 12)) != 0;
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+		bool os_avx = (xcr0 & 0x6) == 0x6; // OS saves the YMM registers
+		bool os_avx512 = (xcr0 & 0xE6) == 0xE6; // ...and the ZMM ones
+		bool avx2 = false, avx512f = false;
+		if (max_leaf >= 7)
+		{
+			__cpuidex(info, 7, 0);
+			avx2 = (info[1] & (1 << 5)) != 0;
+			avx512f = (info[1] & (1 << 16)) != 0;
+		}
+		switch (level)
+		{
+		case SSE2: return sse2;
+		case AVX2: return avx2 && fma && os_avx;
+		case AVX512: return avx512f && os_avx512;
+		default: return false;
+		}
+#else
+		__builtin_cpu_init();
+		switch (level)
+		{
+		case SSE2: return __builtin_cpu_supports("sse2");
+		case AVX2: return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+		case AVX512: return __builtin_cpu_supports("avx512f");
+		default: return false;
+		}
+#endif
+#else
+		return false;
+#endif
+	}
+
+	static Level Best_Supported()
+	{
+		for (int l = AVX512; l > SCALAR; l--)
+		{
+			if (Supported((Level)l))
+			{
+				return (Level)l;
+			}
+		}
+		return SCALAR;
+	}
+
+	static Level Get_Level()
+	{
+		return Current();
+	}
+
+	// Returns false (and changes nothing) if this CPU can't run that kernel
+	static bool Set_Level(Level level)
+	{
+		if (!Supported(level))
+		{
+			return false;
+		}
+		Current() = level;
+		return true;
+	}
+
+	// Move on to the next kernel this CPU supports, wrapping back round to scalar
+	static Level Cycle_Level()
+	{
+		int l = Current().load();
+		do
+		{
+			l = (l + 1) % 4;
+		} while (!Supported((Level)l));
+		Current() = (Level)l;
+		return Current();
+	}
+
+	static std::string Name(Level level)
+	{
+		switch (level)
+		{
+		case SSE2: return "SSE2";
+		case AVX2: return "AVX2";
+		case AVX512: return "AVX-512";
+		default: return "Scalar";
+		}
+	}
+
+	/// <summary>
+	/// Adds the mutual gravity of every pair (i, j) with i in [i0, i1) and i < j < n onto ax, ay, az. Each pair is visited
+	/// once, and both of its bodies get their pull. Only ax, ay, az are written, and only from i0 on, so threads can run
+	/// rows at once as long as each has its own. Not timed (see Record).
+	/// </summary>
+	/// <param name="eps2">Plummer softening length squared: every pair feels gm / (r^2 + eps2) instead of gm / r^2</param>
+	static void Pair_Rows(int i0, int i1, const double* x, const double* y, const double* z, const double* gm, int n, double* ax, double* ay, double* az, double eps2 = 0)
+	{
+		for (int i = i0; i < i1; i++)
+		{
+			double out[3] = { 0, 0, 0 };
+			Row(x[i], y[i], z[i], gm[i], i + 1, n, x, y, z, gm, eps2, ax, ay, az, out);
+			ax[i] += out[0];
+			ay[i] += out[1];
+			az[i] += out[2];
+		}
+	}
+
+	/// <summary>
+	/// Acceleration at p due to every body in [0, n) except skip (pass -1 to skip nobody).
+	/// </summary>
+	static vector3 At_Point(vector3 p, const double* x, const double* y, const double* z, const double* gm, int n, int skip = -1, double eps2 = 0)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		double out[3] = { 0, 0, 0 };
+		if (skip >= 0 && skip < n)
+		{
+			Row(p.x, p.y, p.z, 0, 0, skip, x, y, z, gm, eps2, NULL, NULL, NULL, out);
+			Row(p.x, p.y, p.z, 0, skip + 1, n, x, y, z, gm, eps2, NULL, NULL, NULL, out);
+			Record(n - 1, start);
+		}
+		else
+		{
+			Row(p.x, p.y, p.z, 0, 0, n, x, y, z, gm, eps2, NULL, NULL, NULL, out);
+			Record(n, start);
+		}
+		return { out[0], out[1], out[2] };
+	}
+
+	/// <summary>
+	/// Acceleration and jerk (its time derivative) of body i due to every other body in [0, n), added onto acc[3] and jerk[3].
+	/// Scalar only: it is for the Hermite integrator, which only evaluates the few bodies due a step. Not timed, and only
+	/// reads shared memory, so it is safe to call from several threads at once (see Record).
+	/// </summary>
+	static void Full_Row_With_Jerk(int i, const double* x, const double* y, const double* z, const double* vx, const double* vy, const double* vz, const double* gm, int n, double* acc, double* jerk, double eps2 = 0)
+	{
+		double ax = 0, ay = 0, az = 0, jx = 0, jy = 0, jz = 0;
+		for (int j = 0; j < n; j++)
+		{
+			double rx = x[j] - x[i], ry = y[j] - y[i], rz = z[j] - z[i];
+			double r2 = rx * rx + ry * ry + rz * rz + eps2;
+			if (j == i || r2 == 0)
+			{
+				continue;
+			}
+			double wx = vx[j] - vx[i], wy = vy[j] - vy[i], wz = vz[j] - vz[i];
+			double inv_r2 = 1 / r2;
+			double k = gm[j] * inv_r2 * sqrt(inv_r2); // gm / r^3
+			double rv = 3 * (rx * wx + ry * wy + rz * wz) * inv_r2;
+			ax += rx * k; ay += ry * k; az += rz * k;
+			jx += (wx - rx * rv) * k; jy += (wy - ry * rv) * k; jz += (wz - rz * rv) * k;
+		}
+		acc[0] += ax; acc[1] += ay; acc[2] += az;
+		jerk[0] += jx; jerk[1] += jy; jerk[2] += jz;
+	}
+
+	/// <summary>
+	/// Acceleration of each of n massless points due to m bodies, added onto ax, ay, az. Call it on chunks of points small
+	/// enough to stay in cache while every body goes over them. Not timed, and thread safe like Full_Row_With_Jerk.
+	/// </summary>
+	static void Field(const double* bx, const double* by, const double* bz, const double* gm, int m, const double* x, const double* y, const double* z, int n, double* ax, double* ay, double* az, double eps2 = 0)
+	{
+		for (int j = 0; j < m; j++)
+		{
+			Field_Row(bx[j], by[j], bz[j], gm[j], 0, n, x, y, z, eps2, ax, ay, az);
+		}
+	}
+
+	// For callers that time kernel work themselves (e.g. across threads). Not thread safe: call from one thread.
+	static void Record(long long interactions, double seconds)
+	{
+		Statistics().interactions += interactions;
+		Statistics().seconds += seconds;
+	}
+
+	// Pair interactions per second of kernel time since the last reset
+	static double Interactions_Per_Second()
+	{
+		Stats& s = Statistics();
+		return s.seconds > 0 ? s.interactions / s.seconds : 0;
+	}
+
+	static void Reset_Stats()
+	{
+		Statistics() = Stats();
+	}
+};
+
+#endif /*GRAVITYKERNEL_H*/
@@ -0,0 +1,359 @@
+#pragma once
+#ifndef KEPLER_H
+#define KEPLER_H
+
+#include <cmath>
+#include "vec3.h"
+#include "GravityKernel.h"
+
+/*
+	Exact two-body motion around a fixed central body: where something on a Keplerian orbit will be after a given time.
+
+	Drift works in universal variables (Danby, Fundamentals of Celestial Mechanics, ch. 6), so the same code handles circles,
+	ellipses, parabolas and hyperbolas without ever converting to orbital elements, and stays well behaved right up to the
+	boundary between them. The state is carried forwards with the f and g functions: r = f r0 + g v0, v = f' r0 + g' v0.
+
+	Ellipse and Solve_Batch are the classical version for bound orbits: convert to an ellipse once, then anywhere along it is a
+	single solve of Kepler's equation (see KeplerOrbits in PhysicsState.h).
+
+	Solve_Batch has a kernel per instruction set, picked at runtime with the same level as GravityKernel (so K switches both).
+	The wide kernels take 4 (AVX2) or 8 (AVX-512) orbits at a time through Newton in lockstep, with sin and cos from their own
+	polynomials: reduced by the nearest multiple of pi/2 (in three parts, so the reduction is exact to double precision over
+	the range a mean anomaly in [-pi, pi] produces) and then Cephes' minimax polynomials on [-pi/4, pi/4], good to 1-2 ulp.
+	The scalar kernel uses the C library's sin and cos and is the reference.
+*/
+class Kepler
+{
+private:
+	static const int MAX_ITERATIONS = 64;
+	static constexpr double CONVERGED = 1E-14; // Newton step on E (rad) below which an orbit is solved
+
+#ifdef ORBYTE_X86
+	// pi/2 in three parts (fdlibm), each exact when multiplied by a small whole number
+	static constexpr double PIO2_1 = 1.57079632673412561417E+00, PIO2_2 = 6.07710050650619224932E-11, PIO2_3 = 2.02226624879595063154E-21;
+	static constexpr double TWO_OVER_PI = 6.36619772367581382433E-01;
+	// Cephes sin.c: sin r = r + r z S(z), cos r = 1 - z / 2 + z^2 C(z), z = r^2, for |r| <= pi/4
+	static constexpr double S0 = 1.58962301576546568060E-10, S1 = -2.50507477628578072866E-8, S2 = 2.75573136213857245213E-6,
+		S3 = -1.98412698295895385996E-4, S4 = 8.33333333332211858878E-3, S5 = -1.66666666666666307295E-1;
+	static constexpr double C0 = -1.13585365213876817300E-11, C1 = 2.08757008419747316778E-9, C2 = -2.75573141792967388112E-7,
+		C3 = 2.48015872888517045348E-5, C4 = -1.38888888888730564116E-3, C5 = 4.16666666666665929218E-2;
+
+	ORBYTE_TARGET("avx2,fma")
+	static void Sin_Cos_AVX2(__m256d x, __m256d& sin_x, __m256d& cos_x)
+	{
+		__m256d k = _mm256_round_pd(_mm256_mul_pd(x, _mm256_set1_pd(TWO_OVER_PI)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+		__m256d r = _mm256_fnmadd_pd(k, _mm256_set1_pd(PIO2_1), x);
+		r = _mm256_fnmadd_pd(k, _mm256_set1_pd(PIO2_2), r);
+		r = _mm256_fnmadd_pd(k, _mm256_set1_pd(PIO2_3), r);
+		__m256d z = _mm256_mul_pd(r, r);
+
+		__m256d p = _mm256_fmadd_pd(_mm256_set1_pd(S0), z, _mm256_set1_pd(S1));
+		p = _mm256_fmadd_pd(p, z, _mm256_set1_pd(S2));
+		p = _mm256_fmadd_pd(p, z, _mm256_set1_pd(S3));
+		p = _mm256_fmadd_pd(p, z, _mm256_set1_pd(S4));
+		p = _mm256_fmadd_pd(p, z, _mm256_set1_pd(S5));
+		__m256d s = _mm256_fmadd_pd(_mm256_mul_pd(r, z), p, r);
+
+		__m256d q = _mm256_fmadd_pd(_mm256_set1_pd(C0), z, _mm256_set1_pd(C1));
+		q = _mm256_fmadd_pd(q, z, _mm256_set1_pd(C2));
+		q = _mm256_fmadd_pd(q, z, _mm256_set1_pd(C3));
+		q = _mm256_fmadd_pd(q, z, _mm256_set1_pd(C4));
+		q = _mm256_fmadd_pd(q, z, _mm256_set1_pd(C5));
+		__m256d c = _mm256_fmadd_pd(_mm256_mul_pd(z, z), q, _mm256_fnmadd_pd(_mm256_set1_pd(0.5), z, _mm256_set1_pd(1)));
+
+		// Quadrant k mod 4: 0 => (s, c), 1 => (c, -s), 2 => (-s, -c), 3 => (-c, s)
+		__m256d quadrant = _mm256_sub_pd(k, _mm256_mul_pd(_mm256_set1_pd(4), _mm256_floor_pd(_mm256_mul_pd(k, _mm256_set1_pd(0.25)))));
+		__m256d odd = _mm256_cmp_pd(_mm256_sub_pd(quadrant, _mm256_mul_pd(_mm256_set1_pd(2), _mm256_floor_pd(_mm256_mul_pd(quadrant, _mm256_set1_pd(0.5))))), _mm256_set1_pd(0.5), _CMP_GT_OQ);
+		__m256d sin_negative = _mm256_cmp_pd(quadrant, _mm256_set1_pd(1.5), _CMP_GT_OQ);
+		__m256d cos_negative = _mm256_and_pd(_mm256_cmp_pd(quadrant, _mm256_set1_pd(0.5), _CMP_GT_OQ), _mm256_cmp_pd(quadrant, _mm256_set1_pd(2.5), _CMP_LT_OQ));
+		__m256d sign = _mm256_set1_pd(-0.0);
+		sin_x = _mm256_xor_pd(_mm256_blendv_pd(s, c, odd), _mm256_and_pd(sin_negative, sign));
+		cos_x = _mm256_xor_pd(_mm256_blendv_pd(c, s, odd), _mm256_and_pd(cos_negative, sign));
+	}
+
+	ORBYTE_TARGET("avx2,fma")
+	static int Solve_AVX2(const double* M, const double* e, double* E, double* sin_E, double* cos_E, int n)
+	{
+		int i = 0;
+		for (; i + 4 <= n; i += 4)
+		{
+			__m256d vM = _mm256_loadu_pd(M + i), ve = _mm256_loadu_pd(e + i);
+			__m256d sign = _mm256_and_pd(vM, _mm256_set1_pd(-0.0));
+			__m256d vE = _mm256_add_pd(vM, _mm256_xor_pd(_mm256_mul_pd(_mm256_set1_pd(0.85), ve), sign)); // Danby's guess
+			__m256d s, c;
+			for (int k = 0; k < MAX_ITERATIONS; k++)
+			{
+				Sin_Cos_AVX2(vE, s, c);
+				__m256d f = _mm256_sub_pd(_mm256_fnmadd_pd(ve, s, vE), vM);
+				__m256d step = _mm256_div_pd(f, _mm256_fnmadd_pd(ve, c, _mm256_set1_pd(1)));
+				vE = _mm256_sub_pd(vE, step);
+				__m256d unsolved = _mm256_cmp_pd(_mm256_andnot_pd(_mm256_set1_pd(-0.0), step), _mm256_set1_pd(CONVERGED), _CMP_GT_OQ);
+				if (_mm256_movemask_pd(unsolved) == 0)
+				{
+					break;
+				}
+			}
+			Sin_Cos_AVX2(vE, s, c);
+			_mm256_storeu_pd(E + i, vE);
+			_mm256_storeu_pd(sin_E + i, s);
+			_mm256_storeu_pd(cos_E + i, c);
+		}
+		return i;
+	}
+
+	ORBYTE_TARGET("avx512f")
+	static void Sin_Cos_AVX512(__m512d x, __m512d& sin_x, __m512d& cos_x)
+	{
+		__m512d k = _mm512_maskz_roundscale_pd(0xFF, _mm512_mul_pd(x, _mm512_set1_pd(TWO_OVER_PI)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+		__m512d r = _mm512_fnmadd_pd(k, _mm512_set1_pd(PIO2_1), x);
+		r = _mm512_fnmadd_pd(k, _mm512_set1_pd(PIO2_2), r);
+		r = _mm512_fnmadd_pd(k, _mm512_set1_pd(PIO2_3), r);
+		__m512d z = _mm512_mul_pd(r, r);
+
+		__m512d p = _mm512_fmadd_pd(_mm512_set1_pd(S0), z, _mm512_set1_pd(S1));
+		p = _mm512_fmadd_pd(p, z, _mm512_set1_pd(S2));
+		p = _mm512_fmadd_pd(p, z, _mm512_set1_pd(S3));
+		p = _mm512_fmadd_pd(p, z, _mm512_set1_pd(S4));
+		p = _mm512_fmadd_pd(p, z, _mm512_set1_pd(S5));
+		__m512d s = _mm512_fmadd_pd(_mm512_mul_pd(r, z), p, r);
+
+		__m512d q = _mm512_fmadd_pd(_mm512_set1_pd(C0), z, _mm512_set1_pd(C1));
+		q = _mm512_fmadd_pd(q, z, _mm512_set1_pd(C2));
+		q = _mm512_fmadd_pd(q, z, _mm512_set1_pd(C3));
+		q = _mm512_fmadd_pd(q, z, _mm512_set1_pd(C4));
+		q = _mm512_fmadd_pd(q, z, _mm512_set1_pd(C5));
+		__m512d c = _mm512_fmadd_pd(_mm512_mul_pd(z, z), q, _mm512_fnmadd_pd(_mm512_set1_pd(0.5), z, _mm512_set1_pd(1)));
+
+		// Quadrant k mod 4, as in Sin_Cos_AVX2
+		__m512d quadrant = _mm512_sub_pd(k, _mm512_mul_pd(_mm512_set1_pd(4), _mm512_maskz_roundscale_pd(0xFF, _mm512_mul_pd(k, _mm512_set1_pd(0.25)), _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC)));
+		__mmask8 odd = _mm512_cmp_pd_mask(_mm512_sub_pd(quadrant, _mm512_mul_pd(_mm512_set1_pd(2), _mm512_maskz_roundscale_pd(0xFF, _mm512_mul_pd(quadrant, _mm512_set1_pd(0.5)), _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC))), _mm512_set1_pd(0.5), _CMP_GT_OQ);
+		__mmask8 sin_negative = _mm512_cmp_pd_mask(quadrant, _mm512_set1_pd(1.5), _CMP_GT_OQ);
+		__mmask8 cos_negative = _mm512_cmp_pd_mask(quadrant, _mm512_set1_pd(0.5), _CMP_GT_OQ) & _mm512_cmp_pd_mask(quadrant, _mm512_set1_pd(2.5), _CMP_LT_OQ);
+		__m512d zero = _mm512_setzero_pd();
+		sin_x = _mm512_mask_blend_pd(odd, s, c);
+		cos_x = _mm512_mask_blend_pd(odd, c, s);
+		sin_x = _mm512_mask_sub_pd(sin_x, sin_negative, zero, sin_x);
+		cos_x = _mm512_mask_sub_pd(cos_x, cos_negative, zero, cos_x);
+	}
+
+	ORBYTE_TARGET("avx512f")
+	static int Solve_AVX512(const double* M, const double* e, double* E, double* sin_E, double* cos_E, int n)
+	{
+		int i = 0;
+		for (; i + 8 <= n; i += 8)
+		{
+			__m512d vM = _mm512_loadu_pd(M + i), ve = _mm512_loadu_pd(e + i);
+			__mmask8 negative = _mm512_cmp_pd_mask(vM, _mm512_setzero_pd(), _CMP_LT_OQ);
+			__m512d guess = _mm512_mul_pd(_mm512_set1_pd(0.85), ve);
+			__m512d vE = _mm512_mask_sub_pd(_mm512_add_pd(vM, guess), negative, vM, guess); // Danby's guess
+			__m512d s, c;
+			for (int k = 0; k < MAX_ITERATIONS; k++)
+			{
+				Sin_Cos_AVX512(vE, s, c);
+				__m512d f = _mm512_sub_pd(_mm512_fnmadd_pd(ve, s, vE), vM);
+				__m512d step = _mm512_div_pd(f, _mm512_fnmadd_pd(ve, c, _mm512_set1_pd(1)));
+				vE = _mm512_sub_pd(vE, step);
+				if (_mm512_cmp_pd_mask(_mm512_abs_pd(step), _mm512_set1_pd(CONVERGED), _CMP_GT_OQ) == 0)
+				{
+					break;
+				}
+			}
+			Sin_Cos_AVX512(vE, s, c);
+			_mm512_storeu_pd(E + i, vE);
+			_mm512_storeu_pd(sin_E + i, s);
+			_mm512_storeu_pd(cos_E + i, c);
+		}
+		return i;
+	}
+#endif
+
+	// The reference, on whatever of the batch the wide kernels didn't take
+	static void Solve_Scalar(const double* M, const double* e, double* E, double* sin_E, double* cos_E, int n)
+	{
+		for (int i = 0; i < n; i++)
+		{
+			E[i] = M[i] + 0.85 * e[i] * (M[i] >= 0 ? 1 : -1); // Danby's guess: sin M has the sign of M in [-pi, pi]
+		}
+
+		for (int k = 0; k < MAX_ITERATIONS; k++)
+		{
+			double worst = 0;
+			for (int i = 0; i < n; i++)
+			{
+				double s = sin(E[i]), c = cos(E[i]);
+				double f = E[i] - e[i] * s - M[i];
+				double step = f / (1 - e[i] * c);
+				E[i] -= step;
+				worst = fmax(worst, fabs(step));
+			}
+			if (worst <= CONVERGED)
+			{
+				break;
+			}
+		}
+
+		for (int i = 0; i < n; i++)
+		{
+			sin_E[i] = sin(E[i]);
+			cos_E[i] = cos(E[i]);
+		}
+	}
+
+	// Stumpff functions c2(z) = (1 - cos sqrt z) / z and c3(z) = (sqrt z - sin sqrt z) / sqrt(z)^3, continued to z <= 0
+	static void Stumpff(double z, double& c2, double& c3)
+	{
+		if (fabs(z) < 1E-3)
+		{
+			// Series: the closed forms lose everything to cancellation near 0
+			c2 = 1.0 / 2 - z * (1.0 / 24 - z * (1.0 / 720 - z / 40320));
+			c3 = 1.0 / 6 - z * (1.0 / 120 - z * (1.0 / 5040 - z / 362880));
+		}
+		else if (z > 0)
+		{
+			double s = sqrt(z);
+			c2 = (1 - cos(s)) / z;
+			c3 = (s - sin(s)) / (s * z);
+		}
+		else
+		{
+			double s = sqrt(-z);
+			c2 = (cosh(s) - 1) / -z;
+			c3 = (sinh(s) - s) / (s * -z);
+		}
+	}
+
+public:
+	/// <summary>
+	/// Move a body along its Keplerian orbit around a central body at the origin for dt seconds (negative goes backwards).
+	/// </summary>
+	/// <param name="mu">G * mass of the central body. 0 or less => no central body, so a straight line.</param>
+	/// <returns>false if the solver didn't converge (the state is then left as it was)</returns>
+	static bool Drift(double mu, double& x, double& y, double& z, double& vx, double& vy, double& vz, double dt)
+	{
+		if (mu <= 0)
+		{
+			x += vx * dt; y += vy * dt; z += vz * dt;
+			return true;
+		}
+
+		double r0 = sqrt(x * x + y * y + z * z);
+		if (r0 == 0 || dt == 0)
+		{
+			return dt == 0;
+		}
+		double v2 = vx * vx + vy * vy + vz * vz;
+		double rv = x * vx + y * vy + z * vz; // r0 . v0
+		double alpha = 2 / r0 - v2 / mu; // 1 / semi-major axis, < 0 for hyperbolas
+		double sqrt_mu = sqrt(mu);
+
+		// Whole orbits change nothing, so only do what's left over. Keeps the solver near its first guess for long steps.
+		if (alpha > 0)
+		{
+			double period = 2 * 3.14159265358979323846 / (sqrt_mu * alpha * sqrt(alpha));
+			dt = fmod(dt, period);
+		}
+
+		// Newton's method on the universal Kepler equation for chi
+		double chi = sqrt_mu * dt * (alpha > 0 ? alpha : 1 / r0);
+		double c2 = 0.5, c3 = 1.0 / 6, r = r0;
+		bool converged = false;
+		for (int i = 0; i < MAX_ITERATIONS; i++)
+		{
+			double chi2 = chi * chi;
+			Stumpff(alpha * chi2, c2, c3);
+			double t = (rv / sqrt_mu) * chi2 * c2 + (1 - alpha * r0) * chi2 * chi * c3 + r0 * chi; // sqrt(mu) * time to reach chi
+			r = (rv / sqrt_mu) * chi * (1 - alpha * chi2 * c3) + (1 - alpha * r0) * chi2 * c2 + r0; // dt/dchi * sqrt(mu), also |r|
+			double step = (t - sqrt_mu * dt) / r;
+			chi -= step;
+			if (fabs(step) <= 1E-13 * fmax(1.0, fabs(chi)))
+			{
+				converged = true;
+				break;
+			}
+		}
+		if (!converged)
+		{
+			return false;
+		}
+
+		double chi2 = chi * chi;
+		Stumpff(alpha * chi2, c2, c3);
+		double f = 1 - (chi2 / r0) * c2;
+		double g = dt - (chi2 * chi / sqrt_mu) * c3;
+		double nx = f * x + g * vx, ny = f * y + g * vy, nz = f * z + g * vz;
+		r = sqrt(nx * nx + ny * ny + nz * nz);
+		double fdot = (sqrt_mu / (r * r0)) * (alpha * chi2 * chi * c3 - chi);
+		double gdot = 1 - (chi2 / r) * c2;
+		double nvx = fdot * x + gdot * vx, nvy = fdot * y + gdot * vy, nvz = fdot * z + gdot * vz;
+
+		x = nx; y = ny; z = nz;
+		vx = nvx; vy = nvy; vz = nvz;
+		return true;
+	}
+
+	/// <summary>
+	/// Describe a bound orbit around a central body at the origin as an ellipse: r = (cos E - e) P + sin E Q, where P points
+	/// to periapsis with length a (semi-major axis) and Q is 90 degrees ahead of it with length b (semi-minor axis).
+	/// </summary>
+	/// <param name="mean_motion">2 pi / period (rad/s)</param>
+	/// <param name="mean_anomaly">Where the body is along the ellipse now, in [-pi, pi)</param>
+	/// <returns>false if the orbit isn't bound (a parabola or hyperbola), in which case nothing is written</returns>
+	static bool Ellipse(double mu, vector3 r, vector3 v, double& mean_motion, double& e, double& mean_anomaly, vector3& P, vector3& Q)
+	{
+		double rm = Magnitude(r);
+		if (mu <= 0 || rm == 0)
+		{
+			return false;
+		}
+		double alpha = 2 / rm - (v * v) / mu; // 1 / a
+		vector3 h = { r.y * v.z - r.z * v.y, r.z * v.x - r.x * v.z, r.x * v.y - r.y * v.x }; // Angular momentum per unit mass
+		double hm = Magnitude(h);
+		if (alpha <= 0 || hm == 0)
+		{
+			return false; // Unbound, or falling straight in
+		}
+
+		// Eccentricity vector (v x h) / mu - r / |r| points at periapsis
+		vector3 ev = vector3{ v.y * h.z - v.z * h.y, v.z * h.x - v.x * h.z, v.x * h.y - v.y * h.x } * (1 / mu) - r * (1 / rm);
+		e = Magnitude(ev);
+		if (e >= 1)
+		{
+			return false;
+		}
+		vector3 p_hat = e > 1E-12 ? ev * (1 / e) : r * (1 / rm); // A circle has no periapsis, so measure from where it is now
+		vector3 h_hat = h * (1 / hm);
+		vector3 q_hat = { h_hat.y * p_hat.z - h_hat.z * p_hat.y, h_hat.z * p_hat.x - h_hat.x * p_hat.z, h_hat.x * p_hat.y - h_hat.y * p_hat.x };
+
+		double a = 1 / alpha;
+		double b = a * sqrt(1 - e * e);
+		double E = atan2((r * q_hat) / b, (r * p_hat) / a + e);
+		mean_anomaly = E - e * sin(E);
+		mean_motion = sqrt(mu * alpha) * alpha;
+		P = p_hat * a;
+		Q = q_hat * b;
+		return true;
+	}
+
+	/// <summary>
+	/// Solve Kepler's equation M = E - e sin E for a whole batch of orbits at once, E[i] from M[i] in [-pi, pi] and e[i] < 1.
+	/// The wide kernels take the orbits a vector at a time, each vector until its worst orbit has converged; the rest go
+	/// through the scalar kernel. See the top of the file.
+	/// </summary>
+	/// <param name="sin_E">sin(E[i]), which the caller needs anyway to turn E into a position</param>
+	/// <param name="cos_E">cos(E[i])</param>
+	static void Solve_Batch(const double* M, const double* e, double* E, double* sin_E, double* cos_E, int n)
+	{
+		int done = 0;
+		switch (GravityKernel::Get_Level())
+		{
+#ifdef ORBYTE_X86
+		case GravityKernel::AVX512: done = Solve_AVX512(M, e, E, sin_E, cos_E, n); break;
+		case GravityKernel::AVX2: done = Solve_AVX2(M, e, E, sin_E, cos_E, n); break;
+#endif
+		default: break; // SSE2 has no FMA or round: 2 lanes of it aren't worth a polynomial over the library's sin and cos
+		}
+		Solve_Scalar(M + done, e + done, E + done, sin_E + done, cos_E + done, n - done);
+	}
+};
+
+#endif /*KEPLER_H*/
@@ -0,0 +1,245 @@
+#pragma once
+#ifndef OCTREE_H
+#define OCTREE_H
+
+#include <vector>
+#include <string>
+#include <cmath>
+#include "vec3.h"
+
+/*
+	Barnes-Hut octree. Space is split into cubes, each cube into eight smaller cubes, until every body has a cube to itself.
+	Every cube remembers the total mass and centre of mass of everything inside it, so a cluster of bodies far away from the
+	point we are evaluating can be treated as one big body. This takes the force calculation from O(N^2) to O(N log N).
+
+	The opening angle theta decides how far away "far away" is: a cube of width s at distance d is approximated when s / d < theta.
+	theta = 0 opens every cube and gives exactly the same answer as the direct sum.
+*/
+class Octree
+{
+private:
+	struct Node
+	{
+		vector3 centre; // Geometric centre of the cube
+		double half_size; // Half the width of the cube
+		vector3 com; // Centre of mass of everything in the cube
+		double gm; // G * total mass in the cube
+		int first_child; // Index of the first of 8 contiguous children, -1 if this is a leaf
+		int body; // Index of the (first) body in a leaf, -1 if empty
+	};
+
+	static const int MAX_DEPTH = 48; // Coincident bodies would subdivide forever, so past this depth they share a leaf.
+
+	std::vector<Node> nodes; // Flat pool. Cleared, not freed, between builds so rebuilding each stage doesn't hit the allocator.
+	std::vector<double> px, py, pz; // Copy of the body positions the tree was built with
+	std::vector<double> gms; // G * mass of each body
+	std::vector<int> next_in_leaf; // Linked list of bodies sharing a max depth leaf
+
+	int New_Node(vector3 centre, double half_size)
+	{
+		Node n;
+		n.centre = centre;
+		n.half_size = half_size;
+		n.com = { 0, 0, 0 };
+		n.gm = 0;
+		n.first_child = -1;
+		n.body = -1;
+		nodes.push_back(n);
+		return (int)nodes.size() - 1;
+	}
+
+	int Octant(const Node& n, vector3 p) const
+	{
+		return (p.x >= n.centre.x ? 1 : 0) | (p.y >= n.centre.y ? 2 : 0) | (p.z >= n.centre.z ? 4 : 0);
+	}
+
+	void Subdivide(int node)
+	{
+		double h = nodes[node].half_size * 0.5;
+		vector3 c = nodes[node].centre;
+		int first = (int)nodes.size();
+		for (int i = 0; i < 8; i++)
+		{
+			New_Node({ c.x + ((i & 1) ? h : -h), c.y + ((i & 2) ? h : -h), c.z + ((i & 4) ? h : -h) }, h); // May reallocate, so no references held across this
+		}
+		nodes[node].first_child = first;
+	}
+
+	void Insert(int body)
+	{
+		int node = 0;
+		int depth = 0;
+		while (true)
+		{
+			if (nodes[node].first_child == -1)
+			{
+				int resident = nodes[node].body;
+				if (resident == -1)
+				{
+					nodes[node].body = body; // Empty leaf, move in.
+					return;
+				}
+				if (depth >= MAX_DEPTH)
+				{
+					next_in_leaf[body] = resident; // Share the leaf
+					nodes[node].body = body;
+					return;
+				}
+				// Occupied leaf => split it and push the resident down a level
+				Subdivide(node);
+				nodes[node].body = -1;
+				int child = nodes[node].first_child + Octant(nodes[node], Position(resident));
+				nodes[child].body = resident;
+			}
+			node = nodes[node].first_child + Octant(nodes[node], Position(body));
+			depth++;
+		}
+	}
+
+	void Accumulate_Mass()
+	{
+		// Children are always created after their parents, so walking backwards visits every child before its parent.
+		for (int i = (int)nodes.size() - 1; i >= 0; i--)
+		{
+			Node& n = nodes[i];
+			double gm = 0;
+			vector3 weighted = { 0, 0, 0 };
+			if (n.first_child == -1)
+			{
+				for (int b = n.body; b != -1; b = next_in_leaf[b])
+				{
+					gm += gms[b];
+					weighted = weighted + (Position(b) * gms[b]);
+				}
+			}
+			else
+			{
+				for (int c = n.first_child; c < n.first_child + 8; c++)
+				{
+					gm += nodes[c].gm;
+					weighted = weighted + (nodes[c].com * nodes[c].gm);
+				}
+			}
+			n.gm = gm;
+			n.com = gm != 0 ? weighted * (1 / gm) : n.centre;
+		}
+	}
+
+	vector3 Position(int body) const
+	{
+		return { px[body], py[body], pz[body] };
+	}
+
+	bool Contains(const Node& n, vector3 p) const
+	{
+		return fabs(p.x - n.centre.x) <= n.half_size && fabs(p.y - n.centre.y) <= n.half_size && fabs(p.z - n.centre.z) <= n.half_size;
+	}
+
+public:
+	double theta = 0.5; // Opening angle
+
+	/// <summary>
+	/// Rebuild the tree from scratch. Index i in the arrays is how a body identifies itself when querying.
+	/// </summary>
+	void Build(const double* x, const double* y, const double* z, const double* gm, int n)
+	{
+		nodes.clear();
+		px.assign(x, x + n);
+		py.assign(y, y + n);
+		pz.assign(z, z + n);
+		gms.assign(gm, gm + n);
+		next_in_leaf.assign(n, -1);
+
+		if (n == 0)
+		{
+			return;
+		}
+
+		// Bounding cube of every body
+		vector3 lo = Position(0);
+		vector3 hi = Position(0);
+		for (int i = 1; i < n; i++)
+		{
+			lo = { fmin(lo.x, px[i]), fmin(lo.y, py[i]), fmin(lo.z, pz[i]) };
+			hi = { fmax(hi.x, px[i]), fmax(hi.y, py[i]), fmax(hi.z, pz[i]) };
+		}
+		vector3 centre = (lo + hi) * 0.5;
+		double half_size = fmax(fmax(hi.x - lo.x, hi.y - lo.y), hi.z - lo.z) * 0.5;
+		half_size = half_size > 0 ? half_size * 1.0001 : 1; // Slight padding so bodies on the boundary are inside
+
+		New_Node(centre, half_size);
+		for (int i = 0; i < n; i++)
+		{
+			Insert(i);
+		}
+		Accumulate_Mass();
+	}
+
+	/// <summary>
+	/// Gravitational acceleration at pos due to every body in the tree except self (pass -1 to exclude nobody).
+	/// </summary>
+	/// <param name="eps2">Plummer softening length squared (see GravityKernel). Softens whole cubes as well as single bodies.</param>
+	vector3 Acceleration(vector3 pos, int self = -1, double eps2 = 0) const
+	{
+		vector3 a = { 0, 0, 0 };
+		if (nodes.empty())
+		{
+			return a;
+		}
+
+		int stack[8 * MAX_DEPTH + 8]; // Depth first: at most 7 siblings are left waiting per level
+		int top = 0;
+		stack[top++] = 0;
+		while (top > 0)
+		{
+			const Node& n = nodes[stack[--top]];
+			if (n.gm == 0)
+			{
+				continue;
+			}
+
+			if (n.first_child == -1)
+			{
+				// Leaf => exact contribution of each resident
+				for (int b = n.body; b != -1; b = next_in_leaf[b])
+				{
+					if (b == self)
+					{
+						continue;
+					}
+					vector3 r = pos - Position(b);
+					double r2 = r * r + eps2;
+					if (r2 > 0)
+					{
+						a = a + (r * (-gms[b] / (r2 * sqrt(r2))));
+					}
+				}
+				continue;
+			}
+
+			vector3 r = pos - n.com;
+			double mag = Magnitude(r);
+			bool holds_self = self >= 0 && Contains(n, Position(self)); // A cube containing us must be opened, or we'd attract ourselves
+			if (!holds_self && mag > 0 && (2 * n.half_size) < theta * mag)
+			{
+				double r2 = mag * mag + eps2;
+				a = a + (r * (-n.gm / (r2 * sqrt(r2)))); // Far enough away => treat the whole cube as one body
+			}
+			else
+			{
+				for (int c = n.first_child; c < n.first_child + 8; c++)
+				{
+					stack[top++] = c;
+				}
+			}
+		}
+		return a;
+	}
+
+	int Get_Node_Count()
+	{
+		return (int)nodes.size();
+	}
+};
+
+#endif /*OCTREE_H*/
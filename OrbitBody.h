@@ -14,6 +14,9 @@
 #include "Orbyte_Data.h"
 #include "Orbyte_Graphics.h"
 #include "Camera.h"
+#include "Octree.h"
+#include "PhysicsState.h"
+#include "GravityKernel.h"
 
 class CentralBody
 {
@@ -151,7 +154,7 @@ private:
 
 	void Create_Satellite();
 
-	int Update_Satellites(float delta, float time_scale, std::vector<Body*>* bodies_in_system);
+	int Update_Satellites(float delta, float time_scale, const Octree* tree);
 
 	int Draw_Satellites(Graphyte& g, Camera& c);
 
@@ -160,7 +163,11 @@ private:
 	int Clean_Up_Satellites();
 
 protected:
+	PhysicsStore& store; // Where this body's physics state actually lives
+	int handle = -1; // This body's handle in the store, -1 once removed
+
 	Mesh mesh;
+	vector3 mesh_centre{ 0, 0, 0 }; // Where the vertices are centred. The drawn position, which can trail the store by part of a step.
 	vector3 last_trail_point;
 	std::vector<vector3> trail_points;
 
@@ -169,12 +176,11 @@ protected:
 	double time_since_start = 0;
 
 	//Orbit information
+	//position, velocity and mass are the GUI's copy (text fields write straight into them). The store is the real thing.
 	vector3 position{ 0, 0, 0 };
 	double radius;
 	vector3 velocity{ 0,0,0 };
 	double angular_velocity = 0;
-	vector3 acceleration{ 0, 0, 0 };
-	double mu = 0; 
 	double mass = 0;
 	double scale;
 	const double Gravitational_Constant = 6.6743E-11;
@@ -188,6 +194,7 @@ protected:
 	Text* inspector_angular_velocity = NULL;
 	Text* inspector_acceleration = NULL;
 	Text* inspector_period = NULL;
+	Text* inspector_propagation = NULL;
 
 	//Inspector Function Buttons
 	FunctionButton* inspector_reset = NULL;
@@ -217,79 +224,61 @@ protected:
 			if (inspector_radius != NULL) { inspector_radius->Set_Text("| Radius: " + std::to_string(Magnitude(position) / 1000) + "km"); }
 			if (inspector_velocity != NULL) { inspector_velocity->Set_Text("| Velocity: " + velocity.Debug()); }
 			if (inspector_angular_velocity != NULL) { inspector_angular_velocity->Set_Text("| Angular Velocity: " + std::to_string(angular_velocity * 60 * 60 * 24) + "rad/day"); }
-			if (inspector_acceleration != NULL) { inspector_acceleration->Set_Text("| Acceleration: " + acceleration.Debug()); }
+			if (inspector_acceleration != NULL) { inspector_acceleration->Set_Text("| Acceleration: " + Get_Acceleration().Debug()); }
 			if (inspector_period != NULL) { inspector_period->Set_Text("| Orbit Period: " + std::to_string(Calculate_Period() / (60 * 60 * 24)) + " days"); }
+			if (inspector_propagation != NULL) { inspector_propagation->Set_Text(handle != -1 && store.Is_Analytic(handle) ? "| Motion (A): Fixed Kepler orbit" : "| Motion (A): Integrated"); }
 		}
 	}
 
-	std::vector<vector3> two_body_ode(float t, vector3 _r, vector3 _v, std::vector<Body*>* masses)
+	StateDerivative two_body_ode(float t, vector3 _r, vector3 _v, const Octree* tree = NULL)
 	{
 		vector3 a;
 		vector3 pos = _r; //displacement
 		vector3 v = _v; //velocity
+		double mu = Get_Mu();
 
 
 		//SUN
 		vector3 r = pos; //displacement
-
-		vector3 nr = Normalize(r);
-		//std::cout << "NR.z" << nr.z << "\n";
-		if (nr.z == 0) { nr.z = 1; r.z = 0; }
-		if (nr.y == 0) { nr.y = 1; r.y = 0; }
-		if (nr.x == 0) { nr.x = 1; r.x = 0; }
 		double mag = Magnitude(r);
-		a = vector3({
-			(-mu * r.x) / (pow(mag, 3)),
-			(-mu * r.y) / (pow(mag, 3)),
-			(-mu * r.z) / (pow(mag, 3))
-			});
+		a = mag > 0 ? r * (-mu / (mag * mag * mag)) : vector3{ 0, 0, 0 };
 
 		//Others
+		int self = store.Slot(handle); // The store (and any tree built from it) includes us, so skip our own slot
 
-		for (Body* b : *masses)
+		if (tree != NULL)
 		{
-			if (b != this)
-			{
-				vector3 r = pos - b->Get_Position(); //displacement
-
-				double _mu = Gravitational_Constant * b->Get_Mass();
-
-				//std::cout << "R.z" << r.z << "\n";
-				vector3 nr = Normalize(r);
-				//std::cout << "NR.z" << nr.z << "\n";
-				if (nr.z == 0) { nr.z = 1; r.z = 0; }
-				if (nr.y == 0) { nr.y = 1; r.y = 0; }
-				if (nr.x == 0) { nr.x = 1; r.x = 0; }
-				double mag = Magnitude(r);
-				a = a + vector3({
-					(-_mu * r.x) / (pow(mag, 3)),
-					(-_mu * r.y) / (pow(mag, 3)),
-					(-_mu * r.z) / (pow(mag, 3))
-					});
-			}
+			// Barnes-Hut approximation
+			a = a + tree->Acceleration(pos, self, store.softening * store.softening);
+			return { v, a };
 		}
-		//std::cout << "rk_result: " << (pow(nr.z, 3)) << "\n";
+
+		// Direct sum (exact reference with the scalar kernel)
+		a = a + GravityKernel::At_Point(pos, store.x.data(), store.y.data(), store.z.data(), store.gm.data(), store.Size(), self, store.softening * store.softening);
 		return { v, a };
 	}
 
-	std::vector<vector3> rk4_step(float _time, vector3 _position, vector3 _velocity, std::vector<Body*>* masses, float _dt = 1)
+	StepResult rk4_step(float _time, vector3 _position, vector3 _velocity, float _dt = 1, const Octree* tree = NULL)
 	{
 		//std::cout << "\n DEBUGGING RK4 STEP FOR: " + name + "\n" + "position: " + _position.Debug() + "\nvelocity: " + _velocity.Debug();
-		//structure of the vectors: [pos, velocity]
-		std::vector<vector3> rk1 = two_body_ode(_time, _position, _velocity, masses);
-		std::vector<vector3> rk2 = two_body_ode(_time + (0.5 * _dt), _position + (rk1[0] * 0.5f * _dt), _velocity + (rk1[1] * 0.5f * _dt), masses);
-		std::vector<vector3> rk3 = two_body_ode(_time + (0.5 * _dt), _position + (rk2[0] * 0.5f * _dt), _velocity + (rk2[1] * 0.5f * _dt), masses);
-		std::vector<vector3> rk4 = two_body_ode(_time + _dt, _position + (rk3[0] * _dt), _velocity + (rk3[1] * _dt), masses);
+		//Each stage is a StateDerivative on the stack: nothing here touches the heap
+		StateDerivative rk1 = two_body_ode(_time, _position, _velocity, tree);
+		StateDerivative rk2 = two_body_ode(_time + (0.5 * _dt), _position + (rk1.velocity * 0.5f * _dt), _velocity + (rk1.acceleration * 0.5f * _dt), tree);
+		StateDerivative rk3 = two_body_ode(_time + (0.5 * _dt), _position + (rk2.velocity * 0.5f * _dt), _velocity + (rk2.acceleration * 0.5f * _dt), tree);
+		StateDerivative rk4 = two_body_ode(_time + _dt, _position + (rk3.velocity * _dt), _velocity + (rk3.acceleration * _dt), tree);
 		
-		vector3 result_pos = _position + (rk1[0] + (rk2[0] * 2.0f) + (rk3[0] * 2.0f) + rk4[0]) * (_dt / 6.0f);
-		vector3 result_vel = _velocity + (rk1[1] + rk2[1] * 2 + rk3[1] * 2 + rk4[1]) * (_dt / 6);
-		//std::cout << "\n Result FOR: " + name + "\n" + "position: " + result_pos.Debug() + "\nvelocity: " + result_vel.Debug();
-		return { result_pos, result_vel, rk1[1]};
+		StepResult result;
+		result.position = _position + (rk1.velocity + (rk2.velocity * 2.0f) + (rk3.velocity * 2.0f) + rk4.velocity) * (_dt / 6.0f);
+		result.velocity = _velocity + (rk1.acceleration + rk2.acceleration * 2 + rk3.acceleration * 2 + rk4.acceleration) * (_dt / 6);
+		result.acceleration = rk1.acceleration;
+		//std::cout << "\n Result FOR: " + name + "\n" + "position: " + result.position.Debug() + "\nvelocity: " + result.velocity.Debug();
+		return result;
 	}
 
 	//We need to override initial velocities in case user wants a perfectly circular orbit.
 	virtual void Project_Circular_Orbit(vector3& _velocity)
 	{
+		double mu = Get_Mu();
 		//We manipulate the velocity so that a perfectly circular orbit is achieved
 		if (position.x != 0)
 		{
@@ -356,12 +345,11 @@ protected:
 
 	void MoveToPos(vector3 new_pos)
 	{
-		vector3 old_pos = position;
+		vector3 delta = new_pos - mesh_centre;
 		position = new_pos;
+		mesh_centre = new_pos;
 		radius = Magnitude(position);
 
-		vector3 delta = position - old_pos;
-
 		for (auto& p : mesh.vertices)
 		{
 			p = p + delta;
@@ -370,6 +358,22 @@ protected:
 		return;
 	}
 
+	void Update_Trail()
+	{
+		// Add a "breadcrumb" or trail point if a certain distance away from last
+		if (Magnitude(position - last_trail_point) > (0.5 * radius) / 24)
+		{
+			trail_points.emplace_back(position);
+			last_trail_point = position;
+		}
+
+		// Remove trail point to only show most recent 
+		if (trail_points.size() > 24)
+		{
+			trail_points.erase(trail_points.begin());
+		}
+	}
+
 	vector3 rotate(vector3 rot, vector3 point, vector3 c) //Something is broken. STILL BROKEN
 	{
 
@@ -446,6 +450,8 @@ protected:
 		gui->Add_Stacked_Element(inspector_acceleration);
 		inspector_period = g.CreateText("period should be here", 12);
 		gui->Add_Stacked_Element(inspector_period);
+		inspector_propagation = g.CreateText("motion should be here", 12);
+		gui->Add_Stacked_Element(inspector_propagation);
 
 		//Input fields
 		gui->Add_Stacked_Element(g.CreateText("EDIT PARAMETERS_____", 12));
@@ -528,9 +534,9 @@ public:
 	bool to_delete = false; //Used in mainloop to schedule objects for deletion next update. => deconstructor (see free())
 	bool snap_camera = false;
 
-	Body(std::string _name, vector3 _center, double _mass, double _scale, vector3 _velocity, double _mu, Graphyte& g, bool override_velocity = false):
-		graphyte(g), 
-		ScaleFV(&scale, [this]() { this->RegenerateVertices(); }), MassFV(&mass), NameFV(&name, [this]() { this->Rename(); }), // Scale Dield Value. When written to, recalculate geometry
+	Body(std::string _name, vector3 _center, double _mass, double _scale, vector3 _velocity, double _mu, Graphyte& g, PhysicsStore& _store, bool override_velocity = false):
+		graphyte(g), store(_store),
+		ScaleFV(&scale, [this]() { this->RegenerateVertices(); }), MassFV(&mass, [this]() { this->SetMass(); }), NameFV(&name, [this]() { this->Rename(); }), // Scale Dield Value. When written to, recalculate geometry
 		PosXFV(&this->position.x, [this]() { this->RecenterBody(); }), PosYFV(&this->position.y, [this]() { this->RecenterBody(); }), PosZFV(&this->position.z, [this]() { this->RecenterBody(); }),
 		VelXFV(&this->velocity.x, [this]() { this->SetStartVelocity(); }), VelYFV(&this->velocity.y, [this]() { this->SetStartVelocity(); }), VelZFV(&this->velocity.z, [this]() { this->SetStartVelocity(); })
 	{
@@ -542,14 +548,17 @@ public:
 		name_label->pos_x = 100; //Test values (overwritten later)
 		name_label->pos_y = 100;
 
-		mu = _mu; //Setting attributes
-		name = _name;
+		handle = store.Add(position, _velocity, Gravitational_Constant * _mass, _mu); // Register physics state
+		store.Set_Radius(handle, _scale);
+
+		name = _name; //Setting attributes
 		if (override_velocity)
 		{
 			Project_Circular_Orbit(_velocity); // Force a circular orbit. Not reccommended as will override given parameters. [NO LONGER SUPPORTED]
 		}
 		velocity = _velocity;
 		start_vel = velocity;
+		store.Set_Velocity(handle, velocity);
 
 		scale = _scale;
 		mass = _mass;
@@ -557,6 +566,7 @@ public:
 		std::cout << "Instantiated Orbiting Body with initial position: " << start_pos.Debug() << " and velocity: " << velocity.Debug() << "\n";
 		
 		mesh.vertices = Generate_Vertices(scale); // Generate body geometry
+		mesh_centre = position;
 
 		CreateInspector(g); // Create GUI for body
 	}
@@ -585,12 +595,18 @@ public:
 		std::cout << "\n Me: (regen) " <<this;
 		this->mesh.vertices.clear();
 		this->mesh.vertices = this->Generate_Vertices(scale);
+		mesh_centre = position;
+		if (handle != -1)
+		{
+			store.Set_Radius(handle, scale);
+		}
 		std::cout << "\n" << Magnitude(mesh.vertices[0] - position);
 	}
 
 	void RecenterBody()
 	{
-		MoveToPos(position);
+		MoveToPos(position); // The text field has already written the new value in, the vertices are still around mesh_centre
+		store.Set_Position(handle, position);
 		start_pos = position;
 		time_since_start = 0;
 	}
@@ -598,9 +614,15 @@ public:
 	void SetStartVelocity()
 	{
 		start_vel = velocity;
+		store.Set_Velocity(handle, velocity);
 		time_since_start = 0;
 	}
 
+	void SetMass()
+	{
+		store.Set_GM(handle, Gravitational_Constant * mass);
+	}
+
 	void Rename()
 	{
 		std::cout << "\nRenamed an orbiting body.";
@@ -625,9 +647,64 @@ public:
 		Close_Satellite_Inspectors();
 	}
 
+	/// <summary>
+	/// The simulation removed this body from the store itself (it was absorbed in a collision), so it goes too.
+	/// </summary>
+	void Absorbed()
+	{
+		std::cout << "\n" << name << " was absorbed in a collision\n";
+		handle = -1; // Already out of the store, and the handle may be handed out again
+		Delete();
+	}
+
+	/// <summary>
+	/// Take on mass and size from the store when the simulation has changed them (a merger). Returns true if anything changed.
+	/// </summary>
+	bool Sync_Physical()
+	{
+		int s = store.Slot(handle);
+		double store_mass = store.gm[s] / Gravitational_Constant;
+		bool changed = false;
+		if (fabs(store_mass - mass) > 1E-9 * fabs(mass))
+		{
+			mass = store_mass;
+			changed = true;
+		}
+		if (store.radius[s] != scale)
+		{
+			scale = store.radius[s];
+			RegenerateVertices();
+			changed = true;
+		}
+		return changed;
+	}
+
+	bool Is_Inspected()
+	{
+		return gui->is_visible;
+	}
+
+	/// <summary>
+	/// Switch between integrating this body and moving it along the Kepler orbit it is on now (ignoring everything but the
+	/// central body from then on). Only bound orbits can be made analytic.
+	/// </summary>
+	void Toggle_Analytic()
+	{
+		if (handle == -1)
+		{
+			return;
+		}
+		bool analytic = !store.Is_Analytic(handle);
+		if (store.Set_Analytic(handle, analytic) != analytic)
+		{
+			std::cout << "\n" << name << " isn't on a closed orbit around the central body, so it can't follow a fixed one\n";
+		}
+		update_inspector();
+	}
+
 	OrbitBodyData GetOrbitBodyData() //To be used when saving to a .orbyte file
 	{
-		return OrbitBodyData(name, position, mass, scale, velocity);
+		return OrbitBodyData(name, handle != -1 ? store.Get_Position(handle) : position, mass, scale, velocity); // position may be drawn part way through a step, the store is exact
 	}
 
 	virtual std::string DebugBody() //For debugging purposes...
@@ -642,6 +719,8 @@ public:
 		position = start_pos;
 		radius = Magnitude(position);
 		velocity = start_vel;
+		store.Set_Position(handle, position);
+		store.Set_Velocity(handle, velocity);
 		RegenerateVertices();
 	}
 
@@ -653,47 +732,59 @@ public:
 		f_button->SetEnabled(false);
 		to_delete = true;
 		Delete_Satellites();
+
+		if (handle != -1)
+		{
+			store.Remove(handle); // Stop taking part in the physics straight away
+			handle = -1;
+		}
 	}
 
-	virtual int Update_Body(float delta, float time_scale, std::vector<Body*>* bodies_in_system)
+	// Legacy body by body step. Not virtual: planets and satellites step alike, and only differ in Sync_From_Store.
+	int Update_Body(float delta, float time_scale, const Octree* tree = NULL)
 	{
 		if (time_scale == 0) // If paused, don't update.
 		{
 			return 0;
 		} 
 
-		Update_Satellites(delta, time_scale, bodies_in_system); // Call Update Method of all child satellites
+		Update_Satellites(delta, time_scale, tree); // Call Update Method of all child satellites
 
+		float t = (delta / 1000); //time in seconds
+		if (store.Is_Analytic(handle)) // Already moved along its fixed orbit (PhysicsStore::Advance_Analytic)
+		{
+			Sync_From_Store(t * time_scale, store.Get_Position(handle));
+			return 0;
+		}
+		StepResult sim_step = rk4_step(time_since_start, store.Get_Position(handle), store.Get_Velocity(handle), t * time_scale, tree); // Get RK4 result into a sim_step buffer.
+		store.Set_Position(handle, sim_step.position);
+		store.Set_Velocity(handle, sim_step.velocity);
+		store.Set_Acceleration(handle, sim_step.acceleration);
+		Sync_From_Store(t * time_scale, store.Get_Position(handle));
+
+		return 0; // Successful update.
+	}
+
+	/// <summary>
+	/// Pull this body's new state out of the store after it has been integrated forwards, whoever did the integrating,
+	/// and update everything that hangs off it (vertices, trail, inspector).
+	/// </summary>
+	/// <param name="dt">Simulated seconds the step covered</param>
+	/// <param name="render_position">Where to draw the body. The store's position, or somewhere between it and the last one.</param>
+	virtual void Sync_From_Store(double dt, vector3 render_position)
+	{
 		rotate_about_centre({0.01, 0.01, 0.01}); // Gradual rotation about body origin to mimic a planet's rotation about its axis
 
-		vector3 this_pos = position;
-		float t = (delta / 1000); //time in seconds
-		std::vector<vector3> sim_step = rk4_step(time_since_start, this_pos, velocity, bodies_in_system, t * time_scale); // Get RK4 result into a sim_step buffer.
-		this_pos = sim_step[0];
 		//if (position.z > 0) { std::cout << position.Debug() << "\n"; std::cout << velocity.Debug() << "\n"; }
-		MoveToPos(this_pos); // Shift vertices to new position
+		MoveToPos(render_position); // Shift vertices to new position
 		angular_velocity = Magnitude(velocity) / Magnitude(position); // angular velocity = tangential velocity / radius
-		time_since_start += t * time_scale;
+		time_since_start += dt;
 
-		// Add a "breadcrumb" or trail point if a certain distance away from last
-		if (Magnitude(this_pos - last_trail_point) > (0.5 * radius) / 24)
-		{
-			trail_points.emplace_back(this_pos);
-			last_trail_point = this_pos;
-		}
+		Update_Trail();
 
-		// Remove trail point to only show most recent 
-		if (trail_points.size() > 24)
-		{
-			trail_points.erase(trail_points.begin());
-		}
-		
-		velocity = sim_step[1]; // Get result from RK4 buffer
-		acceleration = sim_step[2];
+		velocity = store.Get_Velocity(handle);
 
 		update_inspector(); // Update GUI
-
-		return 0; // Successful update.
 	}
 
 	int Draw_Arrows(Graphyte& g, Camera& c, vector3 start, vector3 screen_dimensions)
@@ -707,7 +798,7 @@ public:
 
 		//Draw arrow for acceleration
 		Arrow arrow_acceleration;
-		arrow_end = c.WorldSpaceToScreenSpace(position + (acceleration * arrow_modifier * 5E5), screen_dimensions.x, screen_dimensions.y);
+		arrow_end = c.WorldSpaceToScreenSpace(position + (Get_Acceleration() * arrow_modifier * 5E5), screen_dimensions.x, screen_dimensions.y);
 		dir = arrow_end - start;
 		arrow_acceleration.Draw(start, Normalize(dir), Magnitude(dir), 2, g); //Draw arrow, with 2 heads.
 
@@ -805,14 +896,38 @@ public:
 
 	vector3 Get_Acceleration()
 	{
-		return acceleration;
+		if (handle == -1)
+		{
+			return { 0, 0, 0 };
+		}
+		return store.Get_Acceleration(handle);
 	}
 
 	void Set_Mu(double _mu);
 
+	PhysicsStore& Get_Store()
+	{
+		return store;
+	}
+
+	int Get_Handle()
+	{
+		return handle;
+	}
+
+	std::vector<Satellite*>& Get_Satellites()
+	{
+		Clean_Up_Satellites(); // Never hand out satellites that are scheduled for deletion
+		return satellites;
+	}
+
 	double Get_Mu()
 	{
-		return mu;
+		if (handle == -1)
+		{
+			return 0;
+		}
+		return store.mu[store.Slot(handle)];
 	}
 
 	/// <summary>
@@ -880,6 +995,7 @@ private:
 	//Override Circular Orbit Projection [NO LONGER SUPPORTED]
 	void Project_Circular_Orbit(vector3& _velocity) override {
 		vector3 p_velocity = parentBody->Get_Tangential_Velocity();
+		double mu = Get_Mu();
 		//We manipulate the velocity so that a perfectly circular orbit is achieved
 		if (position.x != 0)
 		{
@@ -912,7 +1028,7 @@ protected:
 			// Relative Velocity
 			if (inspector_velocity != NULL) { inspector_velocity->Set_Text("| Velocity: " + (velocity - parentBody->Get_Tangential_Velocity()).Debug()); }
 			if (inspector_angular_velocity != NULL) { inspector_angular_velocity->Set_Text("| Angular Velocity: " + std::to_string(angular_velocity * 60 * 60 * 24) + "rad/day"); }
-			if (inspector_acceleration != NULL) { inspector_acceleration->Set_Text("| Acceleration: " + (acceleration - parentBody->Get_Acceleration()).Debug()); }
+			if (inspector_acceleration != NULL) { inspector_acceleration->Set_Text("| Acceleration: " + (Get_Acceleration() - parentBody->Get_Acceleration()).Debug()); }
 			if (inspector_period != NULL) { inspector_period->Set_Text("| Orbit Period: " + std::to_string(Calculate_Period() / (60 * 60 * 24)) + " days"); }
 		}
 	}
@@ -928,51 +1044,31 @@ protected:
 public:
 	//Constructor
 	Satellite(std::string _name, Body* _parentBody, vector3 center, double _mass, double _scale, vector3 _velocity, Graphyte& g, bool override_velocity = false): 
-		Body(_name, center + _parentBody->Get_Position(), _mass, _scale, _velocity + _parentBody->Get_Tangential_Velocity(), _parentBody->Get_Mu(), g, false), parentBody(_parentBody)
+		Body(_name, center + _parentBody->Get_Position(), _mass, _scale, _velocity + _parentBody->Get_Tangential_Velocity(), _parentBody->Get_Mu(), g, _parentBody->Get_Store(), false), parentBody(_parentBody)
 	{
+		store.Set_Parent(handle, parentBody->Get_Handle()); // Integrated relative to its parent
 		std::cout << "\n____________\nSATELLITE INSTANTIATION\n____________\n" << "parent body name: " << parentBody->name << "\nparent body location: " << parentBody->Get_Position().Debug() << "\nmy location: " << Get_Position().Debug() + "\n";
 		std::cout << "\nSAT POS (RELATIVE) CONSTRUCTOR:" + (position).Debug() + "\n";
 		std::cout << "SAT VEL (RELATIVE) CONSTRUCTOR:" + (velocity).Debug() + " MEANT TO BE: " + _velocity.Debug() + "\n";
 	}
-	//Override Update
-	int Update_Body(float delta, float time_scale, std::vector<Body*>* bodies_in_system) override
+	//Override Step Bookkeeping
+	void Sync_From_Store(double dt, vector3 render_position) override
 	{
-		if (time_scale == 0) // If paused, don't update.
-		{
-			return 0;
-		}
-
 		//rotate(0.0005f, 0.0005f, 0.0005f);
-		vector3 this_pos = position;
-		float t = (delta / 1000); //time in seconds
-		std::vector<vector3> sim_step = rk4_step(time_since_start, this_pos, velocity, bodies_in_system, t * time_scale);
-		this_pos = sim_step[0];
-		radius = Magnitude(this_pos - parentBody->Get_Position());
+		vector3 new_pos = render_position;
+		radius = Magnitude(new_pos - parentBody->Get_Position());
 		
-		MoveToPos(this_pos);
+		MoveToPos(new_pos);
 		angular_velocity = Magnitude(velocity - parentBody->Get_Tangential_Velocity()) / Magnitude(position - parentBody->Get_Position());
-		time_since_start += t * time_scale;
+		time_since_start += dt;
 
-		if (Magnitude(this_pos - last_trail_point) > (0.5 * radius) / 24)
-		{
-			trail_points.emplace_back(this_pos);
-			last_trail_point = this_pos;
-			//printf("Added Point");
-		}
-		if (trail_points.size() > 24)
-		{
-			//printf("Erased Point");
-			trail_points.erase(trail_points.begin());
-		}
+		Update_Trail();
 
-		velocity = sim_step[1];
+		velocity = store.Get_Velocity(handle);
 		//std::cout << "SAT VEL (RELATIVE):" + (velocity - parentBody->Get_Tangential_Velocity()).Debug() + "\n";
-		acceleration = sim_step[2];
-		//std::cout << "\nSatellite Accel: " << Normalize(acceleration).Debug();
+		//std::cout << "\nSatellite Accel: " << Normalize(Get_Acceleration()).Debug();
 
 		update_inspector();
-
-		return 0;
 	}
 
 	std::string DebugBody() override //For debugging purposes...
@@ -982,13 +1078,13 @@ public:
 	}
 };
 
-int Body::Update_Satellites(float delta, float time_scale, std::vector<Body*>* bodies_in_system)
+int Body::Update_Satellites(float delta, float time_scale, const Octree* tree)
 {
 	//Now update Satellites
 	Clean_Up_Satellites();
 	for (Satellite* sat : satellites)
 	{
-		sat->Update_Body(delta, time_scale, bodies_in_system);
+		sat->Update_Body(delta, time_scale, tree);
 	}
 	return 0;
 }
@@ -1045,10 +1141,13 @@ void Body::Close_Satellite_Inspectors()
 
 void Body::Set_Mu(double _mu)
 {
-	mu = _mu;
+	if (handle != -1)
+	{
+		store.Set_Mu(handle, _mu);
+	}
 	for (Satellite* s : satellites)
 	{
-		s->Set_Mu(mu);
+		s->Set_Mu(_mu);
 	}
 }
 
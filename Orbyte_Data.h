@@ -4,12 +4,12 @@
 
 #include<iostream>
 #include<fstream>
+#include <string>
+#include <vector>
+#include <cstdint>
 #include "vec3.h"
 #include <bitset>
-#include "utils.h"
-#include "OrbitBody.h"
-#include <ShObjIdl_core.h>
-#include <Windows.h>
+#include "utils.h" // No SDL or Windows headers from here down: the headless runner reads .orbyte files too
 
 struct OrbitBodyData
 {
@@ -141,6 +141,7 @@ struct SimulationData
 	double cb_scale = 0; // Scale of center body
 	OrbitBodyCollection obc; // All orbits
 	vector3 c_pos; // Camera position
+	double integration_method = 0; // SystemIntegrator::Method. Written after the orbits so older files still load (as RK4).
 };
 
 class DataController
@@ -194,6 +195,7 @@ public:
 			vector3 v = data.velocity; // Body Velocity
 			out.write((char*)&v, sizeof(vector3));
 		}
+		out.write((char*)&sd.integration_method, sizeof(double)); // Integration Method
 		out.close();
 
 		std::cout << "\nBytes: " << my_size + 1;
@@ -252,6 +254,21 @@ public:
 			sd.obc.AddBodyData(data);
 		}
 
+		// Integration Method. Files saved before it existed end here, so running out of file just means the default.
+		if (in.good())
+		{
+			double method;
+			in.read((char*)&method, sizeof(double));
+			if (in.gcount() == sizeof(double))
+			{
+				sd.integration_method = method; std::cout << "\nReading integration method: " << sd.integration_method;
+			}
+			else
+			{
+				in.clear(); // Hitting the end here isn't a failure
+			}
+		}
+
 		in.close();
 
 
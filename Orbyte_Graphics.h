@@ -435,6 +435,7 @@ private: //Private attributes & Methods
 	std::vector<Text*> texts; //Vector of text elements to be drawn to the screen.
 	std::vector<Icon*> icons; //Vectorr of icon elements to be drawn to the screen.
 	std::vector<SDL_Point> points; //Vector of points to be drawn to the screen. Iterate through & draw each point to screen as a pixel.
+	std::vector<SDL_Point> particle_points; //Test particles: far too many to colour one by one, so drawn in one go.
 
 public:  //Public attributes & Methods
 	TextField* active_text_field = NULL; //This pointer will be used to edit text fields
@@ -522,6 +523,14 @@ public:  //Public attributes & Methods
 		}
 	}
 
+	void particle(int x, int y)
+	{
+		if (std::abs(x) < (float)(SCREEN_WIDTH / 2) && std::abs(y) < (float)(SCREEN_HEIGHT / 2))
+		{
+			particle_points.push_back({ x + SCREEN_WIDTH / 2, -y + SCREEN_HEIGHT / 2 });
+		}
+	}
+
 	void line(float x1, float y1, float x2, float y2)
 	{
 		int dx = (x2 - x1);
@@ -553,6 +562,12 @@ public:  //Public attributes & Methods
 		}
 		//std::cout << "\n\nDRAWN POINTS: " << count << " HAD MEMORY: " << count * sizeof(SDL_Point);
 
+		if (!particle_points.empty())
+		{
+			SDL_SetRenderDrawColor(Renderer, 160, 160, 160, 255);
+			SDL_RenderDrawPoints(Renderer, particle_points.data(), particle_points.size());
+		}
+
 		//Make sure you render GUI!
 		for (Text* t : texts)
 		{
@@ -567,6 +582,7 @@ public:  //Public attributes & Methods
 
 		SDL_RenderPresent(Renderer);
 		points.clear();
+		particle_points.clear();
 	}
 
 	void free()
@@ -0,0 +1,359 @@
+/*
+	Orbyte_Headless: integrates a .orbyte scenario with no window, as fast as the CPU allows, for batch jobs.
+	Only uses the physics headers (no SDL, no Windows), so it builds anywhere there is a C++14 compiler: see CMakeLists.txt.
+
+	Orbyte_Headless [--check-allocations] file.orbyte [days = 365] [step hours = 6] [snapshot every days = 30] [method = the file's] [workers = 0] [out = file] [forces = gravity] [drag m^2/kg = 0.01] [srp m^2/kg = 0.01] [j2 = 0]
+	Orbyte_Headless --ensemble file.orbyte [members = 1000] [days = 365] [spread = 1E-6] [step hours = 6] [out = ensemble.csv]
+	Orbyte_Headless --ephemeris file.orbyte [years = 100] [step hours = 6] [out = file.ephemeris]
+
+	file.orbyte is read from simulations/, like the GUI. Every snapshot interval the state is appended to out_snapshots.csv,
+	and at the end it goes to out_final.csv. Every body's apsides and nodes (crossings of the z = 0 plane) go to out_events.csv
+	as they happen, timed by EventDetector however long the steps are. Methods are numbered as in SystemIntegrator::Method.
+
+	forces picks the force models on top of gravity (see ForceModels.h): gravity, j2 (the central body's oblateness, at its
+	radius), drag, srp (radiation pressure) or all. Each is its own integrator, compiled in ahead of time (see
+	SelectableIntegrator), so gravity alone runs exactly as fast as it did before there were models. Satellites' drag
+	coefficient * area / mass and reflectivity * area / mass come after it; the atmosphere is the Earth's. Then the central
+	body's J2, which j2 and all need: 2E-7 for the Sun, 1.08263E-3 for the Earth.
+
+	--check-allocations counts the heap allocations the integrator and the event detector make once the first few steps have
+	sized their buffers, and exits with 1 if there were any: a steady step must not touch the heap (see AllocationCounter).
+
+	--ensemble runs the scenario as an ensemble of perturbed copies and writes their spread (see Ensemble). --ephemeris
+	integrates it once and saves it as a Chebyshev ephemeris in simulations/, for the GUI to play back (see Ephemeris).
+*/
+#define ORBYTE_COUNT_ALLOCATIONS // Always counted here: a thread local increment per allocation is nothing next to a step
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <cmath>
+#include <thread>
+#include <algorithm>
+#include "vec3.h"
+#include "Orbyte_Data.h"
+#include "PhysicsState.h"
+#include "SelectableIntegrator.h"
+#include "GravityKernel.h"
+#include "Events.h"
+#include "Ensemble.h"
+#include "Ephemeris.h"
+#include "AllocationCounter.h"
+
+// Read a scenario from simulations/ into a store, one slot per orbit, and name each slot. Returns false if it couldn't be read.
+static bool load_scenario(const std::string& path, SimulationData& sd, PhysicsStore& store, std::vector<std::string>& names)
+{
+	DataController data_controller;
+	sd = data_controller.ReadDataFromFile(path);
+	if (sd.cb_mass == 0)
+	{
+		return false;
+	}
+
+	const double Gravitational_Constant = 6.6743E-11; // Same as the bodies'
+	for (OrbitBodyData orbit : sd.obc.GetAllOrbits())
+	{
+		int handle = store.Add(orbit.center, orbit.velocity, Gravitational_Constant * orbit.mass, Gravitational_Constant * sd.cb_mass);
+		store.Set_Radius(handle, orbit.scale);
+		names.push_back(orbit.name);
+	}
+	return true;
+}
+
+// One row per body: time, name, position, velocity
+static void write_state(std::ofstream& out, double seconds, const PhysicsStore& store, const std::vector<std::string>& names)
+{
+	for (int i = 0; i < (int)store.x.size(); i++)
+	{
+		out << seconds << "," << names[i] << "," << store.x[i] << "," << store.y[i] << "," << store.z[i] << ","
+			<< store.vx[i] << "," << store.vy[i] << "," << store.vz[i] << "\n";
+	}
+}
+
+static bool open_csv(std::ofstream& out, const std::string& path)
+{
+	out.open(path);
+	if (!out)
+	{
+		std::cout << "\nERR. Writing to " << path << " failed.";
+		return false;
+	}
+	out.precision(17);
+	out << "seconds,body,x,y,z,vx,vy,vz\n";
+	return true;
+}
+
+struct Run
+{
+	double step, end, snapshot_every;
+	long long steps;
+	std::ofstream* snapshots;
+	std::ofstream* event_log;
+	long long allocations; // Made by steady steps, counted from WARM_UP_STEPS on
+};
+
+static const int WARM_UP_STEPS = 3; // Buffers grow over the first steps (DOPRI5 and Hermite pick their substeps on the first)
+
+// Step the store through to the end, writing snapshots and events on the way
+static void integrate(SelectableIntegrator& integrator, PhysicsStore& store, EventDetector& events, const std::vector<std::string>& names, Run& run)
+{
+	double seconds = 0;
+	double next_snapshot = 0;
+	long long next_report = run.steps / 10;
+	auto start = std::chrono::steady_clock::now();
+	for (long long k = 0; k < run.steps; k++)
+	{
+		if (run.snapshot_every > 0 && seconds >= next_snapshot)
+		{
+			write_state(*run.snapshots, seconds, store, names);
+			next_snapshot += run.snapshot_every;
+		}
+		double h = std::min(run.step, run.end - seconds); // The last step lands exactly on the end
+		long long allocations_before = AllocationCounter::Count();
+		integrator.Step(1000, h, store); // 1000 ms at a time scale of h => a step of h seconds
+		int found = events.Check(integrator.Get_Previous(), store, seconds, h);
+		if (k >= WARM_UP_STEPS)
+		{
+			run.allocations += AllocationCounter::Count() - allocations_before;
+		}
+		if (found > 0)
+		{
+			for (int i = 0; i < events.Logged(); i++)
+			{
+				const EventDetector::Event& e = events.Get_Event(i);
+				*run.event_log << e.seconds << "," << events.Name(e.definition) << "," << e.value << "\n";
+			}
+			events.Clear_Log(); // Written out, so the log never fills up however long the run
+		}
+		seconds = k + 1 < run.steps ? (k + 1) * run.step : run.end; // Not summed, so the clock doesn't drift over millions of steps
+
+		if (k + 1 == next_report)
+		{
+			double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			std::cout << (100 * (k + 1)) / run.steps << "%: " << seconds / 86400 << " days, " << (k + 1) / elapsed << " steps/s\n";
+			next_report += run.steps / 10;
+		}
+	}
+}
+
+// Orbyte_Headless --ensemble: args[1] is the file
+static int run_ensemble(int argc, char* args[])
+{
+	std::string path = argc > 1 ? args[1] : "solar_system.orbyte";
+	int members = argc > 2 ? atoi(args[2]) : 1000;
+	double days = argc > 3 ? atof(args[3]) : 365;
+	double spread = argc > 4 ? atof(args[4]) : 1E-6;
+	double step_hours = argc > 5 ? atof(args[5]) : 6;
+	std::string out = argc > 6 ? args[6] : "ensemble.csv";
+	if (members <= 0)
+	{
+		std::cout << "\nERR. Members must be positive.\n";
+		return 1;
+	}
+	if (!(days > 0 && step_hours > 0 && std::isfinite(days) && std::isfinite(step_hours)))
+	{
+		std::cout << "\nERR. Days and step hours must be positive.\n";
+		return 1;
+	}
+	if (!(spread >= 0 && std::isfinite(spread)))
+	{
+		std::cout << "\nERR. Spread must not be negative.\n";
+		return 1;
+	}
+
+	SimulationData sd;
+	PhysicsStore scenario;
+	std::vector<std::string> names;
+	if (!load_scenario(path, sd, scenario, names))
+	{
+		return 1;
+	}
+
+	Ensemble ensemble;
+	ensemble.Setup(scenario, members, spread);
+	int workers = std::max(0, (int)std::thread::hardware_concurrency() - 1);
+	std::cout << "\n\nRunning " << members << " members of " << path << " for " << days << " days on " << workers + 1 << " threads\n";
+	ensemble.Run(days * 86400, step_hours * 3600, Ensemble::YOSHIDA4, workers);
+	ensemble.Print_Statistics(names);
+	ensemble.Write_CSV(out, names);
+	return 0;
+}
+
+// Orbyte_Headless --ephemeris: args[1] is the file
+static int run_ephemeris(int argc, char* args[])
+{
+	std::string path = argc > 1 ? args[1] : "solar_system.orbyte";
+	double years = argc > 2 ? atof(args[2]) : 100;
+	double step_hours = argc > 3 ? atof(args[3]) : 6;
+	std::string out = argc > 4 ? args[4] : path.substr(0, path.rfind(".orbyte")) + ".ephemeris";
+	if (!(years > 0 && step_hours > 0 && std::isfinite(years) && std::isfinite(step_hours)))
+	{
+		std::cout << "\nERR. Years and step hours must be positive.\n";
+		return 1;
+	}
+
+	SimulationData sd;
+	PhysicsStore scenario;
+	std::vector<std::string> names;
+	if (!load_scenario(path, sd, scenario, names))
+	{
+		return 1;
+	}
+
+	std::cout << "\n\nBuilding a " << years << " year ephemeris of " << path << " at " << step_hours << " hour steps\n";
+	auto start = std::chrono::steady_clock::now();
+	Ephemeris ephemeris;
+	if (!ephemeris.Build(scenario, names, 0, years * 365.25 * 86400, step_hours * 3600))
+	{
+		std::cout << "\nERR. Building the ephemeris failed.\n";
+		return 1;
+	}
+	std::cout << "Done in " << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s, " << ephemeris.Bytes() / 1E6 << " MB\n";
+	return ephemeris.Write(out) ? 0 : 1;
+}
+
+int main(int argc, char* argv[])
+{
+	// Flags can go anywhere; everything else is positional
+	bool check_allocations = false, ensemble = false, ephemeris = false;
+	std::vector<char*> positional;
+	for (int i = 0; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "--check-allocations")
+		{
+			check_allocations = true;
+		}
+		else if (arg == "--ensemble")
+		{
+			ensemble = true;
+		}
+		else if (arg == "--ephemeris")
+		{
+			ephemeris = true;
+		}
+		else
+		{
+			positional.push_back(argv[i]);
+		}
+	}
+	argc = positional.size();
+	char** args = positional.data();
+	if (ensemble)
+	{
+		return run_ensemble(argc, args);
+	}
+	if (ephemeris)
+	{
+		return run_ephemeris(argc, args);
+	}
+
+	if (argc < 2)
+	{
+		std::cout << "Orbyte_Headless [--check-allocations] file.orbyte [days = 365] [step hours = 6] [snapshot every days = 30] [method = the file's] [workers = 0] [out = file] [forces = gravity] [drag m^2/kg = 0.01] [srp m^2/kg = 0.01] [j2 = 0]\n"
+			<< "Orbyte_Headless --ensemble file.orbyte [members = 1000] [days = 365] [spread = 1E-6] [step hours = 6] [out = ensemble.csv]\n"
+			<< "Orbyte_Headless --ephemeris file.orbyte [years = 100] [step hours = 6] [out = file.ephemeris]\n";
+		return 1;
+	}
+	std::string path = args[1];
+	double days = argc > 2 ? atof(args[2]) : 365;
+	double step_hours = argc > 3 ? atof(args[3]) : 6;
+	double snapshot_days = argc > 4 ? atof(args[4]) : 30;
+	int method = argc > 5 ? atoi(args[5]) : -1;
+	int workers = argc > 6 ? atoi(args[6]) : 0;
+	std::string out = argc > 7 ? args[7] : path.substr(0, path.rfind(".orbyte"));
+	std::string force_name = argc > 8 ? args[8] : "gravity";
+	double drag_ballistic = argc > 9 ? atof(args[9]) : 0.01;
+	double radiation_area_to_mass = argc > 10 ? atof(args[10]) : 0.01;
+	double j2 = argc > 11 ? atof(args[11]) : 0;
+	const char* force_names[SelectableIntegrator::FORCES_COUNT] = { "gravity", "j2", "drag", "srp", "all" }; // By SelectableIntegrator::Forces
+	int forces = 0;
+	while (forces < SelectableIntegrator::FORCES_COUNT && force_name != force_names[forces])
+	{
+		forces++;
+	}
+	if (days <= 0 || step_hours <= 0)
+	{
+		std::cout << "\nERR. Days and step hours must be positive.\n";
+		return 1;
+	}
+	if (forces == SelectableIntegrator::FORCES_COUNT)
+	{
+		std::cout << "\nERR. Forces must be gravity, j2, drag, srp or all.\n";
+		return 1;
+	}
+	if ((forces == SelectableIntegrator::J2 || forces == SelectableIntegrator::ALL) && !(j2 > 0 && std::isfinite(j2)))
+	{
+		std::cout << "\nERR. Forces " << force_name << " needs the central body's J2 (2E-7 for the Sun, 1.08263E-3 for the Earth).\n";
+		return 1;
+	}
+
+	SimulationData sd;
+	PhysicsStore store;
+	std::vector<std::string> names;
+	if (!load_scenario(path, sd, store, names))
+	{
+		return 1;
+	}
+
+	EventDetector events;
+	for (int i = 0; i < (int)names.size(); i++)
+	{
+		events.Add_Apsides(names[i], store.handle_of_slot[i]);
+		events.Add_Plane_Crossing(names[i], store.handle_of_slot[i], { 0, 0, 1 });
+	}
+
+	std::ofstream snapshots, final_state;
+	if (!open_csv(snapshots, out + "_snapshots.csv") || !open_csv(final_state, out + "_final.csv"))
+	{
+		return 1;
+	}
+	std::ofstream event_log(out + "_events.csv");
+	if (!event_log)
+	{
+		std::cout << "\nERR. Writing to " << out << "_events.csv failed.";
+		return 1;
+	}
+	event_log.precision(17);
+	event_log << "seconds,event,value\n";
+
+	Run run;
+	run.step = step_hours * 3600;
+	run.end = days * 86400;
+	run.snapshot_every = snapshot_days * 86400;
+	run.steps = (long long)std::ceil(run.end / run.step - 1E-9);
+	run.snapshots = &snapshots;
+	run.event_log = &event_log;
+	run.allocations = 0;
+	int chosen_method = method >= 0 ? method : (int)sd.integration_method;
+	std::cout << "\n\nIntegrating " << path << " (" << names.size() << " bodies) for " << days << " days at " << step_hours << " hour steps with "
+		<< SystemIntegrator::Method_Name((SystemIntegrator::Method)chosen_method) << ", forces " << force_name << ", gravity kernel " << GravityKernel::Name(GravityKernel::Get_Level()) << "\n";
+
+	SelectableIntegrator integrator;
+	integrator.Set_Method(chosen_method);
+	integrator.Set_Worker_Count(workers);
+	integrator.Select(forces);
+	integrator.forces.j2 = j2;
+	integrator.forces.j2_radius = sd.cb_scale;
+	integrator.forces.drag_ballistic = drag_ballistic;
+	integrator.forces.radiation_area_to_mass = radiation_area_to_mass;
+	auto start = std::chrono::steady_clock::now();
+	integrate(integrator, store, events, names, run);
+	write_state(snapshots, run.end, store, names);
+	write_state(final_state, run.end, store, names);
+
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "Done: " << run.steps << " steps in " << elapsed << " s, " << events.Total() << " events. Wrote " << out << "_snapshots.csv, " << out << "_final.csv and " << out << "_events.csv\n";
+	if (check_allocations)
+	{
+		std::cout << run.allocations << " heap allocations in " << std::max(0LL, run.steps - WARM_UP_STEPS) << " steady steps\n";
+		if (run.allocations > 0)
+		{
+			std::cout << "ERR. A steady step allocated.\n";
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -19,6 +19,12 @@
 #include "Orbyte_Data.h"
 #include "Orbyte_Graphics.h"
 #include "utils.h"
+#include "Octree.h"
+#include "SystemIntegrator.h"
+#include "PhysicsState.h"
+#include "GravityKernel.h"
+#include "AllocationCounter.h"
+#include "SimulationThread.h"
 
 class Simulation
 {
@@ -50,17 +56,93 @@ private:
 
 	//Orbit Bodies
 	std::vector<Body*> orbiting_bodies;
+	PhysicsStore physics_store; // Physics state of every body and satellite
 
 	//CB
 	CentralBody Sun;
 
+	//Barnes-Hut
+	Octree gravity_tree;
+	bool use_barnes_hut = false; // false => exact direct sum
+	double opening_angle = 0.5;
+
+	//Integration
+	//The system integrators run on the simulation thread, which owns the real physics state. physics_store is the GUI's copy:
+	//refreshed from the thread's snapshots, and journalling every edit the GUI makes to it back to the thread.
+	SimulationThread simulation_thread;
+	bool use_system_integrator = true; // false => legacy body by body Update_Body, here on the GUI thread
+	int integration_method = SystemIntegrator::RK4;
+	double worker_threads = 0; // Force evaluation threads, edited from the GUI (so a double)
+	double tolerance_exponent = -9; // Adaptive integrator tolerance is 10^this. Edited as an exponent because std::to_string(1E-9) is "0.000000".
+	double rel_tolerance = 1E-9;
+	double synced_seconds = 0; // Simulated time the body views were last brought up to
+	bool regularize = false; // Solve close pairs as binaries (simulation thread only)
+	int force_models = SelectableIntegrator::GRAVITY; // Forces on top of gravity (simulation thread only)
+	double central_j2 = 0; // Oblateness of the central body when J2 is on, edited from the GUI. 2E-7 for the Sun, 1.08263E-3 for the Earth.
+	double drag_density = 1.225, drag_scale_height = 8500; // Satellites' parents' atmospheres when drag is on (kg/m^3, m). The Earth's.
+	double drag_ballistic = 0.01; // Satellites' drag coefficient * area / mass (m^2/kg), edited from the GUI
+	double radiation_pressure = 4.56E-6; // At 1 AU (N/m^2)
+	double radiation_area_to_mass = 0.01; // Satellites' reflectivity * area / mass (m^2/kg), edited from the GUI
+	double softening = 0; // Plummer softening length (m), edited from the GUI and kept in the physics store
+
+	//Collisions
+	CollisionDetector collisions; // Legacy path only: the simulation thread has its own
+	int collision_response = CollisionDetector::MERGE;
+	double restitution = 1; // Bounce only. 1 => elastic
+	std::vector<double> step_start_x, step_start_y, step_start_z; // Legacy path positions at the start of the step, for swept collision tests
+
+	//Timeline (simulation thread only: see Timeline)
+	int timeline_retention = Timeline::THIN_OUT;
+	double timeline_budget_mb = 64; // Memory the checkpoints may use
+	double seek_days = 0; // Edited from the GUI
+	double timeline_start = 0, timeline_end = 0; // Simulated seconds that can be sought to, from the latest snapshot
+	bool warping = false; // The simulation thread is running flat out to a time: draw nothing but the progress
+	double warp_from = 0, warp_to = 0;
+	const int WARP_FRAME_MS = 50; // Frame interval while warping, to leave the cores to the physics
+
+	//Test particles (simulation thread only: see TestParticles)
+	double particle_count = 100000; // Added per press of P
+	unsigned particle_seed = 1;
+
+	//Settings as last sent to the simulation thread
+	struct SentSettings
+	{
+		bool valid = false; // false => send everything again
+		double time_scale = 0;
+		int method = 0;
+		bool barnes_hut = false;
+		double opening_angle = 0;
+		double physics_rate = 0;
+		double rel_tolerance = 0;
+		int workers = 0;
+		int collision_response = 0;
+		double restitution = 0;
+		double central_radius = 0;
+		bool regularize = false;
+		int force_models = 0;
+		double central_j2 = 0;
+		double central_radius_j2 = 0;
+		double drag_density = 0, drag_scale_height = 0, drag_ballistic = 0;
+		double radiation_pressure = 0, radiation_area_to_mass = 0;
+		int timeline_retention = 0;
+		double timeline_budget_mb = 0;
+	} sent;
+
 	//Runtime variables
 	bool quit = false;
 	SDL_Event sdl_event;
 
 	//Current time start time
-	Uint32 startTime = 0;
-	Uint32 deltaTime = 0; // delta time in milliseconds
+	Uint64 startTime = 0; // Performance counter ticks
+	double deltaTime = 0; // delta time in milliseconds
+
+	//Fixed physics clock. Physics always advances in whole steps of physics_step_ms of real time, however long frames take,
+	//so a run gives the same result on any machine. Frames draw the bodies part way between the last two steps.
+	double physics_rate = 120; // Physics steps per real second, edited from the GUI
+	double physics_step_ms = 1000.0 / 120;
+	double physics_accumulator = 0; // Real milliseconds not simulated yet
+	const int MAX_PHYSICS_SUBSTEPS = 32; // Per frame. A slow machine falls behind real time rather than spiralling (slower frames => more steps => slower frames).
+	int physics_substeps = 0; // Taken last frame
 	double timeSinceStart = 0;
 
 	//Path source for Orbyte Files
@@ -146,6 +228,7 @@ private:
 	//Frees media and shuts down SDL
 	void close()
 	{
+		simulation_thread.Stop();
 
 		TTF_CloseFont(gFont);
 		gFont = NULL;
@@ -224,14 +307,83 @@ private:
 		close_planet_inspectors();
 	}
 
-	Uint32 Update_Clock()
+	double Update_Clock()
 	{
-		Uint32 current_time = SDL_GetTicks(); //milliseconds
-		Uint32 delta = current_time - startTime;
+		Uint64 current_time = SDL_GetPerformanceCounter(); // High resolution: SDL_GetTicks only counts whole milliseconds
+		double delta = (double)(current_time - startTime) * 1000 / SDL_GetPerformanceFrequency(); //milliseconds
 		startTime = current_time;
 		return delta;
 	}
 
+	void apply_physics_rate()
+	{
+		physics_rate = std::min(10000.0, std::max(1.0, physics_rate));
+		physics_step_ms = 1000 / physics_rate;
+		std::cout << "\nPhysics rate: " << physics_rate << " steps/s\n";
+	}
+
+	// Advance the legacy body by body physics by one fixed step
+	void physics_step(Octree* tree)
+	{
+		if (time_scale != 0)
+		{
+			physics_store.Advance_Analytic((physics_step_ms / 1000) * time_scale); // Update_Body just syncs these
+		}
+		if (tree != NULL)
+		{
+			build_gravity_tree(); // Everyone is evaluated against where the bodies were at the start of the step
+		}
+		step_start_x = physics_store.x; step_start_y = physics_store.y; step_start_z = physics_store.z;
+		for (Body* b : orbiting_bodies)
+		{
+			if (!b->to_delete) // Absorbed earlier this frame, clean_orbit_queue hasn't got to it yet
+			{
+				b->Update_Body(physics_step_ms, time_scale, tree); // Update body
+			}
+		}
+
+		collisions.response = (CollisionDetector::Response)collision_response;
+		collisions.restitution = restitution;
+		collisions.central_radius = Sun.scale;
+		if (physics_store.Size() == (int)step_start_x.size() && collisions.Resolve(physics_store, step_start_x.data(), step_start_y.data(), step_start_z.data()) > 0)
+		{
+			for (Body* b : orbiting_bodies)
+			{
+				settle_collisions(b);
+			}
+		}
+	}
+
+	// Catch a body's view up with what collisions did to it in the store: gone if it was absorbed, heavier and bigger if it absorbed something
+	void settle_collisions(Body* b)
+	{
+		if (b->to_delete || b->Get_Handle() == -1)
+		{
+			return;
+		}
+		if (physics_store.Slot(b->Get_Handle()) < 0)
+		{
+			b->Absorbed(); // clean_orbit_queue erases it next frame
+			return;
+		}
+		b->Sync_Physical();
+		for (Satellite* sat : b->Get_Satellites())
+		{
+			settle_collisions(sat);
+		}
+	}
+
+	std::string collision_status(int count)
+	{
+		return CollisionDetector::Response_Name((CollisionDetector::Response)collision_response) + (count > 0 ? ", " + std::to_string(count) + " just now" : "");
+	}
+
+	void cycle_collision_response()
+	{
+		collision_response = (collision_response + 1) % CollisionDetector::RESPONSE_COUNT;
+		std::cout << "\nCollisions: " << CollisionDetector::Response_Name((CollisionDetector::Response)collision_response) << "\n";
+	}
+
 	void clean_orbit_queue()
 	{
 		// this is not as performant as I'd like it to be!
@@ -267,6 +419,423 @@ private:
 		return com;
 	}
 
+	// Rebuild the octree from the current position of every body in the store
+	void build_gravity_tree()
+	{
+		PhysicsStore& ps = physics_store;
+		gravity_tree.Build(ps.x.data(), ps.y.data(), ps.z.data(), ps.gm.data(), ps.Size());
+	}
+
+	void apply_worker_threads()
+	{
+		worker_threads = std::max(0, (int)worker_threads);
+		std::cout << "\nForce evaluation worker threads: " << (int)worker_threads << "\n";
+	}
+
+	void start_simulation_thread()
+	{
+		physics_store.journal = &simulation_thread.Get_Commands(); // From now on edits go to the thread too
+		simulation_thread.Start(physics_store, timeSinceStart / 1000);
+		synced_seconds = timeSinceStart / 1000;
+		sent.valid = false;
+	}
+
+	void stop_simulation_thread()
+	{
+		simulation_thread.Stop();
+		physics_store.journal = NULL;
+		physics_store.Assign_State(simulation_thread.Get_State()); // Carry on from exactly where it got to
+		timeSinceStart = simulation_thread.Get_Simulated_Seconds() * 1000;
+	}
+
+	// Send the simulation thread any settings that have changed since last frame
+	void push_settings()
+	{
+		if (!sent.valid || time_scale != sent.time_scale)
+		{
+			simulation_thread.Send(PhysicsCommand::SET_TIME_SCALE, time_scale);
+			sent.time_scale = time_scale;
+		}
+		if (!sent.valid || integration_method != sent.method)
+		{
+			simulation_thread.Send(PhysicsCommand::SET_METHOD, integration_method);
+			sent.method = integration_method;
+		}
+		if (!sent.valid || use_barnes_hut != sent.barnes_hut || opening_angle != sent.opening_angle)
+		{
+			simulation_thread.Send(PhysicsCommand::SET_FORCE_MODE, use_barnes_hut ? 1 : 0, opening_angle);
+			sent.barnes_hut = use_barnes_hut;
+			sent.opening_angle = opening_angle;
+		}
+		if (!sent.valid || physics_rate != sent.physics_rate)
+		{
+			simulation_thread.Send(PhysicsCommand::SET_PHYSICS_RATE, physics_rate);
+			sent.physics_rate = physics_rate;
+		}
+		if (!sent.valid || rel_tolerance != sent.rel_tolerance)
+		{
+			simulation_thread.Send(PhysicsCommand::SET_TOLERANCE, rel_tolerance);
+			sent.rel_tolerance = rel_tolerance;
+		}
+		if (!sent.valid || (int)worker_threads != sent.workers)
+		{
+			simulation_thread.Send(PhysicsCommand::SET_WORKERS, (int)worker_threads);
+			sent.workers = (int)worker_threads;
+		}
+		if (!sent.valid || collision_response != sent.collision_response || restitution != sent.restitution || Sun.scale != sent.central_radius)
+		{
+			PhysicsCommand c;
+			c.type = PhysicsCommand::SET_COLLISIONS;
+			c.value = collision_response;
+			c.value2 = restitution;
+			c.a.x = Sun.scale;
+			simulation_thread.Get_Commands().Push(c);
+			sent.collision_response = collision_response;
+			sent.restitution = restitution;
+			sent.central_radius = Sun.scale;
+		}
+		if (!sent.valid || regularize != sent.regularize)
+		{
+			simulation_thread.Send(PhysicsCommand::SET_REGULARIZATION, regularize ? 1 : 0);
+			sent.regularize = regularize;
+		}
+		if (!sent.valid || force_models != sent.force_models || central_j2 != sent.central_j2 || Sun.scale != sent.central_radius_j2
+			|| drag_density != sent.drag_density || drag_scale_height != sent.drag_scale_height || drag_ballistic != sent.drag_ballistic
+			|| radiation_pressure != sent.radiation_pressure || radiation_area_to_mass != sent.radiation_area_to_mass)
+		{
+			PhysicsCommand c;
+			c.type = PhysicsCommand::SET_FORCE_MODELS;
+			c.value = force_models;
+			c.value2 = radiation_pressure;
+			c.a = { central_j2, Sun.scale, radiation_area_to_mass };
+			c.b = { drag_density, drag_scale_height, drag_ballistic };
+			simulation_thread.Get_Commands().Push(c);
+			sent.force_models = force_models;
+			sent.central_j2 = central_j2;
+			sent.central_radius_j2 = Sun.scale;
+			sent.drag_density = drag_density;
+			sent.drag_scale_height = drag_scale_height;
+			sent.drag_ballistic = drag_ballistic;
+			sent.radiation_pressure = radiation_pressure;
+			sent.radiation_area_to_mass = radiation_area_to_mass;
+		}
+		if (!sent.valid || timeline_retention != sent.timeline_retention || timeline_budget_mb != sent.timeline_budget_mb)
+		{
+			simulation_thread.Send(PhysicsCommand::SET_TIMELINE, timeline_retention, timeline_budget_mb);
+			sent.timeline_retention = timeline_retention;
+			sent.timeline_budget_mb = timeline_budget_mb;
+		}
+		sent.valid = true;
+	}
+
+	// Bring the bodies' views up to date with a snapshot (already copied into physics_store), drawn part way through the last step
+	void sync_views(const SimulationSnapshot& snapshot)
+	{
+		double dt = snapshot.simulated_seconds - synced_seconds;
+		synced_seconds = snapshot.simulated_seconds;
+		double since_step = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - snapshot.published).count();
+		double alpha = std::min(1.0, since_step / snapshot.step_ms);
+		for (Body* b : orbiting_bodies)
+		{
+			settle_collisions(b); // Goes by the state rather than snapshot.collisions, so a snapshot we skipped loses nothing
+			if (!b->to_delete)
+			{
+				sync_view(b, snapshot, dt, alpha);
+			}
+		}
+	}
+
+	void sync_view(Body* b, const SimulationSnapshot& snapshot, double dt, double alpha)
+	{
+		if (b->Get_Handle() == -1)
+		{
+			return;
+		}
+		int s = physics_store.Slot(b->Get_Handle());
+		vector3 render_position = { physics_store.x[s], physics_store.y[s], physics_store.z[s] };
+		if (!snapshot.px.empty())
+		{
+			vector3 before = { snapshot.px[s], snapshot.py[s], snapshot.pz[s] };
+			render_position = before + (render_position - before) * alpha;
+		}
+		b->Sync_From_Store(dt, render_position);
+		for (Satellite* sat : b->Get_Satellites()) // After the parent, which satellites measure themselves from
+		{
+			sync_view(sat, snapshot, dt, alpha);
+		}
+	}
+
+	void apply_tolerance()
+	{
+		tolerance_exponent = std::min(-1.0, std::max(-15.0, tolerance_exponent)); // Tighter than 1E-15 is below double precision
+		rel_tolerance = pow(10, tolerance_exponent);
+		std::cout << "\nAdaptive tolerance: " << rel_tolerance << "\n";
+	}
+
+	// System RK4 -> Leapfrog -> Yoshida 4 -> Yoshida 6 -> Sequential RK4 (legacy, body by body) -> System RK4 ...
+	void cycle_integrator()
+	{
+		if (!use_system_integrator)
+		{
+			use_system_integrator = true;
+			integration_method = SystemIntegrator::RK4;
+			start_simulation_thread();
+		}
+		else if (integration_method + 1 < SystemIntegrator::METHOD_COUNT)
+		{
+			integration_method++;
+		}
+		else
+		{
+			use_system_integrator = false;
+			stop_simulation_thread();
+		}
+		std::cout << "\nIntegrator: " << integrator_name() << "\n";
+	}
+
+	std::string integrator_name()
+	{
+		return use_system_integrator ? "System " + SystemIntegrator::Method_Name((SystemIntegrator::Method)integration_method) : "Sequential RK4";
+	}
+
+	void toggle_regularization()
+	{
+		regularize = !regularize;
+		std::cout << "\nClose encounters: " << (regularize ? "solved as binaries" : "left to the integrator") << (use_system_integrator ? "" : " (system integrators only)") << "\n";
+	}
+
+	// Gravity -> + J2 -> + drag -> + radiation pressure -> all of them -> gravity ...
+	void cycle_force_models()
+	{
+		force_models = (force_models + 1) % SelectableIntegrator::FORCES_COUNT;
+		std::cout << "\nForces: " << SelectableIntegrator::Forces_Name((SelectableIntegrator::Forces)force_models) << (use_system_integrator ? "" : " (system integrators only)") << "\n";
+		if ((force_models == SelectableIntegrator::J2 || force_models == SelectableIntegrator::ALL) && central_j2 == 0)
+		{
+			std::cout << "Center Body J2 is 0, so J2 does nothing until it is set (0.0000002 for the Sun, 0.00108263 for the Earth)\n";
+		}
+	}
+
+	void apply_softening()
+	{
+		softening = std::max(0.0, softening);
+		physics_store.Set_Softening(softening);
+		std::cout << "\nSoftening length: " << softening << " m\n";
+	}
+
+	// Go to a simulated time on the timeline (clamped to it by the simulation thread)
+	void seek(double seconds)
+	{
+		if (!use_system_integrator)
+		{
+			std::cout << "\nThe timeline is only kept by the system integrators\n";
+			return;
+		}
+		simulation_thread.Send(PhysicsCommand::SEEK, seconds);
+		std::cout << "\nGoing to " << seconds / 86400 << " days\n";
+	}
+
+	// Beyond the timeline the simulation thread warps there (at the current step) rather than stopping at the end of it
+	void apply_seek()
+	{
+		double seconds = seek_days * 86400;
+		if (use_system_integrator && seconds > std::max(timeline_end, timeSinceStart / 1000))
+		{
+			simulation_thread.Send(PhysicsCommand::WARP, seconds);
+			std::cout << "\nWarping to " << seek_days << " days (Esc to cancel)\n";
+			return;
+		}
+		seek(seconds);
+	}
+
+	// Scrub back (-1) or forward (+1) by a fiftieth of the timeline
+	void scrub(int direction)
+	{
+		double span = timeline_end - timeline_start;
+		if (span > 0)
+		{
+			seek(timeSinceStart / 1000 + direction * span / 50);
+		}
+	}
+
+	// The ephemeris that goes with the open .orbyte file (see Orbyte_Headless --ephemeris)
+	std::string ephemeris_path()
+	{
+		std::string path = path_source;
+		size_t dot = path.rfind(".orbyte");
+		return (dot == std::string::npos ? path : path.substr(0, dot)) + ".ephemeris";
+	}
+
+	void bind_ephemeris(Ephemeris& e, Body* b)
+	{
+		if (b->Get_Handle() != -1 && !b->to_delete && !e.Bind(b->name, b->Get_Handle()))
+		{
+			std::cout << "\n" << b->name << " isn't in the ephemeris";
+		}
+		for (Satellite* sat : b->Get_Satellites())
+		{
+			bind_ephemeris(e, sat);
+		}
+	}
+
+	// Play the open file's ephemeris back from its start (as of now), or go back to integrating
+	void toggle_ephemeris()
+	{
+		if (!use_system_integrator)
+		{
+			std::cout << "\nEphemeris playback needs the system integrators\n";
+			return;
+		}
+		stop_simulation_thread();
+		if (simulation_thread.Playing_Back())
+		{
+			simulation_thread.Clear_Ephemeris();
+			std::cout << "\nEphemeris playback off: integrating from here\n";
+		}
+		else
+		{
+			Ephemeris e;
+			if (e.Read(ephemeris_path()))
+			{
+				for (Body* b : orbiting_bodies)
+				{
+					bind_ephemeris(e, b);
+				}
+				e.Set_Start(timeSinceStart / 1000);
+				simulation_thread.Set_Ephemeris(e);
+				std::cout << "\nPlaying back " << ephemeris_path() << ": " << e.Get_Span() / (86400 * 365.25) << " years, " << e.Bytes() / 1E6 << " MB\n";
+			}
+		}
+		start_simulation_thread();
+	}
+
+	Body* inspected_body()
+	{
+		for (Body* b : orbiting_bodies)
+		{
+			if (b->Is_Inspected())
+			{
+				return b;
+			}
+		}
+		return NULL;
+	}
+
+	// A ring around the inspected body, or a belt between Mars and Jupiter if none is. A count of 0 clears them.
+	void add_particles()
+	{
+		if (!use_system_integrator)
+		{
+			std::cout << "\nTest particles need the system integrators\n";
+			return;
+		}
+		if (particle_count <= 0)
+		{
+			simulation_thread.Send(PhysicsCommand::CLEAR_PARTICLES, 0);
+			std::cout << "\nTest particles cleared\n";
+			return;
+		}
+
+		const double pi = 3.14159265358979323846;
+		const double AU = 1.496E11;
+		PhysicsCommand c;
+		c.value = (int)particle_count;
+		c.b = { 0, (double)particle_seed++, 0 };
+		Body* b = inspected_body();
+		if (b != NULL && b->Get_Handle() != -1)
+		{
+			double radius = physics_store.radius[physics_store.Slot(b->Get_Handle())];
+			c.type = PhysicsCommand::ADD_RING;
+			c.handle = b->Get_Handle();
+			c.a = { 2 * radius, 4 * radius, radius / 100 };
+			std::cout << "\nAdding " << (int)particle_count << " ring particles around " << b->name << "\n";
+		}
+		else
+		{
+			c.type = PhysicsCommand::ADD_BELT;
+			c.value2 = Sun.mu;
+			c.a = { 2.1 * AU, 3.3 * AU, 0.2 };
+			c.b.x = 10 * pi / 180;
+			std::cout << "\nAdding " << (int)particle_count << " belt particles\n";
+		}
+		simulation_thread.Send(c);
+	}
+
+	// Test particles as points, turned by the camera's rotation once as a matrix rather than point by point
+	void draw_particles()
+	{
+		if (!use_system_integrator)
+		{
+			return;
+		}
+		const ParticleFrame& f = simulation_thread.Latest_Particles();
+		int n = f.x.size();
+		if (n == 0)
+		{
+			return;
+		}
+		double m[9];
+		gCamera.Rotation_Matrix(m);
+		vector3 screen_dimensions = graphyte.Get_Screen_Dimensions();
+		double height = screen_dimensions.x; // Matches what the bodies pass to WorldSpaceToScreenSpace
+		vector3 eye = gCamera.position;
+		for (int i = 0; i < n; i++)
+		{
+			double x = f.x[i], y = f.y[i], z = f.z[i];
+			double pz = m[6] * x + m[7] * y + m[8] * z - eye.z;
+			if (pz < gCamera.clipping_z)
+			{
+				continue;
+			}
+			double px = m[0] * x + m[1] * y + m[2] * z - eye.x;
+			double py = m[3] * x + m[4] * y + m[5] * z - eye.y;
+			graphyte.particle((int)(px / pz * height), (int)(py / pz * height));
+		}
+	}
+
+	// Log the inspected body's apsides and nodes (about its parent, or the Sun) as they happen, or with none inspected, stop
+	void watch_events()
+	{
+		if (!use_system_integrator)
+		{
+			std::cout << "\nEvents need the system integrators\n";
+			return;
+		}
+		stop_simulation_thread(); // Events can only be changed while it's stopped
+		EventDetector& events = simulation_thread.Get_Events();
+		Body* b = inspected_body();
+		if (b == NULL || b->Get_Handle() == -1)
+		{
+			events.Clear();
+			std::cout << "\nNo longer watching for events\n";
+		}
+		else
+		{
+			int about = physics_store.parent[physics_store.Slot(b->Get_Handle())];
+			events.Add_Apsides(b->name, b->Get_Handle(), about);
+			events.Add_Plane_Crossing(b->name, b->Get_Handle(), { 0, 0, 1 }, about);
+			std::cout << "\nWatching for " << b->name << "'s apsides and nodes\n";
+		}
+		start_simulation_thread();
+	}
+
+	void cycle_timeline_retention()
+	{
+		timeline_retention = (timeline_retention + 1) % Timeline::RETENTION_COUNT;
+		std::cout << "\nTimeline retention: " << Timeline::Retention_Name((Timeline::Retention)timeline_retention) << "\n";
+	}
+
+	void apply_timeline_budget()
+	{
+		timeline_budget_mb = std::max(0.0, timeline_budget_mb);
+		std::cout << "\nTimeline memory: " << timeline_budget_mb << " MB\n";
+	}
+
+	void toggle_force_mode()
+	{
+		use_barnes_hut = !use_barnes_hut;
+		std::cout << "\nForce mode: " << (use_barnes_hut ? "Barnes-Hut" : "Direct Sum") << "\n";
+	}
+
 	void toggle_pause()
 	{
 		if (time_scale == 0)
@@ -282,13 +851,13 @@ private:
 	// Add orbit with given OrbitBodyData
 	void add_specific_orbit(OrbitBodyData data)
 	{
-		orbiting_bodies.push_back(new Body(data.name, data.center, data.mass, data.scale, data.velocity, Sun.mu, graphyte, false));
+		orbiting_bodies.push_back(new Body(data.name, data.center, data.mass, data.scale, data.velocity, Sun.mu, graphyte, physics_store, false));
 	}
 
 	// Add general orbit with generic parameters
 	void add_orbit_body()
 	{
-		orbiting_bodies.push_back(new Body("New Orbit", { 0, 5.8E10, 0 }, 3.285E23, 2.44E6, { 47000, 0, 0 }, Sun.mu, graphyte, false));
+		orbiting_bodies.push_back(new Body("New Orbit", { 0, 5.8E10, 0 }, 3.285E23, 2.44E6, { 47000, 0, 0 }, Sun.mu, graphyte, physics_store, false));
 	}
 
 	void save()
@@ -307,7 +876,7 @@ private:
 		}
 
 		// Encapsulate all simulation data
-		SimulationData sd = { Sun.mass, Sun.scale, obc, gCamera.position };
+		SimulationData sd = { Sun.mass, Sun.scale, obc, gCamera.position, (double)integration_method };
 
 		// Write to .orbyte file
 		data_controller.WriteDataToFile(sd, to_save, path_source);
@@ -326,6 +895,16 @@ private:
 		std::cout << "\n Sun mass: " << Sun.mass;
 		Sun.scale = new_sd.cb_scale;
 		gCamera.position = new_sd.c_pos;
+		integration_method = (int)new_sd.integration_method;
+		if (integration_method < 0 || integration_method >= SystemIntegrator::METHOD_COUNT)
+		{
+			integration_method = SystemIntegrator::RK4;
+		}
+		if (!use_system_integrator)
+		{
+			use_system_integrator = true;
+			start_simulation_thread(); // Before the old orbits go, so the thread hears about it
+		}
 
 		// Clear Old Orbits
 		for (Body* old_orbit : orbiting_bodies)
@@ -376,7 +955,7 @@ public:
 			//Body mercury = Body("Mercury", { 0, 5.8E10, 0 }, 3.285E23, 2.44E6, { 47000, 0, 0 }, Sun, graphyte, false);
 			//Body venus = Body("Venus", { 0, 1E11, 0 }, 6E6, { 35000, 0, 0 }, Sun, graphyte, false);
 
-			Body earth = Body("Earth", {0, 1.49E11, 0}, 5.97E24, 6.37E6, { 30000, 0, 0 }, Sun.mu, graphyte, false);
+			Body earth = Body("Earth", {0, 1.49E11, 0}, 5.97E24, 6.37E6, { 30000, 0, 0 }, Sun.mu, graphyte, physics_store, false);
 			std::cout << earth.DebugBody();
 			//Name: "Earth"
 			//Radius of orbit: 1.49E11
@@ -417,19 +996,37 @@ public:
 			Text* text_Vertex_Count_Display = graphyte.CreateText("Vertices", 10);
 			Simulation_Parameters.Add_Stacked_Element(text_Vertex_Count_Display);
 
+			Text* text_Force_Mode_Display = graphyte.CreateText("Force Mode", 10);
+			Simulation_Parameters.Add_Stacked_Element(text_Force_Mode_Display);
+
+			Text* text_Integrator_Display = graphyte.CreateText("Integrator", 10);
+			Simulation_Parameters.Add_Stacked_Element(text_Integrator_Display);
+
+			Text* text_Kernel_Display = graphyte.CreateText("Gravity Kernel", 10);
+			Simulation_Parameters.Add_Stacked_Element(text_Kernel_Display);
+
 			Text* text_cl = graphyte.CreateText("__________________\nCLOCK\n__________________", 24);
 			Simulation_Parameters.Add_Stacked_Element(text_cl);
 
 			Text* text_time_Display = graphyte.CreateText("Time: ", 10);
 			Simulation_Parameters.Add_Stacked_Element(text_time_Display);
 
+			Text* text_Timeline_Display = graphyte.CreateText("Timeline", 10);
+			Simulation_Parameters.Add_Stacked_Element(text_Timeline_Display);
+
+			Simulation_Parameters.Add_Stacked_Element(graphyte.CreateText("Go To Time [days, warps past the end]: ", 10));
+			DoubleFieldValue SeekFV(&seek_days, [this]() { this->apply_seek(); });
+			TextField* tf = new TextField({ 0, 0, 0 }, SeekFV, graphyte, std::to_string(seek_days));
+			graphyte.text_fields.push_back(tf);
+			Simulation_Parameters.Add_Inline_Element(tf);
+
 			Text* text_sp = graphyte.CreateText("__________________\nSIMULATION PARAMETERS\n__________________", 24);
 			Simulation_Parameters.Add_Stacked_Element(text_sp);
 
 			//Testing input fields I guess
 			Simulation_Parameters.Add_Stacked_Element(graphyte.CreateText("Time Scale [0.1 | 1 | 86400]: ", 10));
 			DoubleFieldValue TimeScaleFV(&time_scale);
-			TextField* tf = new TextField({ 10,10,0 }, TimeScaleFV, graphyte, std::to_string(time_scale));
+			tf = new TextField({ 10,10,0 }, TimeScaleFV, graphyte, std::to_string(time_scale));
 			graphyte.text_fields.push_back(tf);
 			Simulation_Parameters.Add_Inline_Element(tf);
 			
@@ -445,6 +1042,68 @@ public:
 			graphyte.text_fields.push_back(tf);
 			Simulation_Parameters.Add_Inline_Element(tf);
 
+			worker_threads = std::max(0, (int)std::thread::hardware_concurrency() - 1); // Leave a core for rendering
+			apply_worker_threads();
+			Simulation_Parameters.Add_Stacked_Element(graphyte.CreateText("Worker Threads [0 = off]: ", 10));
+			DoubleFieldValue WorkerThreadsFV(&worker_threads, [this]() { this->apply_worker_threads(); });
+			tf = new TextField({ 0, 0, 0 }, WorkerThreadsFV, graphyte, std::to_string((int)worker_threads));
+			graphyte.text_fields.push_back(tf);
+			Simulation_Parameters.Add_Inline_Element(tf);
+
+			Simulation_Parameters.Add_Stacked_Element(graphyte.CreateText("Opening Angle [0 = exact | 0.5 | 1] (B to toggle): ", 10));
+			DoubleFieldValue OpeningAngleFV(&opening_angle);
+			tf = new TextField({ 0, 0, 0 }, OpeningAngleFV, graphyte, std::to_string(opening_angle));
+			graphyte.text_fields.push_back(tf);
+			Simulation_Parameters.Add_Inline_Element(tf);
+
+			Simulation_Parameters.Add_Stacked_Element(graphyte.CreateText("Softening Length [m, 0 = off]: ", 10));
+			DoubleFieldValue SofteningFV(&softening, [this]() { this->apply_softening(); });
+			tf = new TextField({ 0, 0, 0 }, SofteningFV, graphyte, std::to_string(softening));
+			graphyte.text_fields.push_back(tf);
+			Simulation_Parameters.Add_Inline_Element(tf);
+
+			Simulation_Parameters.Add_Stacked_Element(graphyte.CreateText("Physics Rate [steps/s]: ", 10));
+			DoubleFieldValue PhysicsRateFV(&physics_rate, [this]() { this->apply_physics_rate(); });
+			tf = new TextField({ 0, 0, 0 }, PhysicsRateFV, graphyte, std::to_string((int)physics_rate));
+			graphyte.text_fields.push_back(tf);
+			Simulation_Parameters.Add_Inline_Element(tf);
+
+			Simulation_Parameters.Add_Stacked_Element(graphyte.CreateText("Adaptive Tolerance [10^x, e.g. -9]: ", 10));
+			DoubleFieldValue ToleranceFV(&tolerance_exponent, [this]() { this->apply_tolerance(); });
+			tf = new TextField({ 0, 0, 0 }, ToleranceFV, graphyte, std::to_string((int)tolerance_exponent));
+			graphyte.text_fields.push_back(tf);
+			Simulation_Parameters.Add_Inline_Element(tf);
+
+			Simulation_Parameters.Add_Stacked_Element(graphyte.CreateText("Center Body J2 [Sun 0.0000002 | Earth 0.00108263] (F for forces): ", 10));
+			DoubleFieldValue CentreJ2FV(&central_j2);
+			tf = new TextField({ 0, 0, 0 }, CentreJ2FV, graphyte, std::to_string(central_j2));
+			graphyte.text_fields.push_back(tf);
+			Simulation_Parameters.Add_Inline_Element(tf);
+
+			Simulation_Parameters.Add_Stacked_Element(graphyte.CreateText("Satellite Drag [Cd * area / mass, m^2/kg]: ", 10));
+			DoubleFieldValue DragFV(&drag_ballistic);
+			tf = new TextField({ 0, 0, 0 }, DragFV, graphyte, std::to_string(drag_ballistic));
+			graphyte.text_fields.push_back(tf);
+			Simulation_Parameters.Add_Inline_Element(tf);
+
+			Simulation_Parameters.Add_Stacked_Element(graphyte.CreateText("Satellite Radiation Pressure [area / mass, m^2/kg]: ", 10));
+			DoubleFieldValue RadiationFV(&radiation_area_to_mass);
+			tf = new TextField({ 0, 0, 0 }, RadiationFV, graphyte, std::to_string(radiation_area_to_mass));
+			graphyte.text_fields.push_back(tf);
+			Simulation_Parameters.Add_Inline_Element(tf);
+
+			Simulation_Parameters.Add_Stacked_Element(graphyte.CreateText("Test Particles [count, P to add, 0 to clear]: ", 10));
+			DoubleFieldValue ParticleCountFV(&particle_count);
+			tf = new TextField({ 0, 0, 0 }, ParticleCountFV, graphyte, std::to_string((int)particle_count));
+			graphyte.text_fields.push_back(tf);
+			Simulation_Parameters.Add_Inline_Element(tf);
+
+			Simulation_Parameters.Add_Stacked_Element(graphyte.CreateText("Timeline Memory [MB]: ", 10));
+			DoubleFieldValue TimelineBudgetFV(&timeline_budget_mb, [this]() { this->apply_timeline_budget(); });
+			tf = new TextField({ 0, 0, 0 }, TimelineBudgetFV, graphyte, std::to_string((int)timeline_budget_mb));
+			graphyte.text_fields.push_back(tf);
+			Simulation_Parameters.Add_Inline_Element(tf);
+
 
 			/*
 				PATH TO OPEN FROM FILE
@@ -476,27 +1135,87 @@ public:
 			FunctionButton Open([this]() { this->open(); }, { (SCREEN_WIDTH / 2) - 25, (SCREEN_HEIGHT / 2) - 130, 0 }, { 25, 25, 0 }, graphyte, "icons/open.png");
 			graphyte.function_buttons.push_back(&Open);
 
+			if (use_system_integrator)
+			{
+				start_simulation_thread();
+			}
+
 			//Mainloop time 
+			startTime = SDL_GetPerformanceCounter();
 			while (!quit)
 			{
 				//GRAPHICS 
 				//gCamera.position = { earth.Get_Position().x, earth.Get_Position().y, gCamera.position.z };
 				//render sun
-				Sun.Draw(graphyte, gCamera);
+				if (!warping)
+				{
+					Sun.Draw(graphyte, gCamera);
+				}
 
 				clean_orbit_queue(); // Check if any orbits in the vector are scheduled for deletion.
+
+				physics_substeps = 0;
+				if (use_system_integrator)
+				{
+					push_settings();
+					const SimulationSnapshot& snapshot = simulation_thread.Latest();
+					if (snapshot.commands_applied == simulation_thread.Commands_Sent()) // Else it hasn't made our latest edits yet: keep our copy a little longer
+					{
+						physics_store.Assign_State(snapshot.state);
+						timeSinceStart = snapshot.simulated_seconds * 1000;
+						timeline_start = snapshot.timeline_start;
+						timeline_end = snapshot.timeline_end;
+						warping = snapshot.warping;
+						warp_from = snapshot.warp_from;
+						warp_to = snapshot.warp_to;
+						if (!warping && (time_scale != 0 || snapshot.simulated_seconds != synced_seconds))
+						{
+							sync_views(snapshot);
+						}
+					}
+				}
+				else if (time_scale == 0)
+				{
+					physics_accumulator = 0;
+				}
+				else
+				{
+					// Legacy path: simulate last frame's real time in whole physics steps, carrying what's left over into the next frame
+					Octree* tree = NULL;
+					if (use_barnes_hut)
+					{
+						gravity_tree.theta = opening_angle;
+						tree = &gravity_tree;
+					}
+
+					physics_accumulator += deltaTime;
+					while (physics_accumulator >= physics_step_ms && physics_substeps < MAX_PHYSICS_SUBSTEPS)
+					{
+						physics_step(tree);
+						physics_accumulator -= physics_step_ms;
+						physics_substeps++;
+					}
+					if (physics_accumulator >= physics_step_ms)
+					{
+						physics_accumulator = fmod(physics_accumulator, physics_step_ms); // Too far behind => drop the backlog
+					}
+					timeSinceStart += (physics_substeps * physics_step_ms * time_scale); // Simulated time, not frame time
+				}
 				
-				for (Body* b : orbiting_bodies)
+				if (!warping) // Nothing to see until it gets there
 				{
-					b->Update_Body(deltaTime, time_scale, &orbiting_bodies); // Update body
-					//std::cout << "\n" + b->Get_Position().Debug();
-					if (b->snap_camera)
+					for (Body* b : orbiting_bodies)
 					{
-						vector3 cam_pos = b->Get_Position();
-						gCamera.position.x = cam_pos.x;
-						gCamera.position.y = cam_pos.y;
+						//std::cout << "\n" + b->Get_Position().Debug();
+						if (b->snap_camera)
+						{
+							vector3 cam_pos = b->Get_Position();
+							gCamera.position.x = cam_pos.x;
+							gCamera.position.y = cam_pos.y;
+						}
+						b->Draw(graphyte, gCamera); // Draw the body
 					}
-					b->Draw(graphyte, gCamera); // Draw the body
+					draw_particles();
 				}
 
 				double debug_no_pixels = graphyte.Get_Number_Of_Points();
@@ -558,6 +1277,110 @@ public:
 							commit_to_text_field();
 							break;
 
+						case SDLK_i:
+							if (graphyte.active_text_field == NULL) // Don't toggle while typing
+							{
+								cycle_integrator();
+							}
+							break;
+
+						case SDLK_k:
+							if (graphyte.active_text_field == NULL) // Don't toggle while typing
+							{
+								std::cout << "\nGravity kernel: " << GravityKernel::Name(GravityKernel::Cycle_Level()) << "\n";
+							}
+							break;
+
+						case SDLK_a:
+							if (graphyte.active_text_field == NULL) // Don't toggle while typing
+							{
+								for (Body* b : orbiting_bodies)
+								{
+									if (b->Is_Inspected())
+									{
+										b->Toggle_Analytic();
+									}
+								}
+							}
+							break;
+
+						case SDLK_r:
+							if (graphyte.active_text_field == NULL) // Don't toggle while typing
+							{
+								toggle_regularization();
+							}
+							break;
+
+						case SDLK_c:
+							if (graphyte.active_text_field == NULL) // Don't toggle while typing
+							{
+								cycle_collision_response();
+							}
+							break;
+
+						case SDLK_e:
+							if (graphyte.active_text_field == NULL) // Don't toggle while typing
+							{
+								toggle_ephemeris();
+							}
+							break;
+
+						case SDLK_ESCAPE:
+							if (warping)
+							{
+								simulation_thread.Send(PhysicsCommand::CANCEL_WARP, 0);
+							}
+							break;
+
+						case SDLK_v:
+							if (graphyte.active_text_field == NULL) // Don't toggle while typing
+							{
+								watch_events();
+							}
+							break;
+
+						case SDLK_p:
+							if (graphyte.active_text_field == NULL) // Don't add while typing
+							{
+								add_particles();
+							}
+							break;
+
+						case SDLK_f:
+							if (graphyte.active_text_field == NULL) // Don't toggle while typing
+							{
+								cycle_force_models();
+							}
+							break;
+
+						case SDLK_t:
+							if (graphyte.active_text_field == NULL) // Don't toggle while typing
+							{
+								cycle_timeline_retention();
+							}
+							break;
+
+						case SDLK_LEFTBRACKET:
+							if (graphyte.active_text_field == NULL)
+							{
+								scrub(-1);
+							}
+							break;
+
+						case SDLK_RIGHTBRACKET:
+							if (graphyte.active_text_field == NULL)
+							{
+								scrub(1);
+							}
+							break;
+
+						case SDLK_b:
+							if (graphyte.active_text_field == NULL) // Don't toggle while typing
+							{
+								toggle_force_mode();
+							}
+							break;
+
 						case SDLK_UP:
 							//Rotate Up
 							gCamera.RotateCamera({ 0.01, 0, 0 });
@@ -618,24 +1441,48 @@ public:
 
 				//DELAY UNTIL END
 				deltaTime = Update_Clock(); // get new delta
-				float interval = (float)1000 / MAX_FPS; // Intended interval (capped FPS)
-				if (deltaTime < (Uint32)interval) // If simulation is updating too quickly
+				double interval = warping ? WARP_FRAME_MS : (double)1000 / MAX_FPS; // Intended interval (capped FPS)
+				if (deltaTime < interval) // If simulation is updating too quickly
 				{
-					Uint32 delay = (Uint32)interval - deltaTime;
+					Uint32 delay = (Uint32)(interval - deltaTime);
 					if (delay > 0)
 					{
 						SDL_Delay(delay); // Delay to pad out frame duration and limit FPS
-						deltaTime += delay;
+						deltaTime += Update_Clock(); // Measure how long the delay really was (and don't count it again next frame)
 					}
 				}
 
 				/*DEBUG*/
 				float debug_fps = (float)1000 / ((float)deltaTime + 1);
-				text_FPS_Display->Set_Text("FPS: " + std::to_string(debug_fps));
 				text_Vertex_Count_Display->Set_Text("Vertex Count: " + std::to_string(debug_no_pixels));
+				if (use_system_integrator)
+				{
+					const SimulationSnapshot& stats = simulation_thread.Latest(); // Statistics come from the simulation thread
+					text_FPS_Display->Set_Text("FPS: " + std::to_string(debug_fps) + " | Physics (own thread): " + std::to_string(stats.steps) + " steps per snapshot at " + std::to_string((int)physics_rate) + " steps/s");
+					text_Force_Mode_Display->Set_Text((use_barnes_hut ? "Force Mode: Barnes-Hut (" + std::to_string(stats.tree_nodes) + " nodes)" : "Force Mode: Direct Sum") + " | Collisions (C): " + collision_status(stats.collisions) + (stats.particles > 0 ? " | Test Particles: " + std::to_string(stats.particles) : ""));
+					text_Kernel_Display->Set_Text("Gravity Kernel (K): " + GravityKernel::Name(GravityKernel::Get_Level()) + ", " + std::to_string(stats.interactions_per_second / 1E6) + "M interactions/s");
+					text_Timeline_Display->Set_Text("Timeline ([ ] to scrub, T): " + std::to_string(stats.timeline_start / 86400) + " to " + std::to_string(stats.timeline_end / 86400) + " days, " + std::to_string(stats.checkpoints) + " checkpoints every " + std::to_string(stats.checkpoint_interval) + " steps, " + std::to_string(stats.timeline_bytes / 1000000.0) + " MB, " + Timeline::Retention_Name((Timeline::Retention)timeline_retention) + " | Events (V): " + std::to_string(stats.events) + (stats.events > 0 ? ", last " + stats.last_event : ""));
+					text_Integrator_Display->Set_Text((stats.playback ? "Ephemeris playback (E) | " : "") + std::string("Integrator (I): ") + integrator_name() + ", " + std::to_string(stats.force_evaluations) + " force / " + std::to_string(stats.pair_evaluations) + " pair evaluations per step, " + std::to_string(stats.workers) + " workers, " + SelectableIntegrator::Forces_Name((SelectableIntegrator::Forces)stats.force_models) + " (F)" + (integration_method == SystemIntegrator::DOPRI5 ? ", " + std::to_string(stats.accepted_substeps) + " substeps (" + std::to_string(stats.rejected_substeps) + " rejected)" : "") + (integration_method == SystemIntegrator::HERMITE ? ", " + std::to_string(stats.accepted_substeps) + " block steps" : "") + (regularize ? ", " + std::to_string(stats.encounters) + " close pairs (R)" : "") + (AllocationCounter::Enabled() ? ", " + std::to_string(stats.step_allocations) + " allocations/step" : ""));
+				}
+				else
+				{
+					text_FPS_Display->Set_Text("FPS: " + std::to_string(debug_fps) + " | Physics: " + std::to_string(physics_substeps) + " steps this frame at " + std::to_string((int)physics_rate) + " steps/s");
+					text_Force_Mode_Display->Set_Text((use_barnes_hut ? "Force Mode: Barnes-Hut (" + std::to_string(gravity_tree.Get_Node_Count()) + " nodes)" : "Force Mode: Direct Sum") + " | Collisions (C): " + collision_status(collisions.Get_Last_Collisions()));
+					text_Kernel_Display->Set_Text("Gravity Kernel (K): " + GravityKernel::Name(GravityKernel::Get_Level()) + ", " + std::to_string(GravityKernel::Interactions_Per_Second() / 1E6) + "M interactions/s");
+					GravityKernel::Reset_Stats(); // Per frame figure
+					text_Integrator_Display->Set_Text("Integrator (I): Sequential RK4");
+					text_Timeline_Display->Set_Text("Timeline: system integrators only");
+				}
 
-				timeSinceStart += ((double)deltaTime * time_scale);
-				text_time_Display->Set_Text("Time: " + std::to_string((timeSinceStart) / (1000 * 60 * 60 * 24)) + "days");
+				if (warping)
+				{
+					double progress = warp_to > warp_from ? (timeSinceStart / 1000 - warp_from) / (warp_to - warp_from) : 1;
+					text_time_Display->Set_Text("Warping to " + std::to_string(warp_to / 86400) + " days: " + std::to_string((int)(100 * progress)) + "% (Esc to cancel) | Time: " + std::to_string((timeSinceStart) / (1000 * 60 * 60 * 24)) + "days");
+				}
+				else
+				{
+					text_time_Display->Set_Text("Time: " + std::to_string((timeSinceStart) / (1000 * 60 * 60 * 24)) + "days");
+				}
 			}
 
 		}
@@ -0,0 +1,502 @@
+#pragma once
+#ifndef PHYSICSSTATE_H
+#define PHYSICSSTATE_H
+
+#include <vector>
+#include <string>
+#include <cmath>
+#include <algorithm>
+#include "vec3.h"
+#include "CommandQueue.h"
+#include "Kepler.h"
+
+/*
+	Bodies that move along a fixed Keplerian ellipse around the central body instead of being integrated ("analytic" bodies).
+	Their orbit is worked out once, when they are switched over, and after that a step of any length is one solve of Kepler's
+	equation: time warps of years a frame cost no more than a second. They still pull on everything else, but nothing pulls
+	back, so this is for bodies whose perturbations don't matter to the user.
+
+	Packed (not slot indexed), so Advance runs Kepler::Solve_Batch over contiguous arrays of just the analytic bodies.
+*/
+struct KeplerOrbits
+{
+	std::vector<int> handle;
+	std::vector<double> mean_anomaly; // rad, kept in [-pi, pi)
+	std::vector<double> mean_motion; // rad/s
+	std::vector<double> e;
+	std::vector<double> px, py, pz; // Towards periapsis, length a
+	std::vector<double> qx, qy, qz; // 90 degrees ahead of P, length b
+
+	// Scratch for Advance
+	std::vector<double> E, sin_E, cos_E;
+
+	int Size()
+	{
+		return handle.size();
+	}
+
+	int Find(int _handle)
+	{
+		for (int i = 0; i < Size(); i++)
+		{
+			if (handle[i] == _handle)
+			{
+				return i;
+			}
+		}
+		return -1;
+	}
+
+	/// <summary>
+	/// Work out (or work out again) the ellipse a body is on, from its state now.
+	/// </summary>
+	/// <returns>false if it isn't on a bound orbit around the central body, in which case it's left out</returns>
+	bool Set(int _handle, double mu, vector3 r, vector3 v)
+	{
+		double n, ecc, M;
+		vector3 P, Q;
+		if (!Kepler::Ellipse(mu, r, v, n, ecc, M, P, Q))
+		{
+			Remove(_handle);
+			return false;
+		}
+
+		int i = Find(_handle);
+		if (i < 0)
+		{
+			i = Size();
+			handle.push_back(_handle);
+			mean_anomaly.push_back(0); mean_motion.push_back(0); e.push_back(0);
+			px.push_back(0); py.push_back(0); pz.push_back(0);
+			qx.push_back(0); qy.push_back(0); qz.push_back(0);
+			E.push_back(0); sin_E.push_back(0); cos_E.push_back(0);
+		}
+		mean_anomaly[i] = M; mean_motion[i] = n; e[i] = ecc;
+		px[i] = P.x; py[i] = P.y; pz[i] = P.z;
+		qx[i] = Q.x; qy[i] = Q.y; qz[i] = Q.z;
+		return true;
+	}
+
+	void Remove(int _handle)
+	{
+		int i = Find(_handle);
+		if (i < 0)
+		{
+			return;
+		}
+		int last = Size() - 1;
+		handle[i] = handle[last];
+		mean_anomaly[i] = mean_anomaly[last]; mean_motion[i] = mean_motion[last]; e[i] = e[last];
+		px[i] = px[last]; py[i] = py[last]; pz[i] = pz[last];
+		qx[i] = qx[last]; qy[i] = qy[last]; qz[i] = qz[last];
+
+		handle.pop_back();
+		mean_anomaly.pop_back(); mean_motion.pop_back(); e.pop_back();
+		px.pop_back(); py.pop_back(); pz.pop_back();
+		qx.pop_back(); qy.pop_back(); qz.pop_back();
+		E.pop_back(); sin_E.pop_back(); cos_E.pop_back();
+	}
+
+	/// <summary>
+	/// Move every analytic body dt seconds along its orbit, and solve for where that puts it (into E, sin_E and cos_E).
+	/// </summary>
+	void Advance(double dt)
+	{
+		const double pi = 3.14159265358979323846;
+		int n = Size();
+		for (int i = 0; i < n; i++)
+		{
+			double M = fmod(mean_anomaly[i] + mean_motion[i] * dt + pi, 2 * pi); // Whole orbits change nothing
+			mean_anomaly[i] = (M < 0 ? M + 2 * pi : M) - pi;
+		}
+		Kepler::Solve_Batch(mean_anomaly.data(), e.data(), E.data(), sin_E.data(), cos_E.data(), n);
+	}
+};
+
+/*
+	Structure of arrays store for the physics state of every body in the simulation.
+
+	A Body is mostly GUI (labels, inspector, text fields, mesh), so walking a std::vector<Body*> in the force loop drags all
+	of that through the cache to read six doubles. Here each component lives in its own contiguous array, so the integrator
+	and the force kernels stream straight through x[], y[], z[] ... and nothing else.
+
+	Bodies hold a handle rather than a slot: removing a body swaps the last slot into the hole, so slots move but handles don't.
+
+	When the physics runs on its own thread, the GUI keeps its own copy of the store (refreshed from the simulation thread's
+	snapshots) and sets a journal: every edit made through the methods below is then also queued for the simulation thread to
+	make to the real thing. Handles are handed out the same way on both sides, so they agree as long as every edit is queued.
+*/
+struct PhysicsStore
+{
+	// Slot indexed state
+	std::vector<double> x, y, z; // Position (m)
+	std::vector<double> vx, vy, vz; // Velocity (m/s)
+	std::vector<double> ax, ay, az; // Most recently evaluated acceleration (m/s^2)
+	std::vector<double> gm; // G * mass of the body (what it pulls on everything else with)
+	std::vector<double> mu; // G * mass of whatever sits at the origin (the central body term this body feels)
+	std::vector<double> radius; // Size of the body, for collisions (m). 0 => a point, which never collides.
+	std::vector<int> parent; // Handle of the body this one is a satellite of, -1 for a body orbiting the central body
+
+	std::vector<int> handle_of_slot; // Slot -> handle
+	std::vector<int> slot_of_handle; // Handle -> slot, -1 once removed
+	std::vector<int> free_handles; // Handles available for reuse
+
+	// Bumped whenever a position, velocity or mass is changed from outside an integrator (the GUI, adding / removing bodies), so an
+	// integrator holding on to forces from last step knows they no longer match the system.
+	long long revision = 0;
+
+	// Plummer softening length (m) for the pull between bodies (not the central body's). 0 => exact point masses.
+	double softening = 0;
+
+	CommandQueue* journal = NULL; // Where to queue edits for the simulation thread, NULL if this store is the real thing
+
+	KeplerOrbits orbits; // Bodies on fixed orbits rather than integrated, by handle
+
+	/// <summary>
+	/// Copy another store's state (not its journal). Vectors reuse their capacity, so once sizes settle this doesn't allocate.
+	/// </summary>
+	void Assign_State(const PhysicsStore& other)
+	{
+		x = other.x; y = other.y; z = other.z;
+		vx = other.vx; vy = other.vy; vz = other.vz;
+		ax = other.ax; ay = other.ay; az = other.az;
+		gm = other.gm;
+		mu = other.mu;
+		radius = other.radius;
+		parent = other.parent;
+		handle_of_slot = other.handle_of_slot;
+		slot_of_handle = other.slot_of_handle;
+		free_handles = other.free_handles;
+		revision = other.revision;
+		softening = other.softening;
+
+		orbits.handle = other.orbits.handle;
+		orbits.mean_anomaly = other.orbits.mean_anomaly; orbits.mean_motion = other.orbits.mean_motion; orbits.e = other.orbits.e;
+		orbits.px = other.orbits.px; orbits.py = other.orbits.py; orbits.pz = other.orbits.pz;
+		orbits.qx = other.orbits.qx; orbits.qy = other.orbits.qy; orbits.qz = other.orbits.qz;
+		orbits.E.resize(orbits.Size()); orbits.sin_E.resize(orbits.Size()); orbits.cos_E.resize(orbits.Size());
+	}
+
+	// Queue an edit to a body for the simulation thread, if there is one
+	void Journal(PhysicsCommand::Type type, int handle, vector3 a = { 0, 0, 0 }, vector3 b = { 0, 0, 0 }, double value = 0, double value2 = 0)
+	{
+		if (journal == NULL)
+		{
+			return;
+		}
+		PhysicsCommand c;
+		c.type = type;
+		c.handle = handle;
+		c.a = a;
+		c.b = b;
+		c.value = value;
+		c.value2 = value2;
+		journal->Push(c);
+	}
+
+	int Size()
+	{
+		return x.size();
+	}
+
+	int Slot(int handle)
+	{
+		return slot_of_handle[handle];
+	}
+
+	/// <summary>
+	/// Add a body. Returns its handle.
+	/// </summary>
+	/// <param name="requested">Handle to give it, -1 for the next free one. The simulation thread takes the GUI's choice,
+	/// so the two stores' handles agree even when the simulation has removed bodies (collisions) the GUI hasn't heard about.</param>
+	int Add(vector3 position, vector3 velocity, double _gm, double _mu, int requested = -1)
+	{
+		int handle;
+		if (requested >= 0)
+		{
+			handle = requested;
+			while ((int)slot_of_handle.size() <= handle)
+			{
+				free_handles.push_back(slot_of_handle.size());
+				slot_of_handle.push_back(-1);
+			}
+			free_handles.erase(std::remove(free_handles.begin(), free_handles.end(), handle), free_handles.end());
+		}
+		else if (!free_handles.empty())
+		{
+			handle = free_handles.back();
+			free_handles.pop_back();
+		}
+		else
+		{
+			handle = slot_of_handle.size();
+			slot_of_handle.push_back(-1);
+		}
+
+		slot_of_handle[handle] = Size();
+		handle_of_slot.push_back(handle);
+
+		x.push_back(position.x); y.push_back(position.y); z.push_back(position.z);
+		vx.push_back(velocity.x); vy.push_back(velocity.y); vz.push_back(velocity.z);
+		ax.push_back(0); ay.push_back(0); az.push_back(0);
+		gm.push_back(_gm);
+		mu.push_back(_mu);
+		radius.push_back(0);
+		parent.push_back(-1);
+		revision++;
+		Journal(PhysicsCommand::ADD_BODY, handle, position, velocity, _gm, _mu);
+
+		return handle;
+	}
+
+	void Remove(int handle)
+	{
+		int slot = slot_of_handle[handle];
+		if (slot < 0)
+		{
+			return; // Already gone
+		}
+
+		int last = Size() - 1;
+		if (slot != last)
+		{
+			// Move the last body into the hole
+			x[slot] = x[last]; y[slot] = y[last]; z[slot] = z[last];
+			vx[slot] = vx[last]; vy[slot] = vy[last]; vz[slot] = vz[last];
+			ax[slot] = ax[last]; ay[slot] = ay[last]; az[slot] = az[last];
+			gm[slot] = gm[last];
+			mu[slot] = mu[last];
+			radius[slot] = radius[last];
+			parent[slot] = parent[last];
+			handle_of_slot[slot] = handle_of_slot[last];
+			slot_of_handle[handle_of_slot[slot]] = slot;
+		}
+
+		x.pop_back(); y.pop_back(); z.pop_back();
+		vx.pop_back(); vy.pop_back(); vz.pop_back();
+		ax.pop_back(); ay.pop_back(); az.pop_back();
+		gm.pop_back();
+		mu.pop_back();
+		radius.pop_back();
+		parent.pop_back();
+		handle_of_slot.pop_back();
+
+		slot_of_handle[handle] = -1;
+		free_handles.push_back(handle);
+		for (int i = 0; i < last; i++)
+		{
+			if (parent[i] == handle)
+			{
+				parent[i] = -1; // Its satellites go round the central body now, rather than whatever gets the handle next
+			}
+		}
+		orbits.Remove(handle);
+		revision++;
+		Journal(PhysicsCommand::REMOVE_BODY, handle);
+	}
+
+	//Accessors for code that thinks in vector3s (GUI, legacy per-body stepping)
+	vector3 Get_Position(int handle)
+	{
+		int s = Slot(handle);
+		return { x[s], y[s], z[s] };
+	}
+
+	vector3 Get_Velocity(int handle)
+	{
+		int s = Slot(handle);
+		return { vx[s], vy[s], vz[s] };
+	}
+
+	vector3 Get_Acceleration(int handle)
+	{
+		int s = Slot(handle);
+		return { ax[s], ay[s], az[s] };
+	}
+
+	void Set_Position(int handle, vector3 p)
+	{
+		int s = Slot(handle);
+		x[s] = p.x; y[s] = p.y; z[s] = p.z;
+		revision++;
+		Refresh_Orbit(handle);
+		Journal(PhysicsCommand::SET_POSITION, handle, p);
+	}
+
+	void Set_Velocity(int handle, vector3 v)
+	{
+		int s = Slot(handle);
+		vx[s] = v.x; vy[s] = v.y; vz[s] = v.z;
+		revision++; // Hermite's jerk and drag depend on it
+		Refresh_Orbit(handle);
+		Journal(PhysicsCommand::SET_VELOCITY, handle, v);
+	}
+
+	void Set_Acceleration(int handle, vector3 a)
+	{
+		int s = Slot(handle);
+		ax[s] = a.x; ay[s] = a.y; az[s] = a.z;
+	}
+
+	void Set_GM(int handle, double _gm)
+	{
+		gm[Slot(handle)] = _gm;
+		revision++;
+		Journal(PhysicsCommand::SET_GM, handle, { 0, 0, 0 }, { 0, 0, 0 }, _gm);
+	}
+
+	void Set_Mu(int handle, double _mu)
+	{
+		mu[Slot(handle)] = _mu;
+		revision++;
+		Refresh_Orbit(handle);
+		Journal(PhysicsCommand::SET_MU, handle, { 0, 0, 0 }, { 0, 0, 0 }, _mu);
+	}
+
+	// Size doesn't affect gravity, so this doesn't bump the revision
+	void Set_Radius(int handle, double _radius)
+	{
+		radius[Slot(handle)] = _radius;
+		Journal(PhysicsCommand::SET_RADIUS, handle, { 0, 0, 0 }, { 0, 0, 0 }, _radius);
+	}
+
+	/// <summary>
+	/// Soften the gravity between every pair of bodies, as if each were a fuzzy cloud this size (see GravityKernel).
+	/// </summary>
+	void Set_Softening(double length)
+	{
+		softening = length;
+		revision++;
+		Journal(PhysicsCommand::SET_SOFTENING, -1, { 0, 0, 0 }, { 0, 0, 0 }, length);
+	}
+
+	/// <summary>
+	/// Make a body a satellite of another, so it is integrated relative to it (see SystemIntegrator). -1 => no parent.
+	/// </summary>
+	void Set_Parent(int handle, int parent_handle)
+	{
+		parent[Slot(handle)] = parent_handle;
+		revision++;
+		Journal(PhysicsCommand::SET_PARENT, handle, { 0, 0, 0 }, { 0, 0, 0 }, parent_handle);
+	}
+
+	// Slot of the body in this slot's parent, -1 if it has none (or its parent has been removed)
+	int Parent_Slot(int slot)
+	{
+		int p = parent[slot];
+		return (p >= 0 && p < (int)slot_of_handle.size()) ? slot_of_handle[p] : -1;
+	}
+
+	// An analytic body was edited: its orbit has to be worked out again from the new state
+	void Refresh_Orbit(int handle)
+	{
+		if (orbits.Find(handle) >= 0)
+		{
+			orbits.Set(handle, mu[Slot(handle)], Get_Position(handle), Get_Velocity(handle)); // No longer bound => integrated again
+		}
+	}
+
+	bool Is_Analytic(int handle)
+	{
+		return orbits.Find(handle) >= 0;
+	}
+
+	/// <summary>
+	/// Switch a body between being integrated and following a fixed Keplerian orbit around the central body.
+	/// </summary>
+	/// <returns>Whether the body is analytic now. Only bound orbits can be.</returns>
+	bool Set_Analytic(int handle, bool analytic)
+	{
+		if (analytic)
+		{
+			orbits.Set(handle, mu[Slot(handle)], Get_Position(handle), Get_Velocity(handle));
+		}
+		else
+		{
+			orbits.Remove(handle);
+		}
+		Journal(PhysicsCommand::SET_ANALYTIC, handle, { 0, 0, 0 }, { 0, 0, 0 }, analytic ? 1 : 0);
+		return Is_Analytic(handle);
+	}
+
+	/// <summary>
+	/// Move the analytic bodies dt seconds along their orbits. Integrators call this; it isn't an edit, so nothing is journaled.
+	/// </summary>
+	void Advance_Analytic(double dt)
+	{
+		int n = orbits.Size();
+		if (n == 0)
+		{
+			return;
+		}
+		orbits.Advance(dt);
+
+		const KeplerOrbits& o = orbits;
+		for (int i = 0; i < n; i++)
+		{
+			int s = Slot(o.handle[i]);
+			double c = o.cos_E[i] - o.e[i], sn = o.sin_E[i];
+			x[s] = c * o.px[i] + sn * o.qx[i];
+			y[s] = c * o.py[i] + sn * o.qy[i];
+			z[s] = c * o.pz[i] + sn * o.qz[i];
+
+			double k = o.mean_motion[i] / (1 - o.e[i] * o.cos_E[i]); // dE/dt
+			vx[s] = k * (o.cos_E[i] * o.qx[i] - sn * o.px[i]);
+			vy[s] = k * (o.cos_E[i] * o.qy[i] - sn * o.py[i]);
+			vz[s] = k * (o.cos_E[i] * o.qz[i] - sn * o.pz[i]);
+
+			double r2 = x[s] * x[s] + y[s] * y[s] + z[s] * z[s];
+			double a = -mu[s] / (r2 * sqrt(r2));
+			ax[s] = x[s] * a; ay[s] = y[s] * a; az[s] = z[s] * a;
+		}
+	}
+};
+
+/*
+	Derivative of one body's state, d/dt (position, velocity). Fixed size, so integrator stages live on the stack.
+*/
+struct StateDerivative
+{
+	vector3 velocity; // d(position)/dt
+	vector3 acceleration; // d(velocity)/dt
+};
+
+/*
+	One body's state after a step, plus the acceleration it started the step with (for the inspector / arrows).
+*/
+struct StepResult
+{
+	vector3 position;
+	vector3 velocity;
+	vector3 acceleration;
+};
+
+/*
+	Scratch positions and velocities in the same layout, for integrator stages.
+*/
+struct StateBuffer
+{
+	std::vector<double> x, y, z;
+	std::vector<double> vx, vy, vz;
+
+	void Resize(int n)
+	{
+		x.resize(n); y.resize(n); z.resize(n);
+		vx.resize(n); vy.resize(n); vz.resize(n);
+	}
+};
+
+/*
+	Scratch vectors (accelerations) in the same layout.
+*/
+struct VectorBuffer
+{
+	std::vector<double> x, y, z;
+
+	void Resize(int n)
+	{
+		x.resize(n); y.resize(n); z.resize(n);
+	}
+};
+
+#endif /*PHYSICSSTATE_H*/
@@ -0,0 +1,172 @@
+#pragma once
+#ifndef SELECTABLEINTEGRATOR_H
+#define SELECTABLEINTEGRATOR_H
+
+#include <string>
+#include "SystemIntegrator.h"
+
+/*
+	A BasicSystemIntegrator whose force models can be picked at run time, for the simulation thread and the headless runner.
+
+	Force models are template parameters (see ForceModels.h), so each combination is its own integrator with its own fully
+	inlined force loop. This holds one of each combination on offer, already compiled, and a switch on the selected one
+	forwards each call to it: one branch per step, rather than one per body or per pair. Nothing inside a step ever asks
+	which models are on.
+
+	Settings (method, tolerances, regularisation, workers, model parameters) are kept here and handed to whichever integrator
+	is selected, so switching models keeps them. Only the selected integrator keeps worker threads. Switching resets the new
+	integrator (see BasicSystemIntegrator::Reset), so it starts afresh even if it was used before: no cached forces, no
+	previous state. Changing the model parameters has to be followed by Reset too.
+*/
+class SelectableIntegrator
+{
+public:
+	enum Forces
+	{
+		GRAVITY, // Point masses alone
+		J2, // + the central body's oblateness
+		DRAG, // + atmospheric drag on satellites
+		RADIATION, // + radiation pressure on satellites
+		ALL,
+		FORCES_COUNT
+	};
+
+private:
+	BasicSystemIntegrator<ForceModel<>> gravity;
+	BasicSystemIntegrator<ForceModel<J2Oblateness>> j2;
+	BasicSystemIntegrator<ForceModel<AtmosphericDrag>> drag;
+	BasicSystemIntegrator<ForceModel<RadiationPressure>> radiation;
+	BasicSystemIntegrator<ForceModel<J2Oblateness, AtmosphericDrag, RadiationPressure>> all;
+	Forces selected = GRAVITY;
+	int workers = 0;
+
+	// Call f with the selected integrator, whatever its type. f is generic, so each case is compiled for its own integrator.
+	template <class F>
+	auto Visit(F f) -> decltype(f(gravity))
+	{
+		switch (selected)
+		{
+		case J2: return f(j2);
+		case DRAG: return f(drag);
+		case RADIATION: return f(radiation);
+		case ALL: return f(all);
+		default: return f(gravity);
+		}
+	}
+
+public:
+	SystemIntegrator::Method method = SystemIntegrator::RK4;
+	double rel_tolerance = 1E-9; // See BasicSystemIntegrator
+	double abs_tolerance = 1E-3;
+	bool regularize = false;
+	ForceModel<J2Oblateness, AtmosphericDrag, RadiationPressure> forces; // Parameters of every model, whether selected or not
+
+	/// <summary>
+	/// Advance the whole system by one step with the selected force models. See BasicSystemIntegrator::Step.
+	/// </summary>
+	int Step(double delta, double time_scale, PhysicsStore& store, Octree* tree = NULL)
+	{
+		return Visit([&](auto& integrator)
+		{
+			integrator.Set_Method(method);
+			integrator.rel_tolerance = rel_tolerance;
+			integrator.abs_tolerance = abs_tolerance;
+			integrator.regularize = regularize;
+			integrator.forces.Take_Settings(forces);
+			return integrator.Step(delta, time_scale, store, tree);
+		});
+	}
+
+	/// <summary>
+	/// Pick the force models. Anything out of range falls back to gravity alone. The newly selected integrator starts afresh.
+	/// </summary>
+	void Select(int f)
+	{
+		Forces next = (f >= 0 && f < FORCES_COUNT) ? (Forces)f : GRAVITY;
+		if (next == selected)
+		{
+			return;
+		}
+		Visit([](auto& integrator) { integrator.Set_Worker_Count(0); return 0; }); // Hand the threads over rather than keep two sets
+		selected = next;
+		Visit([&](auto& integrator) { integrator.Set_Worker_Count(workers); integrator.Reset(); return 0; });
+	}
+
+	/// <summary>
+	/// Start the selected integrator afresh. Call after changing forces: nothing in the store shows it.
+	/// </summary>
+	void Reset()
+	{
+		Visit([](auto& integrator) { integrator.Reset(); return 0; });
+	}
+
+	Forces Get_Selected()
+	{
+		return selected;
+	}
+
+	static std::string Forces_Name(Forces f)
+	{
+		switch (f)
+		{
+		case J2: return "Gravity + J2";
+		case DRAG: return "Gravity + drag";
+		case RADIATION: return "Gravity + radiation pressure";
+		case ALL: return "Gravity + J2, drag, radiation pressure";
+		default: return "Gravity";
+		}
+	}
+
+	void Set_Method(int m)
+	{
+		method = (m >= 0 && m < SystemIntegrator::METHOD_COUNT) ? (SystemIntegrator::Method)m : SystemIntegrator::RK4;
+	}
+
+	void Set_Worker_Count(int count)
+	{
+		workers = count < 0 ? 0 : count;
+		Visit([&](auto& integrator) { integrator.Set_Worker_Count(workers); return 0; });
+	}
+
+	const StateBuffer& Get_Previous()
+	{
+		return Visit([](auto& integrator) -> const StateBuffer& { return integrator.Get_Previous(); });
+	}
+
+	bool Has_Previous(PhysicsStore& store)
+	{
+		return Visit([&](auto& integrator) { return integrator.Has_Previous(store); });
+	}
+
+	int Get_Worker_Count()
+	{
+		return Visit([](auto& integrator) { return integrator.Get_Worker_Count(); });
+	}
+
+	long long Get_Pair_Evaluations()
+	{
+		return Visit([](auto& integrator) { return integrator.Get_Pair_Evaluations(); });
+	}
+
+	int Get_Force_Evaluations()
+	{
+		return Visit([](auto& integrator) { return integrator.Get_Force_Evaluations(); });
+	}
+
+	int Get_Accepted_Substeps()
+	{
+		return Visit([](auto& integrator) { return integrator.Get_Accepted_Substeps(); });
+	}
+
+	int Get_Rejected_Substeps()
+	{
+		return Visit([](auto& integrator) { return integrator.Get_Rejected_Substeps(); });
+	}
+
+	int Get_Encounters()
+	{
+		return Visit([](auto& integrator) { return integrator.Get_Encounters(); });
+	}
+};
+
+#endif /*SELECTABLEINTEGRATOR_H*/
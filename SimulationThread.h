@@ -0,0 +1,669 @@
+#pragma once
+#ifndef SIMULATIONTHREAD_H
+#define SIMULATIONTHREAD_H
+
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <cmath>
+#include <iostream>
+#include "PhysicsState.h"
+#include "CommandQueue.h"
+#include "SelectableIntegrator.h"
+#include "Octree.h"
+#include "GravityKernel.h"
+#include "AllocationCounter.h"
+#include "Collisions.h"
+#include "Timeline.h"
+#include "Ephemeris.h"
+#include "TestParticles.h"
+#include "Events.h"
+
+/*
+	Everything the GUI needs from one moment of the simulation. Published by the simulation thread, never changed once published.
+*/
+struct SimulationSnapshot
+{
+	PhysicsStore state;
+	std::vector<double> px, py, pz; // Positions before the last step, to draw part way through it. Empty if the state was edited since.
+	long long commands_applied = 0; // How many queued commands the state includes
+	double simulated_seconds = 0; // Total simulated time
+	std::chrono::steady_clock::time_point published; // When the last step finished
+	double step_ms = 0; // Real time per physics step
+
+	// Statistics for the GUI
+	int steps = 0; // Steps taken since the previous snapshot
+	int force_evaluations = 0; // In the last step
+	long long pair_evaluations = 0;
+	int accepted_substeps = 0;
+	int rejected_substeps = 0;
+	long long step_allocations = 0;
+	double interactions_per_second = 0; // Since the previous snapshot
+	int tree_nodes = 0;
+	int workers = 0;
+	int collisions = 0; // Since the previous snapshot
+	int encounters = 0; // Close pairs regularised in the last step
+	int force_models = 0; // SelectableIntegrator::Forces
+	double timeline_start = 0, timeline_end = 0; // Simulated times that can be sought to
+	int checkpoints = 0;
+	int checkpoint_interval = 0; // Steps
+	long long timeline_bytes = 0;
+	bool playback = false; // Positions come from an ephemeris rather than the integrator
+	int particles = 0;
+	long long particle_interactions = 0; // In the last step
+	bool warping = false; // Running flat out towards warp_to
+	double warp_from = 0, warp_to = 0; // Simulated seconds
+	long long events = 0; // Ever found
+	std::string last_event; // Description of the newest
+};
+
+/*
+	Test particle positions for drawing, in single precision (plenty for a pixel, and half the copying). Handed over alongside
+	each snapshot rather than in it, so the GUI's copy of the state doesn't have to carry a million particles about.
+*/
+struct ParticleFrame
+{
+	double simulated_seconds = 0; // Same as the snapshot published with it
+	std::vector<float> x, y, z;
+};
+
+/*
+	Runs the physics on a thread of its own, so a slow frame doesn't hold up the simulation and a heavy step doesn't hold up
+	the frame. The thread keeps its own fixed step clock (see Simulation) and owns the real PhysicsStore outright.
+
+	The two sides only meet in two places, neither of which takes a lock:
+	- Edits go GUI -> simulation through a CommandQueue, and are made at the start of the simulation thread's next loop.
+	- State goes simulation -> GUI through a triple buffer of snapshots. The simulation thread fills its back buffer and swaps
+	  it with the "latest" slot; the GUI swaps the latest slot with its front buffer when there's something new there.
+	  Neither side ever touches a buffer the other is using.
+
+	A warp (see PhysicsCommand::WARP) drops the step clock and steps back to back until the target time, only stopping every
+	WARP_PUBLISH_MS to publish progress and pick up a cancel. The GUI stops drawing the system meanwhile.
+*/
+class SimulationThread
+{
+private:
+	// Simulation thread only (while running)
+	PhysicsStore store;
+	SelectableIntegrator integrator;
+	CollisionDetector collisions;
+	int collisions_since_publish = 0;
+	Timeline timeline;
+	Ephemeris ephemeris;
+	TestParticles particles;
+	EventDetector events;
+	long long events_published = 0;
+	std::string last_event;
+	double central_mu = 0; // What the particles orbit. Comes with the belt; bodies are given their own mu.
+	bool playback = false; // Take positions from the ephemeris while it covers the time
+	Octree tree;
+	double time_scale = 0;
+	bool use_barnes_hut = false;
+	double step_ms = 1000.0 / 120;
+	double simulated_seconds = 0;
+	double timeline_budget = 0; // Bytes, as last set
+	double last_step = 0; // Simulated seconds
+	long long step_allocations = 0;
+	int last_step_body_count = -1;
+	static const int MAX_SUBSTEPS = 32; // Per loop. Too far behind => drop the backlog rather than spiral.
+
+	// Warp: steps back to back with no pacing, publishing now and then for the progress display
+	bool warping = false;
+	double warp_from = 0, warp_to = 0, warp_step = 0; // Simulated seconds
+	static const int WARP_PUBLISH_MS = 50; // Real time between progress snapshots (and checks for a cancel)
+	static const int DEFAULT_WARP_STEP = 3600; // Simulated seconds, if warping while paused
+
+	// Shared
+	CommandQueue commands;
+	SimulationSnapshot buffers[3];
+	static const int FRESH = 4; // Set in latest when it holds a snapshot the GUI hasn't picked up
+	std::atomic<int> latest{ 0 }; // Index of the newest published buffer | FRESH
+	int back = 1; // Simulation thread's buffer
+	int front = 2; // GUI's buffer
+	ParticleFrame particle_frames[3]; // Triple buffered the same way
+	std::atomic<int> particles_latest{ 0 };
+	int particles_back = 1;
+	int particles_front = 2;
+	std::atomic<bool> running{ false };
+	std::thread thread;
+
+	void Apply(const PhysicsCommand& c)
+	{
+		bool alive = c.handle >= 0 && c.handle < (int)store.slot_of_handle.size() && store.Slot(c.handle) >= 0;
+		if (c.type <= PhysicsCommand::SET_SOFTENING)
+		{
+			timeline.Truncate(simulated_seconds); // Edited here => what came after no longer follows
+			if (playback)
+			{
+				playback = false; // Nor does the ephemeris
+				std::cout << "\nEphemeris playback off: the system was edited, so it's integrated from here\n";
+			}
+		}
+		switch (c.type)
+		{
+		case PhysicsCommand::ADD_BODY:
+			if (store.Add(c.a, c.b, c.value, c.value2, c.handle) != c.handle)
+			{
+				std::cout << "\nWARNING: simulation thread handed out a different handle to the GUI\n";
+			}
+			break;
+		case PhysicsCommand::REMOVE_BODY:
+			if (alive) { store.Remove(c.handle); }
+			break;
+		case PhysicsCommand::SET_POSITION:
+			if (alive) { store.Set_Position(c.handle, c.a); }
+			break;
+		case PhysicsCommand::SET_VELOCITY:
+			if (alive) { store.Set_Velocity(c.handle, c.a); }
+			break;
+		case PhysicsCommand::SET_GM:
+			if (alive) { store.Set_GM(c.handle, c.value); }
+			break;
+		case PhysicsCommand::SET_MU:
+			if (alive) { store.Set_Mu(c.handle, c.value); }
+			break;
+		case PhysicsCommand::SET_ANALYTIC:
+			if (alive) { store.Set_Analytic(c.handle, c.value != 0); }
+			break;
+		case PhysicsCommand::SET_PARENT:
+			if (alive) { store.Set_Parent(c.handle, (int)c.value); }
+			break;
+		case PhysicsCommand::SET_RADIUS:
+			if (alive) { store.Set_Radius(c.handle, c.value); }
+			break;
+		case PhysicsCommand::SET_SOFTENING:
+			store.Set_Softening(c.value);
+			break;
+		case PhysicsCommand::SET_TIME_SCALE:
+			time_scale = c.value;
+			break;
+		case PhysicsCommand::SET_METHOD:
+			integrator.Set_Method((int)c.value);
+			break;
+		case PhysicsCommand::SET_FORCE_MODE:
+			use_barnes_hut = c.value != 0;
+			tree.theta = c.value2;
+			break;
+		case PhysicsCommand::SET_PHYSICS_RATE:
+			step_ms = 1000 / c.value;
+			break;
+		case PhysicsCommand::SET_TOLERANCE:
+			integrator.rel_tolerance = c.value;
+			break;
+		case PhysicsCommand::SET_WORKERS:
+			integrator.Set_Worker_Count((int)c.value);
+			particles.Set_Worker_Count((int)c.value);
+			break;
+		case PhysicsCommand::SET_COLLISIONS:
+			collisions.response = (CollisionDetector::Response)(int)c.value;
+			collisions.restitution = c.value2;
+			collisions.central_radius = c.a.x;
+			break;
+		case PhysicsCommand::SET_REGULARIZATION:
+			integrator.regularize = c.value != 0;
+			break;
+		case PhysicsCommand::SET_FORCE_MODELS:
+			integrator.Select((int)c.value);
+			integrator.forces.j2 = c.a.x;
+			integrator.forces.j2_radius = c.a.y;
+			integrator.forces.radiation_area_to_mass = c.a.z;
+			integrator.forces.drag_density = c.b.x;
+			integrator.forces.drag_scale_height = c.b.y;
+			integrator.forces.drag_ballistic = c.b.z;
+			integrator.forces.radiation_pressure = c.value2;
+			integrator.Reset(); // The cached forces were worked out with the old models
+			break;
+		case PhysicsCommand::SET_TIMELINE:
+			timeline.retention = (Timeline::Retention)(int)c.value;
+			if (c.value2 * 1E6 != timeline_budget)
+			{
+				timeline_budget = c.value2 * 1E6;
+				timeline.Set_Budget(timeline_budget);
+			}
+			break;
+		case PhysicsCommand::SEEK:
+			warping = false;
+			Seek(c.value);
+			break;
+		case PhysicsCommand::WARP:
+			Warp(c.value, c.value2);
+			break;
+		case PhysicsCommand::CANCEL_WARP:
+			if (warping)
+			{
+				warping = false;
+				std::cout << "\nWarp cancelled at " << simulated_seconds / 86400 << " days\n";
+			}
+			break;
+		case PhysicsCommand::ADD_BELT:
+			central_mu = c.value2;
+			particles.Add_Belt((int)c.value, c.value2, c.a.x, c.a.y, c.a.z, c.b.x, (unsigned)c.b.y);
+			break;
+		case PhysicsCommand::ADD_RING:
+			if (alive)
+			{
+				int s = store.Slot(c.handle);
+				particles.Add_Ring((int)c.value, store.Get_Position(c.handle), store.Get_Velocity(c.handle), store.gm[s], c.a.x, c.a.y, c.a.z, (unsigned)c.b.y);
+				if (central_mu == 0)
+				{
+					central_mu = store.mu[s];
+				}
+			}
+			break;
+		case PhysicsCommand::CLEAR_PARTICLES:
+			particles.Clear();
+			break;
+		}
+	}
+
+	// Make every queued edit. Returns true if there were any.
+	bool Drain()
+	{
+		bool any = false;
+		PhysicsCommand c;
+		while (commands.Pop(c))
+		{
+			Apply(c);
+			any = true;
+		}
+		return any;
+	}
+
+	// One step of the integrator and the collisions it leads to
+	void Advance(double delta, double scale)
+	{
+		integrator.Step(delta, scale, store, use_barnes_hut ? &tree : NULL);
+		if (integrator.Has_Previous(store))
+		{
+			const StateBuffer& previous = integrator.Get_Previous();
+			collisions_since_publish += collisions.Resolve(store, previous.x.data(), previous.y.data(), previous.z.data());
+		}
+	}
+
+	// One step of dt simulated seconds: the bodies (integrated or played back), then the particles
+	void Step(double dt)
+	{
+		last_step = dt;
+		timeline.Record(store, simulated_seconds, last_step); // Before counting: the ring is allowed to grow
+		long long allocations_before = AllocationCounter::Count();
+		particles.Begin_Step(store);
+		if (playback && ephemeris.Contains(simulated_seconds + last_step))
+		{
+			ephemeris.Evaluate(simulated_seconds + last_step, store);
+		}
+		else
+		{
+			Advance(1000, dt); // Past the end of the ephemeris this carries on from its last state
+			if (integrator.Has_Previous(store)) // Else bodies merged or were edited: no dense output over this step
+			{
+				events.Check(integrator.Get_Previous(), store, simulated_seconds, dt);
+			}
+		}
+		particles.Step(last_step, store, central_mu);
+		step_allocations = AllocationCounter::Count() - allocations_before;
+		if (step_allocations > 0 && store.Size() == last_step_body_count)
+		{
+			std::cout << "\nWARNING: physics step made " << step_allocations << " heap allocations\n";
+		}
+		last_step_body_count = store.Size();
+		simulated_seconds += dt;
+	}
+
+	// Start running flat out to a later time. An earlier one (or one still on the timeline) is sought to instead.
+	void Warp(double seconds, double step)
+	{
+		warping = false;
+		if (seconds <= std::max(simulated_seconds, timeline.End()))
+		{
+			Seek(seconds);
+			return;
+		}
+		if (simulated_seconds < timeline.End())
+		{
+			Seek(timeline.End()); // Scrubbed back: carry on the history there is rather than integrating it again
+		}
+		warp_step = step > 0 ? step : (time_scale > 0 ? (step_ms / 1000) * time_scale : DEFAULT_WARP_STEP);
+		warp_from = simulated_seconds;
+		warp_to = seconds;
+		warping = true;
+	}
+
+	// Warp steps for up to WARP_PUBLISH_MS of real time. The last step is cut short to land on the target exactly.
+	int Warp_Steps()
+	{
+		auto begin = std::chrono::steady_clock::now();
+		int steps = 0;
+		while (warping && std::chrono::steady_clock::now() - begin < std::chrono::milliseconds(WARP_PUBLISH_MS))
+		{
+			double remaining = warp_to - simulated_seconds;
+			if (remaining <= warp_step * 1E-9)
+			{
+				simulated_seconds = warp_to;
+				warping = false;
+				break;
+			}
+			Step(std::min(warp_step, remaining));
+			steps++;
+		}
+		return steps;
+	}
+
+	// Go to another simulated time within the timeline: back to the checkpoint before it, then integrate forward to it
+	void Seek(double seconds)
+	{
+		if (playback && ephemeris.Contains(seconds))
+		{
+			ephemeris.Evaluate(seconds, store); // Any time at all, straight from the polynomials
+			simulated_seconds = seconds;
+			return;
+		}
+
+		double from, step;
+		if (last_step != 0 && simulated_seconds > timeline.End())
+		{
+			timeline.Record(store, simulated_seconds, last_step, true); // So we can come back to where we left off
+		}
+		seconds = std::max(timeline.Start(), std::min(std::max(timeline.End(), simulated_seconds), seconds));
+		if (!timeline.Restore(seconds, store, from, step))
+		{
+			std::cout << "\nWARNING: nothing on the timeline to go back to\n";
+			return;
+		}
+		simulated_seconds = from;
+		step = fabs(step); // A checkpoint from running backwards is still integrated forwards
+		if (step > 0)
+		{
+			long long whole = (long long)floor((seconds - from) / step + 1E-9);
+			for (long long i = 0; i < whole; i++)
+			{
+				Advance(1000, step); // 1000 ms at a time scale of step is the same dt the step was first taken with
+			}
+			double rest = (seconds - from) - whole * step;
+			if (rest > step * 1E-9)
+			{
+				Advance(1000, rest);
+			}
+		}
+		simulated_seconds = seconds;
+	}
+
+	void Publish(int steps)
+	{
+		SimulationSnapshot& s = buffers[back];
+		s.state.Assign_State(store);
+		if (steps > 0 && integrator.Has_Previous(store))
+		{
+			const StateBuffer& previous = integrator.Get_Previous();
+			s.px = previous.x; s.py = previous.y; s.pz = previous.z;
+		}
+		else
+		{
+			s.px.clear(); s.py.clear(); s.pz.clear();
+		}
+		s.commands_applied = commands.Popped();
+		s.simulated_seconds = simulated_seconds;
+		s.published = std::chrono::steady_clock::now();
+		s.step_ms = step_ms;
+
+		s.steps = steps;
+		s.force_evaluations = integrator.Get_Force_Evaluations();
+		s.pair_evaluations = integrator.Get_Pair_Evaluations();
+		s.accepted_substeps = integrator.Get_Accepted_Substeps();
+		s.rejected_substeps = integrator.Get_Rejected_Substeps();
+		s.step_allocations = step_allocations;
+		s.interactions_per_second = GravityKernel::Interactions_Per_Second(); // This thread's own kernel time
+		GravityKernel::Reset_Stats();
+		s.tree_nodes = use_barnes_hut ? tree.Get_Node_Count() : 0;
+		s.workers = integrator.Get_Worker_Count();
+		s.encounters = integrator.Get_Encounters();
+		s.force_models = integrator.Get_Selected();
+		s.collisions = collisions_since_publish;
+		collisions_since_publish = 0;
+		s.timeline_start = timeline.Start();
+		s.timeline_end = std::max(timeline.End(), simulated_seconds);
+		s.checkpoints = timeline.Count();
+		s.checkpoint_interval = timeline.Interval();
+		s.timeline_bytes = timeline.Bytes();
+		s.playback = playback;
+		if (playback)
+		{
+			s.timeline_start = std::min(s.timeline_start, ephemeris.Get_Start());
+			s.timeline_end = std::max(s.timeline_end, ephemeris.Get_Start() + ephemeris.Get_Span());
+		}
+
+		int found = (int)std::min((long long)events.Logged(), events.Total() - events_published); // Since the last snapshot, that are still in the log
+		for (int i = events.Logged() - found; i < events.Logged(); i++)
+		{
+			last_event = events.Describe(events.Get_Event(i));
+			std::cout << "\nEvent: " << last_event;
+		}
+		events_published = events.Total();
+		s.last_event = last_event;
+		s.events = events.Total();
+		s.warping = warping;
+		s.warp_from = warp_from;
+		s.warp_to = warp_to;
+		s.particles = particles.Size();
+		s.particle_interactions = particles.Get_Interactions();
+
+		back = latest.exchange(back | FRESH, std::memory_order_acq_rel) & 3; // Hand it over, take back whichever buffer was there
+
+		ParticleFrame& f = particle_frames[particles_back];
+		if (particles.Size() > 0 || !f.x.empty())
+		{
+			int n = particles.Size();
+			f.simulated_seconds = simulated_seconds;
+			f.x.resize(n); f.y.resize(n); f.z.resize(n);
+			for (int i = 0; i < n; i++)
+			{
+				f.x[i] = (float)particles.x[i];
+				f.y[i] = (float)particles.y[i];
+				f.z[i] = (float)particles.z[i];
+			}
+			particles_back = particles_latest.exchange(particles_back | FRESH, std::memory_order_acq_rel) & 3;
+		}
+	}
+
+	void Run()
+	{
+		auto last = std::chrono::steady_clock::now();
+		double accumulator = 0; // Real milliseconds not simulated yet
+		while (running.load(std::memory_order_acquire))
+		{
+			bool edited = Drain();
+
+			auto now = std::chrono::steady_clock::now();
+			accumulator += std::chrono::duration<double, std::milli>(now - last).count();
+			last = now;
+
+			int steps = 0;
+			if (warping)
+			{
+				steps = Warp_Steps(); // No pacing and no sleeping: back here only to check for a cancel and show progress
+				Publish(steps);
+				accumulator = 0;
+				last = std::chrono::steady_clock::now();
+				continue;
+			}
+			if (time_scale == 0)
+			{
+				accumulator = 0;
+			}
+			else
+			{
+				while (accumulator >= step_ms && steps < MAX_SUBSTEPS)
+				{
+					Step((step_ms / 1000) * time_scale);
+					accumulator -= step_ms;
+					steps++;
+				}
+				if (accumulator >= step_ms)
+				{
+					accumulator = fmod(accumulator, step_ms);
+				}
+			}
+
+			if (steps > 0 || edited)
+			{
+				Publish(steps);
+			}
+
+			// Sleep until the next step is due. Paused => just check for edits every millisecond.
+			double wait = time_scale == 0 ? 1 : step_ms - accumulator;
+			std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(wait));
+		}
+
+		Drain(); // Anything sent before Stop still counts
+		Publish(0);
+	}
+
+public:
+	~SimulationThread()
+	{
+		Stop();
+	}
+
+	/// <summary>
+	/// Copy the initial state over and start simulating it. Settings come through the command queue like any other edit.
+	/// </summary>
+	/// <param name="initial">State to start from. Its journal should be set to Get_Commands() from now on.</param>
+	/// <param name="_simulated_seconds">Simulated time so far</param>
+	void Start(const PhysicsStore& initial, double _simulated_seconds)
+	{
+		Stop();
+		store.Assign_State(initial);
+		simulated_seconds = _simulated_seconds;
+		last_step_body_count = -1;
+		warping = false;
+		timeline.Clear(); // The GUI may have changed anything while it wasn't running
+		if (playback && !ephemeris.Covers(store))
+		{
+			playback = false;
+			std::cout << "\nWARNING: the ephemeris doesn't cover every body, so the system is integrated instead\n";
+		}
+		if (playback && ephemeris.Contains(simulated_seconds))
+		{
+			ephemeris.Evaluate(simulated_seconds, store);
+		}
+
+		// Publish the starting state straight away so Latest always has something sensible to return
+		Publish(0);
+		front = latest.exchange(front, std::memory_order_acq_rel) & 3;
+
+		running.store(true, std::memory_order_release);
+		thread = std::thread([this]() { this->Run(); });
+	}
+
+	/// <summary>
+	/// Finish off any queued edits and stop the thread. Get_State is then the final state.
+	/// </summary>
+	void Stop()
+	{
+		if (!thread.joinable())
+		{
+			return;
+		}
+		running.store(false, std::memory_order_release);
+		thread.join();
+	}
+
+	bool Is_Running()
+	{
+		return thread.joinable();
+	}
+
+	/// <summary>
+	/// Play the bodies back from an ephemeris (bound to their handles) instead of integrating them, from the next Start.
+	/// Only while the thread is stopped.
+	/// </summary>
+	void Set_Ephemeris(const Ephemeris& e)
+	{
+		ephemeris = e;
+		playback = true;
+	}
+
+	// Integrate again, from wherever playback got to. Only while the thread is stopped.
+	void Clear_Ephemeris()
+	{
+		playback = false;
+	}
+
+	bool Playing_Back()
+	{
+		return playback;
+	}
+
+	// Where the GUI queues edits (set it as the GUI store's journal)
+	CommandQueue& Get_Commands()
+	{
+		return commands;
+	}
+
+	void Send(PhysicsCommand::Type type, double value, double value2 = 0)
+	{
+		PhysicsCommand c;
+		c.type = type;
+		c.value = value;
+		c.value2 = value2;
+		commands.Push(c);
+	}
+
+	void Send(const PhysicsCommand& c)
+	{
+		commands.Push(c);
+	}
+
+	// Number of commands the GUI has queued. Compare with a snapshot's commands_applied to see if it has caught up.
+	long long Commands_Sent()
+	{
+		return commands.Pushed();
+	}
+
+	/// <summary>
+	/// The newest snapshot. GUI thread only. Stays valid (and unchanged) until the next call.
+	/// </summary>
+	const SimulationSnapshot& Latest()
+	{
+		if (latest.load(std::memory_order_acquire) & FRESH)
+		{
+			front = latest.exchange(front, std::memory_order_acq_rel) & 3;
+		}
+		return buffers[front];
+	}
+
+	/// <summary>
+	/// The newest test particle positions. GUI thread only. Stays valid (and unchanged) until the next call.
+	/// </summary>
+	const ParticleFrame& Latest_Particles()
+	{
+		if (particles_latest.load(std::memory_order_acquire) & FRESH)
+		{
+			particles_front = particles_latest.exchange(particles_front, std::memory_order_acq_rel) & 3;
+		}
+		return particle_frames[particles_front];
+	}
+
+	/// <summary>
+	/// What to watch for between steps (see EventDetector), and the log of what's been found. Only while the thread is stopped.
+	/// </summary>
+	EventDetector& Get_Events()
+	{
+		return events;
+	}
+
+	/// <summary>
+	/// The simulation's own state. Only safe to read while the thread is stopped.
+	/// </summary>
+	const PhysicsStore& Get_State()
+	{
+		return store;
+	}
+
+	double Get_Simulated_Seconds()
+	{
+		return simulated_seconds;
+	}
+};
+
+#endif /*SIMULATIONTHREAD_H*/
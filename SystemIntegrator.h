@@ -0,0 +1,1320 @@
+#pragma once
+#ifndef SYSTEMINTEGRATOR_H
+#define SYSTEMINTEGRATOR_H
+
+#include <vector>
+#include <string>
+#include <cmath>
+#include <utility>
+#include <algorithm>
+#include "vec3.h"
+#include "Octree.h"
+#include "PhysicsState.h"
+#include "GravityKernel.h"
+#include "WorkerPool.h"
+#include "Kepler.h"
+#include "ForceModels.h"
+
+/*
+	Advances every body (and every satellite) in the system together, one step of the chosen method at a time.
+
+	Body::Update_Body integrates each body on its own, against neighbours that may or may not have already been moved this frame,
+	so the result depends on the order of orbiting_bodies and the same pair distances get worked out again by every body.
+	Here each RK4 stage is evaluated once for the whole system, against where every body is at that stage.
+
+	All of the maths runs on the PhysicsStore arrays, and none of it knows about Body: bringing the views up to date afterwards
+	is the GUI's job. Once the buffers have grown to the number of bodies, Step makes no heap allocations at all.
+
+	The direct sum visits each pair once (Newton's third law). Its rows are cut into fixed chunks, each of which writes into
+	its own partial sums, and every body adds its partials up in chunk order afterwards. The chunks don't depend on the
+	number of threads and no two threads ever write to the same place, so the result is bitwise identical whether it runs
+	on the calling thread alone, 1 worker or 31.
+
+	Methods:
+	RK4 - four force evaluations a step. Accurate over a short run, but the energy error grows without limit.
+	LEAPFROG - kick-drift-kick, second order. The force at the end of one step is the force at the start of the next, so it
+		costs one evaluation a step. Symplectic: the energy error oscillates but stays bounded, however long the run.
+	YOSHIDA4, YOSHIDA6 - leapfrog substeps of carefully chosen (partly negative) lengths, composed into a 4th / 6th order
+		symplectic step. 3 and 7 evaluations a step.
+	DOPRI5 - Dormand-Prince embedded RK5(4). The difference between the 5th and 4th order answers estimates the error of each
+		substep, so the frame is cut into as many substeps as the tolerance needs: small ones through a close encounter,
+		one big one through a quiet stretch. 6 evaluations a substep (the 7th is the first of the next).
+	WISDOM_HOLMAN - splits the motion into each body's exact Keplerian orbit around the central body (the Kepler drift) and
+		the much smaller pulls the bodies have on each other (kicks either side of it). The central body sits still at the
+		origin here, so the split is exact and there is no indirect term. The error scales with the size of the perturbations
+		rather than with the Sun's pull, so planets can take steps of days. One evaluation a step. Satellites are perturbed
+		hard by their parent, though, so they need small steps under this method as much as any other.
+	HERMITE - 4th order Hermite predictor-corrector (Makino & Aarseth 1992) with block timesteps. Each body steps dt / 2^k for
+		its own k, picked from how fast its acceleration is changing (Aarseth's criterion), and everyone lines up again at the
+		end of the frame. At each block step only the bodies that are due are evaluated (against everyone else's predicted
+		position), so a fast inner moon no longer costs an evaluation of the outer planets every time it moves. Needs the jerk
+		as well as the acceleration, which the octree doesn't give, so it always uses the direct sum.
+
+	Satellites (bodies with a parent in the store) aren't part of the method's step. The methods integrate the top level
+	bodies, each carrying the mass of its satellites, and then each family of satellites is integrated relative to its parent
+	(see Step_Satellites). That has its own substeps, chosen from the satellites' orbital periods. A planet with a fast moon
+	no longer holds the whole system to the moon's step size, and the moon doesn't spiral off at big time scales.
+
+	Analytic bodies (PhysicsStore::orbits) are put back on their fixed orbits after whichever method has run. If every body is
+	analytic there is nothing to integrate, so a step of any length costs one batch Kepler solve.
+
+	Close encounters (with regularize on) go through the same machinery. Two top level bodies close enough that their mutual
+	orbit takes only a few steps are made a binary for the step: the lighter becomes a satellite of the heavier, the method
+	only sees their barycentre, and their relative motion is the exact Kepler drift plus tidal kicks. The 1/r^2 singularity
+	is solved analytically rather than stepped through, which is what regularisation (Kustaanheimo-Stiefel and friends)
+	buys, so one tight pair no longer drags the whole system's step size down with it. The pairs are found again every step.
+
+	PhysicsStore::softening softens the pull between bodies (Plummer), for clouds of bodies where close pairs are everywhere
+	and only the overall motion matters.
+
+	Forces other than point mass gravity (oblateness, drag, radiation pressure) come from the Forces policy, chosen at compile
+	time (see ForceModels.h). SystemIntegrator is gravity alone.
+*/
+template <class Forces = ForceModel<>>
+class BasicSystemIntegrator
+{
+public:
+	enum Method { RK4, LEAPFROG, YOSHIDA4, YOSHIDA6, DOPRI5, WISDOM_HOLMAN, HERMITE, METHOD_COUNT };
+
+private:
+	// Buffers live between frames so stepping doesn't reallocate them every time
+	StateBuffer stage; // State the current stage is evaluated at
+	VectorBuffer k_pos[7], k_vel[7]; // Derivatives at each stage (RK4 uses 4, DOPRI5 all 7)
+	StateBuffer trial; // DOPRI5: 5th order answer of the substep being tried
+	VectorBuffer perturbation; // WISDOM_HOLMAN: acceleration from the other bodies only
+
+	long long pair_evaluations = 0; // Counted over the last step
+	int force_evaluations = 0; // Counted over the last step
+
+	// Leapfrog methods reuse the acceleration left in the store by the previous step. It is only trusted if nothing has
+	// touched the store since (see PhysicsStore::revision) and it was worked out the same way.
+	bool forces_cached = false;
+	long long cached_revision = -1;
+	const Octree* cached_tree = NULL;
+	double cached_theta = 0;
+	Method cached_method = RK4; // Wisdom-Holman caches just the perturbations, the others the whole acceleration
+
+	// DOPRI5
+	double substep = 0; // Substep length to try next (s). Carried over between frames, 0 => start from the whole frame.
+	int accepted_substeps = 0; // Counted over the last step
+	int rejected_substeps = 0;
+	static const int MAX_SUBSTEPS = 1000; // Per frame. Past this, substeps are accepted whatever their error so a frame always ends.
+
+	// HERMITE
+	VectorBuffer jerk; // d(acceleration)/dt of every body, at the same time as the store's acceleration
+	VectorBuffer next_acceleration, next_jerk; // At the end of the block step, for the bodies due one
+	std::vector<int> level; // Each body steps frame / 2^level
+	std::vector<long long> body_tick; // How far through the frame each body has got, in units of frame / 2^MAX_LEVEL
+	std::vector<int> due; // Bodies due a step at the current block time
+	double level_frame = 0; // Frame length the levels were picked for
+	long long hermite_revision = -1; // Store revision jerk and level were left for by the last Hermite step, -1 => start afresh
+	static const int MAX_LEVEL = 16; // Smallest step is frame / 65536. Anything that wants less has to make do.
+	// Satellite hierarchy. Rebuilt every step, allocation free once the sizes settle.
+	PhysicsStore top; // Just the top level bodies, each standing in for its whole family: their barycentre and total mass
+	StateBuffer start_barycentre; // Where each top level family's barycentre was at the start of the step
+	StateBuffer family_shift; // How far each family has to move to put its barycentre back
+	std::vector<int> top_slot; // Top level index -> store slot
+	std::vector<int> top_index; // Store slot -> top level index, -1 for satellites
+	std::vector<int> depth; // Store slot -> 0 for top level, 1 for a satellite, 2 for a satellite's satellite...
+	std::vector<int> ancestor; // Store slot -> slot of its top level ancestor
+	std::vector<int> family; // Satellites, sorted so each parent's come together, parents before children
+	StateBuffer relative; // Satellite states relative to their parent, by position in family
+	VectorBuffer tidal; // Perturbations on each satellite, by position in family
+	std::vector<double> family_mu; // G * (parent + satellite) mass, by position in family
+	static const int STEPS_PER_ORBIT = 64; // Satellite substeps per orbit of the fastest satellite in a family
+	static const int MAX_DEPTH = 8; // Guards against a parent loop
+
+	// Close encounters
+	struct Encounter
+	{
+		double time; // Time scale of the pair's mutual orbit, sqrt(r^3 / G(m1 + m2))
+		int lighter, heavier; // Slots
+	};
+	std::vector<Encounter> encounters;
+	std::vector<int> loose; // Slots that could take part in an encounter: top level and integrated
+	std::vector<int> parent_of; // Store slot -> slot it is integrated relative to this step (its parent or its encounter partner), -1 for none
+	std::vector<int> last_parent_of; // The same from last step, to tell when a pair forms or breaks up
+	int encounter_count = 0; // Pairs regularised in the last step
+	static const int ENCOUNTER_STEPS = 8; // A pair whose time scale is under this many steps is regularised
+
+	// Positions (and velocities) before the last step, so views can be drawn part way between it and the current state
+	StateBuffer previous;
+	long long previous_revision = -1; // Store revision the snapshot belongs to. Edited since => don't interpolate.
+
+	WorkerPool pool; // Persistent worker threads for the force evaluation. Empty => everything on the calling thread.
+	static const int ROWS_PER_CHUNK = 64;
+	VectorBuffer partial; // Direct sum: each chunk of rows' pull on the bodies from its first row on, one after the other
+	std::vector<long long> partial_start; // Chunk -> where its partial sums begin
+
+	void Resize_Buffers(int n)
+	{
+		stage.Resize(n);
+		trial.Resize(n);
+		for (int s = 0; s < 7; s++)
+		{
+			k_pos[s].Resize(n);
+			k_vel[s].Resize(n);
+		}
+	}
+
+	// Add the force models' accelerations on a top level body at (x, y, z), (vx, vy, vz) into a
+	void Add_Forces(double mu, double x, double y, double z, double vx, double vy, double vz, vector3& a)
+	{
+		ForceState s;
+		s.r = { x, y, z };
+		s.v = { vx, vy, vz };
+		s.relative_r = s.r;
+		s.relative_v = s.v;
+		s.parent_radius = 0;
+		forces.Add(s, mu, a);
+	}
+
+	// Acceleration of every body at (x, y, z) moving at (vx, vy, vz), written into (ax, ay, az). central = false leaves out the central body.
+	void Evaluate(PhysicsStore& store, const double* x, const double* y, const double* z, const double* vx, const double* vy, const double* vz, double* ax, double* ay, double* az, Octree* tree, bool central = true)
+	{
+		int n = store.Size();
+		const double* gm = store.gm.data();
+		const double* mu = store.mu.data();
+		double eps2 = store.softening * store.softening;
+		force_evaluations++;
+
+		//SUN
+		for (int i = 0; i < n; i++)
+		{
+			double r2 = x[i] * x[i] + y[i] * y[i] + z[i] * z[i];
+			double s = (central && r2 > 0) ? -mu[i] / (r2 * sqrt(r2)) : 0;
+			ax[i] = x[i] * s;
+			ay[i] = y[i] * s;
+			az[i] = z[i] * s;
+			if (!Forces::EMPTY) // Known at compile time: gravity alone doesn't even look
+			{
+				vector3 a = { ax[i], ay[i], az[i] };
+				Add_Forces(mu[i], x[i], y[i], z[i], vx[i], vy[i], vz[i], a);
+				ax[i] = a.x; ay[i] = a.y; az[i] = a.z;
+			}
+		}
+
+		//Others
+		if (tree != NULL)
+		{
+			tree->Build(x, y, z, gm, n); // Rebuilt every stage so the tree always matches the positions being evaluated
+			auto walk = [&](int begin, int end)
+			{
+				for (int i = begin; i < end; i++)
+				{
+					vector3 a = tree->Acceleration({ x[i], y[i], z[i] }, i, eps2); // The tree is only read, so walks can share it
+					ax[i] += a.x;
+					ay[i] += a.y;
+					az[i] += a.z;
+				}
+			};
+			pool.Parallel_For(n, ROWS_PER_CHUNK, walk);
+			return;
+		}
+
+		// Chunk c holds rows [c * ROWS_PER_CHUNK, ...), which only reach bodies from its first row on
+		auto start = std::chrono::high_resolution_clock::now();
+		int chunks = (n + ROWS_PER_CHUNK - 1) / ROWS_PER_CHUNK;
+		partial_start.resize(chunks + 1);
+		partial_start[0] = 0;
+		for (int c = 0; c < chunks; c++)
+		{
+			partial_start[c + 1] = partial_start[c] + n - c * ROWS_PER_CHUNK;
+		}
+		partial.Resize((int)partial_start[chunks]);
+		auto rows = [&](int begin, int end)
+		{
+			for (int c = begin; c < end; c++)
+			{
+				int first = c * ROWS_PER_CHUNK;
+				long long offset = partial_start[c] - first; // Body j's partial sum is at offset + j. Never negative.
+				std::fill(partial.x.begin() + partial_start[c], partial.x.begin() + partial_start[c + 1], 0.0);
+				std::fill(partial.y.begin() + partial_start[c], partial.y.begin() + partial_start[c + 1], 0.0);
+				std::fill(partial.z.begin() + partial_start[c], partial.z.begin() + partial_start[c + 1], 0.0);
+				GravityKernel::Pair_Rows(first, std::min(first + ROWS_PER_CHUNK, n), x, y, z, gm, n, partial.x.data() + offset, partial.y.data() + offset, partial.z.data() + offset, eps2);
+			}
+		};
+		pool.Parallel_For(chunks, 1, rows); // Chunks, not rows: the same chunks however many threads there are
+		auto sum = [&](int begin, int end)
+		{
+			for (int j = begin; j < end; j++)
+			{
+				for (int c = 0; c <= j / ROWS_PER_CHUNK; c++) // Always in chunk order
+				{
+					long long k = partial_start[c] - c * ROWS_PER_CHUNK + j;
+					ax[j] += partial.x[k];
+					ay[j] += partial.y[k];
+					az[j] += partial.z[k];
+				}
+			}
+		};
+		pool.Parallel_For(n, ROWS_PER_CHUNK, sum);
+		std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+		GravityKernel::Record((long long)n * (n - 1) / 2, elapsed.count());
+		pair_evaluations += (long long)n * (n - 1) / 2;
+	}
+
+	// Stage state = start state + derivative * h
+	void Offset_State(PhysicsStore& store, VectorBuffer& d_pos, VectorBuffer& d_vel, double h)
+	{
+		int n = store.Size();
+		for (int i = 0; i < n; i++)
+		{
+			stage.x[i] = store.x[i] + d_pos.x[i] * h;
+			stage.y[i] = store.y[i] + d_pos.y[i] * h;
+			stage.z[i] = store.z[i] + d_pos.z[i] * h;
+			stage.vx[i] = store.vx[i] + d_vel.x[i] * h;
+			stage.vy[i] = store.vy[i] + d_vel.y[i] * h;
+			stage.vz[i] = store.vz[i] + d_vel.z[i] * h;
+		}
+	}
+
+	void Step_RK4(PhysicsStore& store, double dt, Octree* tree)
+	{
+		int n = store.Size();
+
+		// k1: derivative at the start
+		k_pos[0].x = store.vx; k_pos[0].y = store.vy; k_pos[0].z = store.vz;
+		Evaluate(store, store.x.data(), store.y.data(), store.z.data(), store.vx.data(), store.vy.data(), store.vz.data(), k_vel[0].x.data(), k_vel[0].y.data(), k_vel[0].z.data(), tree);
+
+		// k2, k3: derivatives half a step in. k4: derivative a full step in.
+		double offsets[3] = { 0.5 * dt, 0.5 * dt, dt };
+		for (int s = 1; s < 4; s++)
+		{
+			Offset_State(store, k_pos[s - 1], k_vel[s - 1], offsets[s - 1]);
+			k_pos[s].x = stage.vx; k_pos[s].y = stage.vy; k_pos[s].z = stage.vz;
+			Evaluate(store, stage.x.data(), stage.y.data(), stage.z.data(), stage.vx.data(), stage.vy.data(), stage.vz.data(), k_vel[s].x.data(), k_vel[s].y.data(), k_vel[s].z.data(), tree);
+		}
+
+		double w = dt / 6;
+		for (int i = 0; i < n; i++)
+		{
+			store.x[i] += (k_pos[0].x[i] + 2 * k_pos[1].x[i] + 2 * k_pos[2].x[i] + k_pos[3].x[i]) * w;
+			store.y[i] += (k_pos[0].y[i] + 2 * k_pos[1].y[i] + 2 * k_pos[2].y[i] + k_pos[3].y[i]) * w;
+			store.z[i] += (k_pos[0].z[i] + 2 * k_pos[1].z[i] + 2 * k_pos[2].z[i] + k_pos[3].z[i]) * w;
+			store.vx[i] += (k_vel[0].x[i] + 2 * k_vel[1].x[i] + 2 * k_vel[2].x[i] + k_vel[3].x[i]) * w;
+			store.vy[i] += (k_vel[0].y[i] + 2 * k_vel[1].y[i] + 2 * k_vel[2].y[i] + k_vel[3].y[i]) * w;
+			store.vz[i] += (k_vel[0].z[i] + 2 * k_vel[1].z[i] + 2 * k_vel[2].z[i] + k_vel[3].z[i]) * w;
+			store.ax[i] = k_vel[0].x[i];
+			store.ay[i] = k_vel[0].y[i];
+			store.az[i] = k_vel[0].z[i];
+		}
+		forces_cached = false; // ax is the start of the step, not the end
+	}
+
+	// v += a * h, with a the acceleration in the store
+	void Kick(PhysicsStore& store, double h)
+	{
+		int n = store.Size();
+		for (int i = 0; i < n; i++)
+		{
+			store.vx[i] += store.ax[i] * h;
+			store.vy[i] += store.ay[i] * h;
+			store.vz[i] += store.az[i] * h;
+		}
+	}
+
+	// x += v * h
+	void Drift(PhysicsStore& store, double h)
+	{
+		int n = store.Size();
+		for (int i = 0; i < n; i++)
+		{
+			store.x[i] += store.vx[i] * h;
+			store.y[i] += store.vy[i] * h;
+			store.z[i] += store.vz[i] * h;
+		}
+	}
+
+	void Evaluate_In_Store(PhysicsStore& store, Octree* tree)
+	{
+		Evaluate(store, store.x.data(), store.y.data(), store.z.data(), store.vx.data(), store.vy.data(), store.vz.data(), store.ax.data(), store.ay.data(), store.az.data(), tree);
+	}
+
+	// A run of kick-drift-kick leapfrog substeps, of length weights[i] * dt each. One weight is plain leapfrog.
+	void Step_Composition(PhysicsStore& store, double dt, Octree* tree, const double* weights, int count)
+	{
+		if (!Forces_Cached(store, tree))
+		{
+			Evaluate_In_Store(store, tree); // First step, or the system was edited => start from fresh forces
+		}
+
+		for (int i = 0; i < count; i++)
+		{
+			double h = weights[i] * dt;
+			Kick(store, 0.5 * h);
+			Drift(store, h);
+			Evaluate_In_Store(store, tree);
+			Kick(store, 0.5 * h);
+		}
+
+		Cache_Forces(store, tree); // The store now holds the acceleration at the new positions: exactly what the next step starts with.
+	}
+
+	bool Forces_Cached(PhysicsStore& store, Octree* tree)
+	{
+		return forces_cached && cached_method == method && cached_revision == store.revision && cached_tree == tree && (tree == NULL || cached_theta == tree->theta);
+	}
+
+	void Cache_Forces(PhysicsStore& store, Octree* tree)
+	{
+		forces_cached = true;
+		cached_method = method;
+		cached_revision = store.revision;
+		cached_tree = tree;
+		cached_theta = tree != NULL ? tree->theta : 0;
+	}
+
+	// Stage state = start state + h * sum over j < count of a[j] * k[j]
+	void Combine_State(PhysicsStore& store, StateBuffer& out, const double* a, int count, double h)
+	{
+		int n = store.Size();
+		for (int i = 0; i < n; i++)
+		{
+			double x = 0, y = 0, z = 0, vx = 0, vy = 0, vz = 0;
+			for (int j = 0; j < count; j++)
+			{
+				if (a[j] == 0)
+				{
+					continue;
+				}
+				x += a[j] * k_pos[j].x[i]; y += a[j] * k_pos[j].y[i]; z += a[j] * k_pos[j].z[i];
+				vx += a[j] * k_vel[j].x[i]; vy += a[j] * k_vel[j].y[i]; vz += a[j] * k_vel[j].z[i];
+			}
+			out.x[i] = store.x[i] + h * x; out.y[i] = store.y[i] + h * y; out.z[i] = store.z[i] + h * z;
+			out.vx[i] = store.vx[i] + h * vx; out.vy[i] = store.vy[i] + h * vy; out.vz[i] = store.vz[i] + h * vz;
+		}
+	}
+
+	// Derivative at a state: velocity is copied, acceleration evaluated
+	void Derivative(PhysicsStore& store, StateBuffer& at, int k, Octree* tree)
+	{
+		k_pos[k].x = at.vx; k_pos[k].y = at.vy; k_pos[k].z = at.vz;
+		Evaluate(store, at.x.data(), at.y.data(), at.z.data(), at.vx.data(), at.vy.data(), at.vz.data(), k_vel[k].x.data(), k_vel[k].y.data(), k_vel[k].z.data(), tree);
+	}
+
+	// Scaled RMS of the embedded error estimate h * sum e[j] * k[j]. <= 1 means the substep meets the tolerance.
+	double Error_Norm(PhysicsStore& store, const double* e, double h)
+	{
+		int n = store.Size();
+		double sum = 0;
+		const double* y0[6] = { store.x.data(), store.y.data(), store.z.data(), store.vx.data(), store.vy.data(), store.vz.data() };
+		const double* y1[6] = { trial.x.data(), trial.y.data(), trial.z.data(), trial.vx.data(), trial.vy.data(), trial.vz.data() };
+		for (int c = 0; c < 6; c++)
+		{
+			for (int i = 0; i < n; i++)
+			{
+				double err = 0;
+				for (int j = 0; j < 7; j++)
+				{
+					if (e[j] == 0)
+					{
+						continue;
+					}
+					const VectorBuffer& k = c < 3 ? k_pos[j] : k_vel[j];
+					const double* kc = (c % 3 == 0) ? k.x.data() : (c % 3 == 1) ? k.y.data() : k.z.data();
+					err += e[j] * kc[i];
+				}
+				double scale = abs_tolerance + rel_tolerance * fmax(fabs(y0[c][i]), fabs(y1[c][i]));
+				double r = h * err / scale;
+				sum += r * r;
+			}
+		}
+		return sqrt(sum / (6.0 * n));
+	}
+
+	void Step_DOPRI5(PhysicsStore& store, double dt, Octree* tree)
+	{
+		// Dormand & Prince (1980) tableau. No stage times (c): nothing here depends on time, only on the state.
+		static const double a[7][6] = {
+			{ 0 },
+			{ 1.0 / 5 },
+			{ 3.0 / 40, 9.0 / 40 },
+			{ 44.0 / 45, -56.0 / 15, 32.0 / 9 },
+			{ 19372.0 / 6561, -25360.0 / 2187, 64448.0 / 6561, -212.0 / 729 },
+			{ 9017.0 / 3168, -355.0 / 33, 46732.0 / 5247, 49.0 / 176, -5103.0 / 18656 },
+			{ 35.0 / 384, 0, 500.0 / 1113, 125.0 / 192, -2187.0 / 6784, 11.0 / 84 } // Also the 5th order weights
+		};
+		static const double e[7] = { 71.0 / 57600, 0, -71.0 / 16695, 71.0 / 1920, -17253.0 / 339200, 22.0 / 525, -1.0 / 40 }; // 5th - 4th order weights
+
+		int n = store.Size();
+		accepted_substeps = 0;
+		rejected_substeps = 0;
+
+		// k1 at the start of the frame. The end of the last frame's final substep if nothing has changed since.
+		k_pos[0].x = store.vx; k_pos[0].y = store.vy; k_pos[0].z = store.vz;
+		if (Forces_Cached(store, tree))
+		{
+			k_vel[0].x = store.ax; k_vel[0].y = store.ay; k_vel[0].z = store.az;
+		}
+		else
+		{
+			Evaluate(store, store.x.data(), store.y.data(), store.z.data(), store.vx.data(), store.vy.data(), store.vz.data(), k_vel[0].x.data(), k_vel[0].y.data(), k_vel[0].z.data(), tree);
+		}
+
+		// Work in lengths of time and carry the direction separately, so a negative time scale runs the system backwards
+		double direction = dt < 0 ? -1 : 1;
+		double span = fabs(dt);
+		double t = 0;
+		double h = (substep > 0 && substep < span) ? substep : span;
+		while (t < span)
+		{
+			bool last = h >= span - t;
+			if (last)
+			{
+				h = span - t;
+			}
+
+			for (int s = 1; s < 7; s++)
+			{
+				Combine_State(store, s < 6 ? stage : trial, a[s], s, direction * h); // Stage 7 is the 5th order answer itself
+				Derivative(store, s < 6 ? stage : trial, s, tree);
+			}
+
+			double err = Error_Norm(store, e, h);
+			bool forced = accepted_substeps + rejected_substeps >= MAX_SUBSTEPS;
+			double factor = err > 0 ? 0.9 * pow(err, -0.2) : 5; // Standard controller, clamped so h changes by at most 5x either way
+			factor = fmin(5.0, fmax(0.2, factor));
+
+			if (err <= 1 || forced)
+			{
+				// Accept: the trial state becomes the state, and k7 (the derivative there) is the next substep's k1
+				store.x = trial.x; store.y = trial.y; store.z = trial.z;
+				store.vx = trial.vx; store.vy = trial.vy; store.vz = trial.vz;
+				std::swap(k_pos[0], k_pos[6]);
+				std::swap(k_vel[0], k_vel[6]);
+				t = last ? span : t + h;
+				accepted_substeps++;
+				if (!last)
+				{
+					substep = h * factor; // Don't let a short final piece of the frame shrink the next frame's first try
+				}
+			}
+			else
+			{
+				rejected_substeps++;
+			}
+			h *= factor;
+		}
+
+		for (int i = 0; i < n; i++)
+		{
+			store.ax[i] = k_vel[0].x[i];
+			store.ay[i] = k_vel[0].y[i];
+			store.az[i] = k_vel[0].z[i];
+		}
+		Cache_Forces(store, tree);
+	}
+
+	void Evaluate_Perturbations(PhysicsStore& store, Octree* tree)
+	{
+		Evaluate(store, store.x.data(), store.y.data(), store.z.data(), store.vx.data(), store.vy.data(), store.vz.data(), perturbation.x.data(), perturbation.y.data(), perturbation.z.data(), tree, false);
+	}
+
+	// Kick with the perturbations, drift along the Kepler orbits, kick again (the second kick's forces are the next step's first)
+	void Step_Wisdom_Holman(PhysicsStore& store, double dt, Octree* tree)
+	{
+		int n = store.Size();
+		perturbation.Resize(n);
+		if (!Forces_Cached(store, tree))
+		{
+			Evaluate_Perturbations(store, tree);
+		}
+
+		for (int i = 0; i < n; i++)
+		{
+			store.vx[i] += perturbation.x[i] * 0.5 * dt;
+			store.vy[i] += perturbation.y[i] * 0.5 * dt;
+			store.vz[i] += perturbation.z[i] * 0.5 * dt;
+		}
+
+		auto drift = [&](int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				if (!Kepler::Drift(store.mu[i], store.x[i], store.y[i], store.z[i], store.vx[i], store.vy[i], store.vz[i], dt))
+				{
+					// Practically never happens (it takes a near collision with the central body), but don't leave the body behind
+					store.x[i] += store.vx[i] * dt; store.y[i] += store.vy[i] * dt; store.z[i] += store.vz[i] * dt;
+				}
+			}
+		};
+		pool.Parallel_For(n, ROWS_PER_CHUNK, drift);
+
+		Evaluate_Perturbations(store, tree);
+		for (int i = 0; i < n; i++)
+		{
+			store.vx[i] += perturbation.x[i] * 0.5 * dt;
+			store.vy[i] += perturbation.y[i] * 0.5 * dt;
+			store.vz[i] += perturbation.z[i] * 0.5 * dt;
+
+			// The store's acceleration is the whole thing, for the inspector
+			double r2 = store.x[i] * store.x[i] + store.y[i] * store.y[i] + store.z[i] * store.z[i];
+			double s = r2 > 0 ? -store.mu[i] / (r2 * sqrt(r2)) : 0;
+			store.ax[i] = perturbation.x[i] + store.x[i] * s;
+			store.ay[i] = perturbation.y[i] + store.y[i] * s;
+			store.az[i] = perturbation.z[i] + store.z[i] * s;
+		}
+		Cache_Forces(store, tree);
+	}
+
+	// Acceleration and jerk of the bodies in list, with everyone at (x, y, z, vx, vy, vz), into (ax, ay, az) and jrk
+	void Evaluate_With_Jerk(PhysicsStore& store, const double* x, const double* y, const double* z, const double* vx, const double* vy, const double* vz, const int* list, int count, double* ax, double* ay, double* az, VectorBuffer& jrk)
+	{
+		int n = store.Size();
+		const double* gm = store.gm.data();
+		const double* mu = store.mu.data();
+		double eps2 = store.softening * store.softening;
+		force_evaluations++;
+
+		auto start = std::chrono::high_resolution_clock::now();
+		auto rows = [&](int begin, int end)
+		{
+			for (int k = begin; k < end; k++)
+			{
+				int i = list[k];
+				double a[3] = { 0, 0, 0 }, j[3] = { 0, 0, 0 };
+
+				//SUN
+				double r2 = x[i] * x[i] + y[i] * y[i] + z[i] * z[i];
+				if (r2 > 0)
+				{
+					double inv_r2 = 1 / r2;
+					double c = -mu[i] * inv_r2 * sqrt(inv_r2);
+					double rv = 3 * (x[i] * vx[i] + y[i] * vy[i] + z[i] * vz[i]) * inv_r2;
+					a[0] = x[i] * c; a[1] = y[i] * c; a[2] = z[i] * c;
+					j[0] = (vx[i] - x[i] * rv) * c; j[1] = (vy[i] - y[i] * rv) * c; j[2] = (vz[i] - z[i] * rv) * c;
+				}
+
+				if (!Forces::EMPTY) // Their jerk is left out: next to gravity's it hardly moves the timestep
+				{
+					vector3 f = { a[0], a[1], a[2] };
+					Add_Forces(mu[i], x[i], y[i], z[i], vx[i], vy[i], vz[i], f);
+					a[0] = f.x; a[1] = f.y; a[2] = f.z;
+				}
+
+				//Others
+				GravityKernel::Full_Row_With_Jerk(i, x, y, z, vx, vy, vz, gm, n, a, j, eps2);
+				ax[i] = a[0]; ay[i] = a[1]; az[i] = a[2];
+				jrk.x[i] = j[0]; jrk.y[i] = j[1]; jrk.z[i] = j[2];
+			}
+		};
+		pool.Parallel_For(count, ROWS_PER_CHUNK, rows);
+		std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+		GravityKernel::Record((long long)count * (n - 1), elapsed.count());
+		pair_evaluations += (long long)count * (n - 1);
+	}
+
+	// Smallest level whose step (frame / 2^level) is no longer than h
+	int Level_For(double h, double frame)
+	{
+		int k = 0;
+		while (k < MAX_LEVEL && frame > h * (double)(1LL << k))
+		{
+			k++;
+		}
+		return k;
+	}
+
+	void Step_Hermite(PhysicsStore& store, double dt)
+	{
+		static const double ETA = 0.02; // Aarseth's accuracy parameter
+		static const double ETA_START = 0.01; // Before there are higher derivatives to go on, from |a| / |jerk| alone
+
+		int n = store.Size();
+		double frame = fabs(dt);
+		bool fresh = hermite_revision != store.revision || (int)jerk.x.size() != n; // Edited, or another method had the last step
+		jerk.Resize(n);
+		next_acceleration.Resize(n);
+		next_jerk.Resize(n);
+		level.resize(n);
+		body_tick.assign(n, 0);
+		due.clear();
+
+		if (fresh)
+		{
+			for (int i = 0; i < n; i++)
+			{
+				due.push_back(i);
+			}
+			Evaluate_With_Jerk(store, store.x.data(), store.y.data(), store.z.data(), store.vx.data(), store.vy.data(), store.vz.data(), due.data(), n, store.ax.data(), store.ay.data(), store.az.data(), jerk);
+		}
+		if (fresh || level_frame != frame)
+		{
+			for (int i = 0; i < n; i++)
+			{
+				double a = sqrt(store.ax[i] * store.ax[i] + store.ay[i] * store.ay[i] + store.az[i] * store.az[i]);
+				double j = sqrt(jerk.x[i] * jerk.x[i] + jerk.y[i] * jerk.y[i] + jerk.z[i] * jerk.z[i]);
+				level[i] = j > 0 ? Level_For(ETA_START * a / j, frame) : 0;
+			}
+			level_frame = frame;
+		}
+
+		const long long total = 1LL << MAX_LEVEL;
+		const double tick = dt / total;
+		int block_steps = 0;
+		long long now = 0;
+		while (now < total)
+		{
+			now = total;
+			for (int i = 0; i < n; i++)
+			{
+				now = std::min(now, body_tick[i] + (total >> level[i]));
+			}
+			due.clear();
+			for (int i = 0; i < n; i++)
+			{
+				if (body_tick[i] + (total >> level[i]) == now)
+				{
+					due.push_back(i);
+				}
+			}
+
+			// Everyone, due or not, predicted forwards to now from their own last step
+			for (int i = 0; i < n; i++)
+			{
+				double d = (now - body_tick[i]) * tick;
+				double d2 = d * d / 2, d3 = d * d * d / 6;
+				stage.x[i] = store.x[i] + store.vx[i] * d + store.ax[i] * d2 + jerk.x[i] * d3;
+				stage.y[i] = store.y[i] + store.vy[i] * d + store.ay[i] * d2 + jerk.y[i] * d3;
+				stage.z[i] = store.z[i] + store.vz[i] * d + store.az[i] * d2 + jerk.z[i] * d3;
+				stage.vx[i] = store.vx[i] + store.ax[i] * d + jerk.x[i] * d2;
+				stage.vy[i] = store.vy[i] + store.ay[i] * d + jerk.y[i] * d2;
+				stage.vz[i] = store.vz[i] + store.az[i] * d + jerk.z[i] * d2;
+			}
+
+			int count = due.size();
+			Evaluate_With_Jerk(store, stage.x.data(), stage.y.data(), stage.z.data(), stage.vx.data(), stage.vy.data(), stage.vz.data(), due.data(), count, next_acceleration.x.data(), next_acceleration.y.data(), next_acceleration.z.data(), next_jerk);
+
+			// Correct the bodies that were due, with the 2nd and 3rd derivatives of a fitted through both ends of their step
+			for (int k = 0; k < count; k++)
+			{
+				int i = due[k];
+				double h = (now - body_tick[i]) * tick;
+				double h2 = h * h, h3 = h2 * h;
+				double* pos[3] = { &store.x[i], &store.y[i], &store.z[i] };
+				double* vel[3] = { &store.vx[i], &store.vy[i], &store.vz[i] };
+				double* acc[3] = { &store.ax[i], &store.ay[i], &store.az[i] };
+				double* jrk[3] = { &jerk.x[i], &jerk.y[i], &jerk.z[i] };
+				const double predicted_pos[3] = { stage.x[i], stage.y[i], stage.z[i] };
+				const double predicted_vel[3] = { stage.vx[i], stage.vy[i], stage.vz[i] };
+				const double a1[3] = { next_acceleration.x[i], next_acceleration.y[i], next_acceleration.z[i] };
+				const double j1[3] = { next_jerk.x[i], next_jerk.y[i], next_jerk.z[i] };
+				double a1_2 = 0, j1_2 = 0, snap_2 = 0, crackle_2 = 0;
+				for (int c = 0; c < 3; c++)
+				{
+					double a0 = *acc[c], j0 = *jrk[c];
+					double snap = (-6 * (a0 - a1[c]) - h * (4 * j0 + 2 * j1[c])) / h2; // 2nd derivative of a, at the start
+					double crackle = (12 * (a0 - a1[c]) + 6 * h * (j0 + j1[c])) / h3; // 3rd derivative of a
+					*pos[c] = predicted_pos[c] + snap * h2 * h2 / 24 + crackle * h3 * h2 / 120;
+					*vel[c] = predicted_vel[c] + snap * h3 / 6 + crackle * h2 * h2 / 24;
+					*acc[c] = a1[c];
+					*jrk[c] = j1[c];
+
+					double snap_end = snap + crackle * h;
+					a1_2 += a1[c] * a1[c]; j1_2 += j1[c] * j1[c]; snap_2 += snap_end * snap_end; crackle_2 += crackle * crackle;
+				}
+
+				// Aarseth's criterion: sqrt(eta (|a| |snap| + |jerk|^2) / (|jerk| |crackle| + |snap|^2))
+				double upper = sqrt(a1_2 * snap_2) + j1_2;
+				double lower = sqrt(j1_2 * crackle_2) + snap_2;
+				int next = lower > 0 ? Level_For(sqrt(ETA * upper / lower), frame) : 0;
+				next = std::max(next, level[i] - 1); // Grow by at most a factor of 2...
+				if (next < level[i] && now % (total >> next) != 0)
+				{
+					next = level[i]; // ...and only when that lands on the bigger step's grid
+				}
+				level[i] = next;
+				body_tick[i] = now;
+			}
+			block_steps++;
+		}
+		accepted_substeps = block_steps;
+		Cache_Forces(store, NULL);
+		hermite_revision = store.revision;
+	}
+
+	// Work out who is integrated relative to whom this step: every satellite to its parent and, if regularising, the lighter
+	// of each close pair to the heavier. Each body joins at most one pair, the tightest pairs first.
+	void Find_Encounters(PhysicsStore& store, double dt)
+	{
+		int n = store.Size();
+		parent_of.resize(n);
+		for (int s = 0; s < n; s++)
+		{
+			parent_of[s] = store.Parent_Slot(s);
+		}
+		encounter_count = 0;
+		if (!regularize)
+		{
+			return;
+		}
+
+		loose.clear();
+		for (int s = 0; s < n; s++)
+		{
+			if (parent_of[s] < 0 && !store.Is_Analytic(store.handle_of_slot[s]))
+			{
+				loose.push_back(s);
+			}
+		}
+
+		// Every pair once, like a direct sum evaluation. Regularisation is for small systems: clouds want softening instead.
+		encounters.clear();
+		double reach = ENCOUNTER_STEPS * fabs(dt);
+		for (int a = 0; a < (int)loose.size(); a++)
+		{
+			int i = loose[a];
+			for (int b = a + 1; b < (int)loose.size(); b++)
+			{
+				int j = loose[b];
+				double mu2 = store.gm[i] + store.gm[j];
+				if (mu2 <= 0)
+				{
+					continue;
+				}
+				double dx = store.x[j] - store.x[i], dy = store.y[j] - store.y[i], dz = store.z[j] - store.z[i];
+				double r2 = dx * dx + dy * dy + dz * dz;
+				double r3 = r2 * sqrt(r2);
+				if (r3 >= mu2 * reach * reach)
+				{
+					continue; // Slow enough for the method to follow
+				}
+				// The pair has to be inside its Hill sphere, or the central body's tide would be pulling it apart faster than
+				// the pair orbits itself, and then there is no binary to speak of
+				double mu = store.mu[i];
+				double R2 = store.x[i] * store.x[i] + store.y[i] * store.y[i] + store.z[i] * store.z[i];
+				if (mu > 0 && 3 * mu * r3 >= mu2 * R2 * sqrt(R2))
+				{
+					continue;
+				}
+				bool i_heavier = store.gm[i] >= store.gm[j]; // Ties go to the lower slot, so parents can never form a loop
+				encounters.push_back({ sqrt(r3 / mu2), i_heavier ? j : i, i_heavier ? i : j });
+			}
+		}
+
+		std::sort(encounters.begin(), encounters.end(), [](const Encounter& a, const Encounter& b) { return a.time < b.time; });
+		for (const Encounter& e : encounters)
+		{
+			if (parent_of[e.lighter] >= 0)
+			{
+				continue; // Already in a tighter pair
+			}
+			parent_of[e.lighter] = e.heavier;
+			encounter_count++;
+		}
+	}
+
+	// Sort out who is whose satellite. Returns false (and touches nothing else) if there are no satellites.
+	bool Gather_Top_Level(PhysicsStore& store)
+	{
+		int n = store.Size();
+		top_slot.clear();
+		top_index.assign(n, -1);
+		depth.assign(n, 0);
+		ancestor.resize(n);
+		for (int s = 0; s < n; s++)
+		{
+			int a = s;
+			int p = parent_of[s];
+			while (p >= 0 && depth[s] < MAX_DEPTH)
+			{
+				a = p;
+				depth[s]++;
+				p = parent_of[p];
+			}
+			ancestor[s] = a;
+			if (depth[s] == 0)
+			{
+				top_index[s] = top_slot.size();
+				top_slot.push_back(s);
+			}
+		}
+		if ((int)top_slot.size() == n)
+		{
+			return false;
+		}
+
+		// Mass weighted sums over each family, divided through below
+		int m = top_slot.size();
+		top.x.assign(m, 0); top.y.assign(m, 0); top.z.assign(m, 0);
+		top.vx.assign(m, 0); top.vy.assign(m, 0); top.vz.assign(m, 0);
+		top.ax.resize(m); top.ay.resize(m); top.az.resize(m);
+		top.gm.assign(m, 0); top.mu.resize(m);
+		for (int s = 0; s < n; s++)
+		{
+			int i = top_index[ancestor[s]];
+			double gm = store.gm[s];
+			top.x[i] += store.x[s] * gm; top.y[i] += store.y[s] * gm; top.z[i] += store.z[s] * gm;
+			top.vx[i] += store.vx[s] * gm; top.vy[i] += store.vy[s] * gm; top.vz[i] += store.vz[s] * gm;
+			top.gm[i] += gm;
+		}
+		for (int i = 0; i < m; i++)
+		{
+			int s = top_slot[i];
+			if (top.gm[i] > 0)
+			{
+				double w = 1 / top.gm[i];
+				top.x[i] *= w; top.y[i] *= w; top.z[i] *= w;
+				top.vx[i] *= w; top.vy[i] *= w; top.vz[i] *= w;
+			}
+			else
+			{
+				top.x[i] = store.x[s]; top.y[i] = store.y[s]; top.z[i] = store.z[s]; // Massless family: no barycentre to speak of
+				top.vx[i] = store.vx[s]; top.vy[i] = store.vy[s]; top.vz[i] = store.vz[s];
+			}
+			top.ax[i] = store.ax[s]; top.ay[i] = store.ay[s]; top.az[i] = store.az[s];
+			top.mu[i] = store.mu[s];
+		}
+		start_barycentre.x = top.x; start_barycentre.y = top.y; start_barycentre.z = top.z;
+		start_barycentre.vx = top.vx; start_barycentre.vy = top.vy; start_barycentre.vz = top.vz;
+		top.revision = store.revision; // Cached forces only depend on the top level, so they stay good as long as the store does
+		top.softening = store.softening;
+		return true;
+	}
+
+	// Move each top level body along with its family's barycentre, keeping its offset from it for now (see Settle_Families)
+	void Scatter_Top_Level(PhysicsStore& store)
+	{
+		for (int i = 0; i < (int)top_slot.size(); i++)
+		{
+			int s = top_slot[i];
+			store.x[s] = top.x[i] + (previous.x[s] - start_barycentre.x[i]);
+			store.y[s] = top.y[i] + (previous.y[s] - start_barycentre.y[i]);
+			store.z[s] = top.z[i] + (previous.z[s] - start_barycentre.z[i]);
+			store.vx[s] = top.vx[i] + (previous.vx[s] - start_barycentre.vx[i]);
+			store.vy[s] = top.vy[i] + (previous.vy[s] - start_barycentre.vy[i]);
+			store.vz[s] = top.vz[i] + (previous.vz[s] - start_barycentre.vz[i]);
+			store.ax[s] = top.ax[i]; store.ay[s] = top.ay[i]; store.az[s] = top.az[i];
+		}
+	}
+
+	// Once the satellites have moved, shift each family as a whole so its barycentre is back where the top level step put it
+	void Settle_Families(PhysicsStore& store)
+	{
+		int n = store.Size();
+		int m = top_slot.size();
+		family_shift.Resize(m);
+		std::fill(family_shift.x.begin(), family_shift.x.end(), 0.0); std::fill(family_shift.y.begin(), family_shift.y.end(), 0.0); std::fill(family_shift.z.begin(), family_shift.z.end(), 0.0);
+		std::fill(family_shift.vx.begin(), family_shift.vx.end(), 0.0); std::fill(family_shift.vy.begin(), family_shift.vy.end(), 0.0); std::fill(family_shift.vz.begin(), family_shift.vz.end(), 0.0);
+		for (int s = 0; s < n; s++)
+		{
+			int i = top_index[ancestor[s]];
+			double gm = store.gm[s];
+			family_shift.x[i] -= store.x[s] * gm; family_shift.y[i] -= store.y[s] * gm; family_shift.z[i] -= store.z[s] * gm;
+			family_shift.vx[i] -= store.vx[s] * gm; family_shift.vy[i] -= store.vy[s] * gm; family_shift.vz[i] -= store.vz[s] * gm;
+		}
+		for (int i = 0; i < m; i++)
+		{
+			// An analytic parent stays on its fixed orbit, and massless families have no barycentre to put anywhere
+			if (top.gm[i] <= 0 || store.Is_Analytic(store.handle_of_slot[top_slot[i]]))
+			{
+				family_shift.x[i] = 0; family_shift.y[i] = 0; family_shift.z[i] = 0;
+				family_shift.vx[i] = 0; family_shift.vy[i] = 0; family_shift.vz[i] = 0;
+				continue;
+			}
+			double w = 1 / top.gm[i];
+			family_shift.x[i] = top.x[i] + family_shift.x[i] * w; family_shift.y[i] = top.y[i] + family_shift.y[i] * w; family_shift.z[i] = top.z[i] + family_shift.z[i] * w;
+			family_shift.vx[i] = top.vx[i] + family_shift.vx[i] * w; family_shift.vy[i] = top.vy[i] + family_shift.vy[i] * w; family_shift.vz[i] = top.vz[i] + family_shift.vz[i] * w;
+		}
+		for (int s = 0; s < n; s++)
+		{
+			int i = top_index[ancestor[s]];
+			store.x[s] += family_shift.x[i]; store.y[s] += family_shift.y[i]; store.z[s] += family_shift.z[i];
+			store.vx[s] += family_shift.vx[i]; store.vy[s] += family_shift.vy[i]; store.vz[s] += family_shift.vz[i];
+		}
+	}
+
+	// Acceleration at q (heliocentric) from the central body and every top level body but the family's own, at time fraction f
+	vector3 External(PhysicsStore& store, double mu, double qx, double qy, double qz, int own, double f)
+	{
+		double r2 = qx * qx + qy * qy + qz * qz;
+		double s = r2 > 0 ? -mu / (r2 * sqrt(r2)) : 0;
+		vector3 a = { qx * s, qy * s, qz * s };
+		for (int i = 0; i < (int)top_slot.size(); i++)
+		{
+			int j = top_slot[i];
+			if (j == own)
+			{
+				continue;
+			}
+			// Top level bodies have finished their step, so anywhere during it is somewhere between previous and now
+			double dx = qx - (previous.x[j] + (store.x[j] - previous.x[j]) * f);
+			double dy = qy - (previous.y[j] + (store.y[j] - previous.y[j]) * f);
+			double dz = qz - (previous.z[j] + (store.z[j] - previous.z[j]) * f);
+			double d2 = dx * dx + dy * dy + dz * dz + store.softening * store.softening;
+			double k = d2 > 0 ? -top.gm[i] / (d2 * sqrt(d2)) : 0;
+			a.x += dx * k; a.y += dy * k; a.z += dz * k;
+		}
+		return a;
+	}
+
+	// Everything but the parent's own pull on family[begin, end), in the parent's frame, at time fraction f of the step
+	void Family_Perturbations(PhysicsStore& store, int begin, int end, int p, double f)
+	{
+		// Where the parent is. Parents always finish their step before their satellites start theirs.
+		double px = previous.x[p] + (store.x[p] - previous.x[p]) * f;
+		double py = previous.y[p] + (store.y[p] - previous.y[p]) * f;
+		double pz = previous.z[p] + (store.z[p] - previous.z[p]) * f;
+		int own = depth[p] == 0 ? p : -1; // A top level parent is the frame. Deeper ones' ancestors are just more perturbers.
+		double mu = store.mu[family[begin]];
+		double eps2 = store.softening * store.softening; // Between siblings. The parent's own pull is the exact Kepler part.
+		vector3 frame = External(store, mu, px, py, pz, own, f); // What accelerates the frame itself cancels out
+		double pvx = previous.vx[p] + (store.vx[p] - previous.vx[p]) * f;
+		double pvy = previous.vy[p] + (store.vy[p] - previous.vy[p]) * f;
+		double pvz = previous.vz[p] + (store.vz[p] - previous.vz[p]) * f;
+		if (!Forces::EMPTY)
+		{
+			Add_Forces(mu, px, py, pz, pvx, pvy, pvz, frame);
+		}
+
+		for (int i = begin; i < end; i++)
+		{
+			double rx = relative.x[i], ry = relative.y[i], rz = relative.z[i];
+			vector3 a = External(store, mu, px + rx, py + ry, pz + rz, own, f);
+			if (!Forces::EMPTY)
+			{
+				ForceState s;
+				s.r = { px + rx, py + ry, pz + rz };
+				s.v = { pvx + relative.vx[i], pvy + relative.vy[i], pvz + relative.vz[i] };
+				s.relative_r = { rx, ry, rz };
+				s.relative_v = { relative.vx[i], relative.vy[i], relative.vz[i] };
+				s.parent_radius = store.radius[p];
+				forces.Add(s, mu, a);
+			}
+			a.x -= frame.x; a.y -= frame.y; a.z -= frame.z;
+
+			for (int k = begin; k < end; k++)
+			{
+				if (k == i)
+				{
+					continue;
+				}
+				double gm = store.gm[family[k]];
+				// Direct pull of the sibling...
+				double dx = relative.x[k] - rx, dy = relative.y[k] - ry, dz = relative.z[k] - rz;
+				double d2 = dx * dx + dy * dy + dz * dz + eps2;
+				double kd = d2 > 0 ? gm / (d2 * sqrt(d2)) : 0;
+				// ...less its pull on the parent (the indirect term)
+				double r2 = relative.x[k] * relative.x[k] + relative.y[k] * relative.y[k] + relative.z[k] * relative.z[k] + eps2;
+				double ki = r2 > 0 ? gm / (r2 * sqrt(r2)) : 0;
+				a.x += dx * kd - relative.x[k] * ki;
+				a.y += dy * kd - relative.y[k] * ki;
+				a.z += dz * kd - relative.z[k] * ki;
+			}
+			tidal.x[i] = a.x; tidal.y[i] = a.y; tidal.z[i] = a.z;
+		}
+	}
+
+	// Wisdom-Holman in the parent's frame: Kepler orbits around the parent, kicked by the siblings and the tides
+	void Step_Family(PhysicsStore& store, int begin, int end, double dt)
+	{
+		int p = parent_of[family[begin]];
+
+		// Start relative to where the parent was. Its velocity then is in previous too.
+		double shortest = 0;
+		for (int i = begin; i < end; i++)
+		{
+			int s = family[i];
+			relative.x[i] = store.x[s] - previous.x[p]; relative.y[i] = store.y[s] - previous.y[p]; relative.z[i] = store.z[s] - previous.z[p];
+			relative.vx[i] = store.vx[s] - previous.vx[p]; relative.vy[i] = store.vy[s] - previous.vy[p]; relative.vz[i] = store.vz[s] - previous.vz[p];
+			family_mu[i] = store.gm[p] + store.gm[s];
+
+			// Time scale of the orbit: its period if bound, otherwise how long it takes to cover its own distance
+			double r = sqrt(relative.x[i] * relative.x[i] + relative.y[i] * relative.y[i] + relative.z[i] * relative.z[i]);
+			double v2 = relative.vx[i] * relative.vx[i] + relative.vy[i] * relative.vy[i] + relative.vz[i] * relative.vz[i];
+			double alpha = r > 0 ? 2 / r - v2 / family_mu[i] : 0;
+			double period = alpha > 0 ? 2 * 3.14159265358979323846 / (sqrt(family_mu[i] * alpha) * alpha) : (v2 > 0 ? r / sqrt(v2) : 0);
+			if (period > 0 && (shortest == 0 || period < shortest))
+			{
+				shortest = period;
+			}
+		}
+
+		int substeps = shortest > 0 ? (int)ceil(fabs(dt) * STEPS_PER_ORBIT / shortest) : 1;
+		substeps = std::max(1, std::min(substeps, MAX_SUBSTEPS));
+		double h = dt / substeps;
+
+		Family_Perturbations(store, begin, end, p, 0);
+		for (int k = 0; k < substeps; k++)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				relative.vx[i] += tidal.x[i] * 0.5 * h; relative.vy[i] += tidal.y[i] * 0.5 * h; relative.vz[i] += tidal.z[i] * 0.5 * h;
+				if (!Kepler::Drift(family_mu[i], relative.x[i], relative.y[i], relative.z[i], relative.vx[i], relative.vy[i], relative.vz[i], h))
+				{
+					relative.x[i] += relative.vx[i] * h; relative.y[i] += relative.vy[i] * h; relative.z[i] += relative.vz[i] * h;
+				}
+			}
+			Family_Perturbations(store, begin, end, p, (double)(k + 1) / substeps);
+			for (int i = begin; i < end; i++)
+			{
+				relative.vx[i] += tidal.x[i] * 0.5 * h; relative.vy[i] += tidal.y[i] * 0.5 * h; relative.vz[i] += tidal.z[i] * 0.5 * h;
+			}
+		}
+		force_evaluations += substeps;
+
+		// Back to heliocentric, around where the parent is now
+		for (int i = begin; i < end; i++)
+		{
+			int s = family[i];
+			store.x[s] = store.x[p] + relative.x[i]; store.y[s] = store.y[p] + relative.y[i]; store.z[s] = store.z[p] + relative.z[i];
+			store.vx[s] = store.vx[p] + relative.vx[i]; store.vy[s] = store.vy[p] + relative.vy[i]; store.vz[s] = store.vz[p] + relative.vz[i];
+
+			double r2 = relative.x[i] * relative.x[i] + relative.y[i] * relative.y[i] + relative.z[i] * relative.z[i];
+			double k = r2 > 0 ? -family_mu[i] / (r2 * sqrt(r2)) : 0;
+			store.ax[s] = store.ax[p] + tidal.x[i] + relative.x[i] * k;
+			store.ay[s] = store.ay[p] + tidal.y[i] + relative.y[i] * k;
+			store.az[s] = store.az[p] + tidal.z[i] + relative.z[i] * k;
+		}
+	}
+
+	// Step every family of satellites in its parent's frame, shallowest first, once the top level has had its step
+	void Step_Satellites(PhysicsStore& store, double dt)
+	{
+		int n = store.Size();
+		family.clear();
+		for (int s = 0; s < n; s++)
+		{
+			if (depth[s] > 0)
+			{
+				family.push_back(s);
+			}
+		}
+		std::sort(family.begin(), family.end(), [&](int a, int b)
+		{
+			if (depth[a] != depth[b]) { return depth[a] < depth[b]; }
+			return parent_of[a] < parent_of[b];
+		});
+
+		int m = family.size();
+		relative.Resize(m);
+		tidal.Resize(m);
+		family_mu.resize(m);
+		int begin = 0;
+		while (begin < m)
+		{
+			int end = begin + 1;
+			while (end < m && parent_of[family[end]] == parent_of[family[begin]])
+			{
+				end++;
+			}
+			Step_Family(store, begin, end, dt);
+			begin = end;
+		}
+	}
+
+public:
+	Method method = RK4;
+	Forces forces; // Settings of the force models, if there are any. Reset after changing them.
+	double rel_tolerance = 1E-9; // DOPRI5: allowed error per substep, relative to the size of each position / velocity...
+	double abs_tolerance = 1E-3; // ...plus this much absolute (m, m/s) so values near 0 aren't held to an impossible standard
+	bool regularize = false; // Solve close pairs as binaries (see Find_Encounters)
+
+	/// <summary>
+	/// Advance the whole system by one step.
+	/// </summary>
+	/// <param name="delta">Real time the step covers in milliseconds</param>
+	/// <param name="time_scale">Simulated seconds per real second</param>
+	/// <param name="store">Physics state of every body, advanced in place</param>
+	/// <param name="tree">Barnes-Hut octree to use, NULL for the exact direct sum</param>
+	/// <returns>0 on success</returns>
+	int Step(double delta, double time_scale, PhysicsStore& store, Octree* tree = NULL)
+	{
+		if (time_scale == 0) // If paused, don't update.
+		{
+			return 0;
+		}
+
+		pair_evaluations = 0;
+		force_evaluations = 0;
+		int n = store.Size();
+		if (n == 0)
+		{
+			return 0;
+		}
+
+		double dt = (delta / 1000) * time_scale; //time in seconds
+		previous.x = store.x; previous.y = store.y; previous.z = store.z;
+		previous.vx = store.vx; previous.vy = store.vy; previous.vz = store.vz;
+
+		// With satellites the method only sees the top level
+		Find_Encounters(store, dt);
+		if (parent_of != last_parent_of)
+		{
+			forces_cached = false; // The top level has different bodies in it now
+			hermite_revision = -1;
+			last_parent_of = parent_of;
+		}
+		bool hierarchy = Gather_Top_Level(store);
+		PhysicsStore& system = hierarchy ? top : store;
+		int analytic = 0;
+		for (int i = 0; i < store.orbits.Size(); i++)
+		{
+			analytic += parent_of[store.Slot(store.orbits.handle[i])] < 0 ? 1 : 0;
+		}
+		n = system.Size();
+		Resize_Buffers(n);
+
+		// Yoshida (1990) composition weights. Symmetric, so the composed step is time reversible like leapfrog itself.
+		static const double cbrt2 = 1.2599210498948732; // 2^(1/3)
+		static const double y4_1 = 1 / (2 - cbrt2);
+		static const double y4_0 = -cbrt2 / (2 - cbrt2);
+		static const double yoshida4[3] = { y4_1, y4_0, y4_1 };
+		static const double y6_1 = -1.17767998417887, y6_2 = 0.235573213359357, y6_3 = 0.784513610477560; // Solution A
+		static const double y6_0 = 1 - 2 * (y6_1 + y6_2 + y6_3);
+		static const double yoshida6[7] = { y6_3, y6_2, y6_1, y6_0, y6_1, y6_2, y6_3 };
+		static const double leapfrog[1] = { 1 };
+
+		switch (analytic == n ? METHOD_COUNT : method) // Every body analytic => nothing to integrate
+		{
+		case METHOD_COUNT:
+			break;
+		case LEAPFROG:
+			Step_Composition(system, dt, tree, leapfrog, 1);
+			break;
+		case YOSHIDA4:
+			Step_Composition(system, dt, tree, yoshida4, 3);
+			break;
+		case YOSHIDA6:
+			Step_Composition(system, dt, tree, yoshida6, 7);
+			break;
+		case DOPRI5:
+			Step_DOPRI5(system, dt, tree);
+			break;
+		case WISDOM_HOLMAN:
+			Step_Wisdom_Holman(system, dt, tree);
+			break;
+		case HERMITE:
+			Step_Hermite(system, dt);
+			break;
+		default:
+			Step_RK4(system, dt, tree);
+			break;
+		}
+		if (method != HERMITE)
+		{
+			hermite_revision = -1; // The acceleration in the store is no longer Hermite's, and there is no jerk to go with it
+		}
+		if (hierarchy)
+		{
+			Scatter_Top_Level(store);
+		}
+		if (store.orbits.Size() > 0)
+		{
+			store.Advance_Analytic(dt);
+			forces_cached = false; // They were evaluated with the analytic bodies where the method had put them
+			hermite_revision = -1;
+		}
+		if (hierarchy)
+		{
+			Step_Satellites(store, dt);
+			Settle_Families(store);
+		}
+		previous_revision = store.revision;
+
+		return 0;
+	}
+
+	static std::string Method_Name(Method m)
+	{
+		switch (m)
+		{
+		case LEAPFROG: return "Leapfrog";
+		case YOSHIDA4: return "Yoshida 4";
+		case YOSHIDA6: return "Yoshida 6";
+		case DOPRI5: return "Dormand-Prince 5(4)";
+		case WISDOM_HOLMAN: return "Wisdom-Holman";
+		case HERMITE: return "Hermite block steps";
+		default: return "RK4";
+		}
+	}
+
+	/// <summary>
+	/// Pick the integration method. Anything out of range (an old or corrupt save) falls back to RK4.
+	/// </summary>
+	void Set_Method(int m)
+	{
+		method = (m >= 0 && m < METHOD_COUNT) ? (Method)m : RK4;
+	}
+
+	/// <summary>
+	/// Forget everything carried over from earlier steps: cached forces (and Wisdom-Holman's perturbations), Hermite's jerk
+	/// and levels, DOPRI5's substep length and the previous positions. The next step starts afresh, as after an edit to the
+	/// store. Needed whenever the forces change in a way the store's revision can't show, such as the force model settings.
+	/// </summary>
+	void Reset()
+	{
+		forces_cached = false;
+		hermite_revision = -1;
+		level_frame = 0;
+		substep = 0;
+		last_parent_of.clear();
+		previous_revision = -1;
+	}
+
+	/// <summary>
+	/// Positions before the last step, for drawing part way through it. Only meaningful while Has_Previous.
+	/// </summary>
+	const StateBuffer& Get_Previous()
+	{
+		return previous;
+	}
+
+	// True if nothing has edited the store since the last step, so Get_Previous still lines up with it slot for slot
+	bool Has_Previous(PhysicsStore& store)
+	{
+		return previous_revision == store.revision && (int)previous.x.size() == store.Size();
+	}
+
+	/// <summary>
+	/// Number of persistent worker threads for force evaluation. 0 runs it all on the calling thread, with the same result.
+	/// </summary>
+	void Set_Worker_Count(int count)
+	{
+		if (count < 0)
+		{
+			count = 0;
+		}
+		if (count != pool.Size())
+		{
+			pool.Resize(count);
+		}
+	}
+
+	int Get_Worker_Count()
+	{
+		return pool.Size();
+	}
+
+	long long Get_Pair_Evaluations()
+	{
+		return pair_evaluations;
+	}
+
+	int Get_Force_Evaluations()
+	{
+		return force_evaluations;
+	}
+
+	// DOPRI5 substeps taken / thrown away over the last step
+	int Get_Accepted_Substeps()
+	{
+		return accepted_substeps;
+	}
+
+	int Get_Rejected_Substeps()
+	{
+		return rejected_substeps;
+	}
+
+	// Close pairs solved as binaries in the last step
+	int Get_Encounters()
+	{
+		return encounter_count;
+	}
+};
+
+typedef BasicSystemIntegrator<> SystemIntegrator;
+
+#endif /*SYSTEMINTEGRATOR_H*/
@@ -0,0 +1,220 @@
+#pragma once
+#ifndef TESTPARTICLES_H
+#define TESTPARTICLES_H
+
+#include <vector>
+#include <random>
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+#include "PhysicsState.h"
+#include "GravityKernel.h"
+#include "WorkerPool.h"
+
+/*
+	Massless test particles: asteroid belts, rings, debris. They feel the central body and every body in the store but pull
+	on nothing, so a step costs (bodies + 1) x particles rather than particles squared, and they have no Body (no inspector,
+	no label, no mesh) - just positions and velocities in arrays of their own, drawn as points.
+
+	They are stepped after the bodies, with drift-kick-drift leapfrog: half a drift, a kick from the bodies where they were
+	half way through the step (the average of where they started and ended up), and the other half drift. That is second
+	order and symplectic like the bodies' own leapfrog, so a belt keeps its shape over millions of steps. Particles are
+	worked on in chunks that fit in cache, across the workers, and within a chunk by the field kernels (see GravityKernel).
+
+	They aren't part of the timeline's checkpoints (a million particles is 48 MB a checkpoint): seeking moves the bodies only.
+*/
+class TestParticles
+{
+private:
+	static const int CHUNK = 512; // Particles at a time: positions and accelerations of a chunk stay in L1
+
+	// Bodies pulling on the particles this step, with the central body first
+	std::vector<double> bx, by, bz, bgm;
+	std::vector<double> start_x, start_y, start_z; // Where the bodies were at the start of the step
+
+	WorkerPool pool;
+	long long interactions = 0; // In the last step
+
+	void Drift(int begin, int end, double h)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			x[i] += vx[i] * h;
+			y[i] += vy[i] * h;
+			z[i] += vz[i] * h;
+		}
+	}
+
+	// Position and velocity on an orbit of the given elements, around a body of G * mass mu at the origin
+	static void From_Elements(double mu, double a, double e, double inclination, double node, double periapsis, double M, vector3& r, vector3& v)
+	{
+		double E = M;
+		for (int k = 0; k < 32; k++) // Newton on Kepler's equation. Belts aren't very eccentric, so this is quick.
+		{
+			double f = E - e * sin(E) - M;
+			E -= f / (1 - e * cos(E));
+			if (fabs(f) < 1E-14)
+			{
+				break;
+			}
+		}
+		double b = a * sqrt(1 - e * e);
+		double px = a * (cos(E) - e), qy = b * sin(E); // In the orbit's own plane
+		double k = sqrt(mu / a) / (1 - e * cos(E)); // a * dE/dt
+		double pvx = -k * sin(E), qvy = k * sqrt(1 - e * e) * cos(E);
+
+		// Rotate by periapsis, inclination, then node
+		double cw = cos(periapsis), sw = sin(periapsis), ci = cos(inclination), si = sin(inclination), cn = cos(node), sn = sin(node);
+		double xx = cn * cw - sn * sw * ci, xy = -cn * sw - sn * cw * ci;
+		double yx = sn * cw + cn * sw * ci, yy = -sn * sw + cn * cw * ci;
+		double zx = sw * si, zy = cw * si;
+		r = { xx * px + xy * qy, yx * px + yy * qy, zx * px + zy * qy };
+		v = { xx * pvx + xy * qvy, yx * pvx + yy * qvy, zx * pvx + zy * qvy };
+	}
+
+public:
+	std::vector<double> x, y, z; // Position (m)
+	std::vector<double> vx, vy, vz; // Velocity (m/s)
+
+	int Size()
+	{
+		return x.size();
+	}
+
+	void Clear()
+	{
+		x.clear(); y.clear(); z.clear();
+		vx.clear(); vy.clear(); vz.clear();
+	}
+
+	void Add(vector3 p, vector3 v)
+	{
+		x.push_back(p.x); y.push_back(p.y); z.push_back(p.z);
+		vx.push_back(v.x); vy.push_back(v.y); vz.push_back(v.z);
+	}
+
+	/// <summary>
+	/// Scatter particles on random orbits around the central body, like the main asteroid belt.
+	/// </summary>
+	/// <param name="mu">G * mass of the central body</param>
+	/// <param name="inner">Smallest semi-major axis (m)</param>
+	/// <param name="outer">Largest semi-major axis (m)</param>
+	/// <param name="max_e">Eccentricities are spread evenly up to this</param>
+	/// <param name="max_inclination">Inclinations likewise (rad)</param>
+	void Add_Belt(int count, double mu, double inner, double outer, double max_e, double max_inclination, unsigned seed)
+	{
+		const double pi = 3.14159265358979323846;
+		std::mt19937_64 random(seed);
+		std::uniform_real_distribution<double> unit(0, 1);
+		for (int k = 0; k < count; k++)
+		{
+			double a = inner + (outer - inner) * unit(random);
+			vector3 r, v;
+			From_Elements(mu, a, max_e * unit(random), max_inclination * unit(random), 2 * pi * unit(random), 2 * pi * unit(random), 2 * pi * unit(random), r, v);
+			Add(r, v);
+		}
+	}
+
+	/// <summary>
+	/// Scatter particles on circular orbits around a body, like a planet's rings, in the plane of the simulation.
+	/// </summary>
+	/// <param name="centre">Position of the body</param>
+	/// <param name="velocity">Velocity of the body</param>
+	/// <param name="gm">G * mass of the body</param>
+	/// <param name="inner">Inner edge of the ring (m)</param>
+	/// <param name="outer">Outer edge (m)</param>
+	/// <param name="thickness">Particles are spread this far either side of the plane (m)</param>
+	void Add_Ring(int count, vector3 centre, vector3 velocity, double gm, double inner, double outer, double thickness, unsigned seed)
+	{
+		const double pi = 3.14159265358979323846;
+		std::mt19937_64 random(seed);
+		std::uniform_real_distribution<double> unit(0, 1);
+		for (int k = 0; k < count; k++)
+		{
+			double r = sqrt(inner * inner + (outer * outer - inner * inner) * unit(random)); // Even per unit area
+			double angle = 2 * pi * unit(random);
+			double speed = sqrt(gm / r);
+			vector3 offset = { r * cos(angle), r * sin(angle), thickness * (2 * unit(random) - 1) };
+			vector3 orbit = { -speed * sin(angle), speed * cos(angle), 0 };
+			Add(centre + offset, velocity + orbit);
+		}
+	}
+
+	/// <summary>
+	/// Note where the bodies are before they are stepped. Call before the bodies' step, then Step after it.
+	/// </summary>
+	void Begin_Step(const PhysicsStore& store)
+	{
+		start_x = store.x; start_y = store.y; start_z = store.z;
+	}
+
+	/// <summary>
+	/// Move every particle on by dt, given the bodies have just been moved on by the same dt.
+	/// </summary>
+	/// <param name="store">Bodies at the end of the step</param>
+	/// <param name="mu">G * mass of the central body</param>
+	void Step(double dt, const PhysicsStore& store, double mu)
+	{
+		interactions = 0;
+		int n = Size();
+		if (n == 0 || dt == 0)
+		{
+			return;
+		}
+
+		// Bodies half way through the step. If the bodies changed (a merge, say), their end position will have to do.
+		int m = store.x.size();
+		bool started = (int)start_x.size() == m;
+		bx.resize(m + 1); by.resize(m + 1); bz.resize(m + 1); bgm.resize(m + 1);
+		bx[0] = 0; by[0] = 0; bz[0] = 0; bgm[0] = mu;
+		for (int j = 0; j < m; j++)
+		{
+			bx[j + 1] = started ? (start_x[j] + store.x[j]) / 2 : store.x[j];
+			by[j + 1] = started ? (start_y[j] + store.y[j]) / 2 : store.y[j];
+			bz[j + 1] = started ? (start_z[j] + store.z[j]) / 2 : store.z[j];
+			bgm[j + 1] = store.gm[j];
+		}
+		double eps2 = store.softening * store.softening;
+
+		auto start = std::chrono::high_resolution_clock::now();
+		auto chunks = [&](int begin, int end)
+		{
+			double ax[CHUNK], ay[CHUNK], az[CHUNK];
+			for (int c = begin; c < end; c += CHUNK)
+			{
+				int count = std::min(CHUNK, end - c);
+				Drift(c, c + count, dt / 2);
+				std::fill(ax, ax + count, 0.0); std::fill(ay, ay + count, 0.0); std::fill(az, az + count, 0.0);
+				GravityKernel::Field(&bx[0], &by[0], &bz[0], &bgm[0], 1, &x[c], &y[c], &z[c], count, ax, ay, az); // Central body: never softened
+				GravityKernel::Field(&bx[1], &by[1], &bz[1], &bgm[1], m, &x[c], &y[c], &z[c], count, ax, ay, az, eps2);
+				for (int i = 0; i < count; i++)
+				{
+					vx[c + i] += ax[i] * dt;
+					vy[c + i] += ay[i] * dt;
+					vz[c + i] += az[i] * dt;
+				}
+				Drift(c, c + count, dt / 2);
+			}
+		};
+		pool.Parallel_For(n, 16 * CHUNK, chunks);
+		interactions = (long long)n * (m + 1);
+		std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+		GravityKernel::Record(interactions, elapsed.count());
+	}
+
+	// Particle-body interactions in the last step
+	long long Get_Interactions()
+	{
+		return interactions;
+	}
+
+	void Set_Worker_Count(int count)
+	{
+		if (std::max(0, count) != pool.Size())
+		{
+			pool.Resize(std::max(0, count));
+		}
+	}
+};
+
+#endif /*TESTPARTICLES_H*/
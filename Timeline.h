@@ -0,0 +1,334 @@
+#pragma once
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include "PhysicsState.h"
+
+/*
+	Checkpoints of the physics state taken every few steps as the simulation runs, so it can go back to any earlier time:
+	restore the last checkpoint at or before it and integrate forward from there. That is at most one checkpoint interval
+	of steps, however far back the time is, so seeking back a simulated year costs about as much as seeking back a minute.
+
+	A checkpoint only holds what changes from step to step (positions, velocities, masses, sizes, parents, fixed orbits),
+	packed slot by slot. Which body is in which slot is kept once for the whole timeline, and adding or removing a body
+	(including a merge) clears the timeline, since the GUI has no way of bringing back bodies it has deleted.
+
+	The checkpoints live in a fixed ring, sized from a memory budget when the first one is taken, and reused after that.
+	Every checkpoint in it gets room for the current bodies there and then, so recording never allocates once the ring
+	exists, unless more bodies are put on fixed orbits later (their orbits then need more room, once per checkpoint). When
+	the ring fills up, the retention policy says what goes:
+	- KEEP_RECENT overwrites the oldest, so the timeline covers a sliding window of the most recent steps.
+	- THIN_OUT drops every other checkpoint and doubles the interval, so the timeline always goes back to where it was last
+	  cleared, with coarser checkpoints (longer seeks) the longer it runs.
+
+	Checkpoints after the current time are kept until the simulation steps or is edited, so a paused simulation can be
+	scrubbed back and forth. Stepping on from the past starts a new history.
+*/
+class Timeline
+{
+public:
+	enum Retention { KEEP_RECENT, THIN_OUT, RETENTION_COUNT };
+
+	Retention retention = THIN_OUT;
+
+private:
+	static const int VALUES_PER_BODY = 9; // x, y, z, vx, vy, vz, gm, mu, radius
+	static const int BASE_INTERVAL = 30; // Steps between checkpoints after a clear
+	static const int MAX_CHECKPOINTS = 4096; // However small the bodies are. Keeps thinning out cheap.
+
+	struct Checkpoint
+	{
+		double seconds = 0; // Simulated time
+		double step = 0; // Length of the step taken from here (s), to integrate forward again with
+		std::vector<double> values; // VALUES_PER_BODY per slot
+		std::vector<int> parent;
+		double softening = 0;
+
+		// Fixed orbits (see KeplerOrbits)
+		std::vector<int> orbit_handle;
+		std::vector<double> orbit_values; // ORBIT_VALUES per orbit
+	};
+	static const int ORBIT_VALUES = 9; // mean_anomaly, mean_motion, e, px, py, pz, qx, qy, qz
+
+	std::vector<Checkpoint> ring;
+	int first = 0; // Ring index of the oldest checkpoint
+	int count = 0;
+	int capacity = 0; // Checkpoints the budget allows for the current bodies
+	long long checkpoint_bytes = 0; // Each, for the current bodies
+	std::vector<int> layout; // PhysicsStore::handle_of_slot the checkpoints were taken with
+	int interval = BASE_INTERVAL;
+	int since = 0; // Steps since the last checkpoint
+	double budget = 64E6; // Bytes
+
+	Checkpoint& At(int i)
+	{
+		return ring[(first + i) % ring.size()];
+	}
+
+	static long long Checkpoint_Bytes(const PhysicsStore& store)
+	{
+		return (long long)store.x.size() * (VALUES_PER_BODY * sizeof(double) + sizeof(int)) + (long long)store.orbits.handle.size() * (ORBIT_VALUES * sizeof(double) + sizeof(int)) + sizeof(Checkpoint);
+	}
+
+	// Make room in every checkpoint for the store's bodies and fixed orbits, so Take doesn't have to while stepping. Buffers
+	// sized for other bodies are swapped for fresh ones rather than resized, so none keeps more memory than the budget counted.
+	void Size_Ring(const PhysicsStore& store)
+	{
+		size_t n = store.x.size(), m = store.orbits.handle.size();
+		for (Checkpoint& c : ring)
+		{
+			if (c.values.size() != n * VALUES_PER_BODY)
+			{
+				std::vector<double>(n * VALUES_PER_BODY).swap(c.values);
+				std::vector<int>(n).swap(c.parent);
+			}
+			if (c.orbit_handle.size() != m)
+			{
+				std::vector<int>(m).swap(c.orbit_handle);
+				std::vector<double>(m * ORBIT_VALUES).swap(c.orbit_values);
+			}
+		}
+	}
+
+	// Keep every other checkpoint (the oldest included) and take them half as often from now on
+	void Thin_Out()
+	{
+		int kept = (count + 1) / 2;
+		for (int i = 1; i < kept; i++)
+		{
+			std::swap(At(i), At(2 * i)); // Swapping the vectors over, so no copying and no allocation
+		}
+		count = kept;
+		interval *= 2;
+	}
+
+	void Take(Checkpoint& c, const PhysicsStore& store, double seconds, double step)
+	{
+		int n = store.x.size();
+		c.seconds = seconds;
+		c.step = step;
+		c.values.resize(n * VALUES_PER_BODY);
+		double* v = c.values.data();
+		for (int i = 0; i < n; i++, v += VALUES_PER_BODY)
+		{
+			v[0] = store.x[i]; v[1] = store.y[i]; v[2] = store.z[i];
+			v[3] = store.vx[i]; v[4] = store.vy[i]; v[5] = store.vz[i];
+			v[6] = store.gm[i]; v[7] = store.mu[i]; v[8] = store.radius[i];
+		}
+		c.parent = store.parent;
+		c.softening = store.softening;
+
+		const KeplerOrbits& o = store.orbits;
+		int m = o.handle.size();
+		c.orbit_handle = o.handle;
+		c.orbit_values.resize(m * ORBIT_VALUES);
+		v = c.orbit_values.data();
+		for (int i = 0; i < m; i++, v += ORBIT_VALUES)
+		{
+			v[0] = o.mean_anomaly[i]; v[1] = o.mean_motion[i]; v[2] = o.e[i];
+			v[3] = o.px[i]; v[4] = o.py[i]; v[5] = o.pz[i];
+			v[6] = o.qx[i]; v[7] = o.qy[i]; v[8] = o.qz[i];
+		}
+	}
+
+	void Put(const Checkpoint& c, PhysicsStore& store)
+	{
+		int n = store.x.size();
+		const double* v = c.values.data();
+		for (int i = 0; i < n; i++, v += VALUES_PER_BODY)
+		{
+			store.x[i] = v[0]; store.y[i] = v[1]; store.z[i] = v[2];
+			store.vx[i] = v[3]; store.vy[i] = v[4]; store.vz[i] = v[5];
+			store.gm[i] = v[6]; store.mu[i] = v[7]; store.radius[i] = v[8];
+		}
+		store.parent = c.parent;
+		store.softening = c.softening;
+
+		KeplerOrbits& o = store.orbits;
+		int m = c.orbit_handle.size();
+		o.handle = c.orbit_handle;
+		o.mean_anomaly.resize(m); o.mean_motion.resize(m); o.e.resize(m);
+		o.px.resize(m); o.py.resize(m); o.pz.resize(m);
+		o.qx.resize(m); o.qy.resize(m); o.qz.resize(m);
+		o.E.resize(m); o.sin_E.resize(m); o.cos_E.resize(m);
+		v = c.orbit_values.data();
+		for (int i = 0; i < m; i++, v += ORBIT_VALUES)
+		{
+			o.mean_anomaly[i] = v[0]; o.mean_motion[i] = v[1]; o.e[i] = v[2];
+			o.px[i] = v[3]; o.py[i] = v[4]; o.pz[i] = v[5];
+			o.qx[i] = v[6]; o.qy[i] = v[7]; o.qz[i] = v[8];
+		}
+
+		store.revision++; // Everything has moved: cached forces and the previous step no longer apply
+	}
+
+public:
+	/// <summary>
+	/// Forget every checkpoint. The next Record starts a new timeline.
+	/// </summary>
+	void Clear()
+	{
+		count = 0;
+		first = 0;
+		interval = BASE_INTERVAL;
+		since = 0;
+	}
+
+	/// <summary>
+	/// Change how much memory the checkpoints may use. Clears the timeline, which is sized when it starts.
+	/// </summary>
+	void Set_Budget(double bytes)
+	{
+		budget = std::max(0.0, bytes);
+		Clear();
+	}
+
+	/// <summary>
+	/// Drop every checkpoint from after a time, because the state has been changed there and they no longer follow from it.
+	/// </summary>
+	void Truncate(double seconds)
+	{
+		bool dropped = false;
+		while (count > 0 && At(count - 1).seconds >= seconds)
+		{
+			count--;
+			dropped = true;
+		}
+		if (dropped)
+		{
+			since = interval; // Take one straight away where the new history starts
+		}
+	}
+
+	/// <summary>
+	/// Call before every step. Takes a checkpoint of the state about to be stepped from if one is due.
+	/// </summary>
+	/// <param name="store">State at the start of the step</param>
+	/// <param name="seconds">Simulated time of that state</param>
+	/// <param name="step">Length of the step about to be taken (s)</param>
+	/// <param name="now">true to take one whether it's due or not</param>
+	void Record(const PhysicsStore& store, double seconds, double step, bool now = false)
+	{
+		Truncate(seconds);
+		if (count > 0 && since < interval && !now)
+		{
+			since++;
+			return;
+		}
+		if (count > 0 && store.handle_of_slot != layout)
+		{
+			Clear(); // Bodies added or removed since
+		}
+		since = 1;
+
+		if (count == 0)
+		{
+			layout = store.handle_of_slot;
+			checkpoint_bytes = Checkpoint_Bytes(store);
+			capacity = (int)std::max(2LL, std::min((long long)MAX_CHECKPOINTS, (long long)(budget / checkpoint_bytes)));
+			if ((int)ring.size() != capacity)
+			{
+				ring.resize(capacity);
+			}
+			Size_Ring(store);
+		}
+		if (count == capacity)
+		{
+			if (retention == THIN_OUT)
+			{
+				Thin_Out();
+			}
+			else
+			{
+				first = (first + 1) % capacity;
+				count--;
+			}
+		}
+		Take(At(count), store, seconds, step);
+		count++;
+	}
+
+	/// <summary>
+	/// Put the store back to the last checkpoint at or before a time (the oldest, if the time is before that).
+	/// </summary>
+	/// <param name="seconds">Time to go back to</param>
+	/// <param name="store">Restored in place. Must have the same bodies in the same slots as when the checkpoints were taken.</param>
+	/// <param name="from_seconds">Set to the time of the checkpoint restored</param>
+	/// <param name="step">Set to the step length it was stepped on from with, to integrate forward the same way</param>
+	/// <returns>false (and the store is untouched) if there are no checkpoints for these bodies</returns>
+	bool Restore(double seconds, PhysicsStore& store, double& from_seconds, double& step)
+	{
+		if (count > 0 && store.handle_of_slot != layout)
+		{
+			Clear();
+		}
+		if (count == 0)
+		{
+			return false;
+		}
+
+		// Binary search for the last one at or before the time: they are in time order
+		int lo = 0, hi = count - 1;
+		while (lo < hi)
+		{
+			int mid = (lo + hi + 1) / 2;
+			if (At(mid).seconds <= seconds)
+			{
+				lo = mid;
+			}
+			else
+			{
+				hi = mid - 1;
+			}
+		}
+		const Checkpoint& c = At(lo);
+		Put(c, store);
+		from_seconds = c.seconds;
+		step = c.step;
+		return true;
+	}
+
+	int Count()
+	{
+		return count;
+	}
+
+	// Simulated time of the oldest checkpoint
+	double Start()
+	{
+		return count > 0 ? At(0).seconds : 0;
+	}
+
+	// Simulated time of the newest checkpoint
+	double End()
+	{
+		return count > 0 ? At(count - 1).seconds : 0;
+	}
+
+	// Steps between checkpoints at the moment
+	int Interval()
+	{
+		return interval;
+	}
+
+	// Memory the ring takes up, roughly
+	long long Bytes()
+	{
+		return (long long)ring.size() * checkpoint_bytes;
+	}
+
+	static std::string Retention_Name(Retention r)
+	{
+		switch (r)
+		{
+		case KEEP_RECENT: return "Keep Recent";
+		case THIN_OUT: return "Thin Out";
+		default: return "Unknown";
+		}
+	}
+};
+
+#endif /*TIMELINE_H*/
@@ -0,0 +1,166 @@
+#pragma once
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+
+/*
+	A fixed set of worker threads that sleep between jobs, so splitting the force evaluation across cores doesn't cost a thread
+	creation every stage of every frame.
+
+	A job is a range [0, n) chopped into chunks of "grain" items. Workers (and the calling thread, which helps rather than idles)
+	grab chunks off an atomic counter until there are none left. Who ends up doing which chunk changes from run to run, so jobs
+	must only write to their own items: then the result is the same whatever the number of threads.
+*/
+class WorkerPool
+{
+private:
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake; // Workers wait on this for a new job
+	std::condition_variable finished; // The caller waits on this for the workers to finish
+	bool quitting = false;
+	long long job_id = 0; // Bumped for every job so workers can tell a new one from a spurious wake up
+	int busy = 0; // Workers still on the current job
+
+	// Current job. A plain function pointer + context so dispatching doesn't allocate.
+	void (*job_fn)(void*, int, int) = NULL;
+	void* job_ctx = NULL;
+	int job_n = 0;
+	int job_grain = 1;
+	std::atomic<int> next_chunk{ 0 };
+
+	template <typename F>
+	static void Trampoline(void* ctx, int begin, int end)
+	{
+		(*static_cast<F*>(ctx))(begin, end);
+	}
+
+	void Run_Chunks()
+	{
+		while (true)
+		{
+			int begin = next_chunk.fetch_add(1) * job_grain;
+			if (begin >= job_n)
+			{
+				return;
+			}
+			job_fn(job_ctx, begin, std::min(begin + job_grain, job_n));
+		}
+	}
+
+	void Worker_Loop()
+	{
+		long long seen = 0;
+		while (true)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [&]() { return quitting || job_id != seen; });
+				if (quitting)
+				{
+					return;
+				}
+				seen = job_id;
+			}
+
+			Run_Chunks();
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				busy--;
+				if (busy == 0)
+				{
+					finished.notify_one();
+				}
+			}
+		}
+	}
+
+public:
+	WorkerPool(int count = 0)
+	{
+		Resize(count);
+	}
+
+	~WorkerPool()
+	{
+		Resize(0);
+	}
+
+	/// <summary>
+	/// Stop the current workers and start count new ones. 0 means everything runs on the calling thread.
+	/// </summary>
+	void Resize(int count)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			quitting = true;
+		}
+		wake.notify_all();
+		for (std::thread& t : workers)
+		{
+			t.join();
+		}
+		workers.clear();
+
+		quitting = false;
+		for (int i = 0; i < count; i++)
+		{
+			workers.emplace_back([this]() { this->Worker_Loop(); });
+		}
+	}
+
+	int Size()
+	{
+		return workers.size();
+	}
+
+	/// <summary>
+	/// Call fn(ctx, begin, end) over [0, n) in chunks of grain, spread across the workers. Returns when every chunk is done.
+	/// </summary>
+	void Parallel_For(int n, int grain, void (*fn)(void*, int, int), void* ctx)
+	{
+		if (n <= 0)
+		{
+			return;
+		}
+		grain = std::max(grain, 1);
+		if (workers.empty() || n <= grain)
+		{
+			fn(ctx, 0, n); // Not worth waking anyone up
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			job_fn = fn;
+			job_ctx = ctx;
+			job_n = n;
+			job_grain = grain;
+			next_chunk = 0;
+			busy = workers.size();
+			job_id++;
+		}
+		wake.notify_all();
+
+		Run_Chunks(); // Help out
+
+		std::unique_lock<std::mutex> lock(mutex);
+		finished.wait(lock, [&]() { return busy == 0; });
+	}
+
+	// Same again for a lambda taking (begin, end). The lambda must outlive the call, which it does if it's a local.
+	template <typename F>
+	void Parallel_For(int n, int grain, F& f)
+	{
+		Parallel_For(n, grain, &Trampoline<F>, &f);
+	}
+};
+
+#endif /*WORKERPOOL_H*/
@@ -3,7 +3,9 @@
 #ifndef UTILS_H
 #define UTILS_H
 
-#include "OrbitBody.h"
+#include <string>
+#include <sstream>
+#include <utility>
 #include <vector>
 
 //Take two strings and XOR them. String a defines length of output string.
@@ -1,5 +1,8 @@
 #ifndef VEC3_H
 #define VEC3_H
+#include <cmath>
+#include <string>
+
 struct vector3
 {
 	double x, y, z;